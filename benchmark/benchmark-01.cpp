@@ -1,8 +1,13 @@
 // compile with g++ -o benchmark-01 benchmark-01.cpp -lfastforest
 //
 // optimization flag does not matter because fastforest is already compiled
+//
+// usage: benchmark-01 [--perf] [--json results.json]
+//   --perf  reads the cycles, instructions, branch-misses and cache-misses counters around the evaluation loop
+//   --json  writes the results as JSON, for regression tracking
 
 #include "fastforest.h"
+#include "perf_counters.h"
 
 #include <cmath>
 #include <algorithm>
@@ -10,8 +15,23 @@
 #include <numeric>
 #include <iostream>
 #include <ctime>
+#include <string>
+
+int main(int argc, char** argv) {
+    bool usePerf = false;
+    std::string jsonPath;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--perf") {
+            usePerf = true;
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--perf] [--json results.json]" << std::endl;
+            return 1;
+        }
+    }
 
-int main() {
     std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
 
     const auto fastForest = fastforest::load_txt("model.txt", features);
@@ -26,10 +46,14 @@ int main() {
         x = float(x) / RAND_MAX * 10 - 5;
     }
 
+    perf::Counters counters{usePerf};
+
     clock_t begin = clock();
+    counters.start();
     for (int i = 0; i < n; ++i) {
         scores[i] = 1. / (1. + std::exp(-fastForest(input.data() + i * 5)));
     }
+    counters.stop();
     double average = std::accumulate(scores.begin(), scores.end(), 0.0) / scores.size();
     std::cout << average << std::endl;
 
@@ -37,4 +61,17 @@ int main() {
     double elapsedSecs = double(end - begin) / CLOCKS_PER_SEC;
 
     std::cout << "Wall time for inference: " << elapsedSecs << " s" << std::endl;
+
+    perf::Measurement measurement;
+    measurement.name = "fastforest";
+    measurement.nRows = n;
+    measurement.nNodeVisits = perf::countNodeVisits(fastForest, input.data(), n, 5);
+    measurement.seconds = elapsedSecs;
+    measurement.counters = counters.counters();
+    if (usePerf) {
+        perf::print(measurement);
+    }
+    if (!jsonPath.empty()) {
+        perf::writeJson({measurement}, jsonPath);
+    }
 }
@@ -0,0 +1,47 @@
+# Compares the Python bindings of FastForest with xgboost.Booster.inplace_predict on the same model and data,
+# single-threaded and multithreaded, for C- and F-contiguous input. Needs the bindings from python/ on the path and
+# the library in FASTFOREST_LIBRARY, e.g.:
+#
+#     FASTFOREST_LIBRARY=build/libfastforest.so PYTHONPATH=python python benchmark/benchmark-02-python.py
+
+from xgboost import XGBClassifier
+from sklearn.datasets import make_classification
+import numpy as np
+import os
+import time
+
+import fastforest
+
+X, y = make_classification(n_samples=10000, n_features=5, random_state=42, n_classes=2, weights=[0.5])
+
+model = XGBClassifier(n_estimators=1000, objective="binary:logistic").fit(X, y)
+booster = model.get_booster()
+booster.dump_model("model.txt")
+
+forest = fastforest.load_txt("model.txt", ["f" + str(i) for i in range(5)])
+forest.set_metadata(objective="binary:logistic")
+
+X_test = np.random.uniform(-5, 5, size=(1000000, 5)).astype(np.float32)
+
+
+def best_of(func, n=5):
+    times = []
+    for _ in range(n):
+        start_time = time.time()
+        result = func()
+        times.append(time.time() - start_time)
+    return min(times), result
+
+
+n_cores = os.cpu_count()
+
+for layout, data in [("C", X_test), ("F", np.asfortranarray(X_test))]:
+    for n_threads in sorted({1, n_cores}):
+        booster.set_param({"nthread": n_threads})
+        t_xgb, preds_xgb = best_of(lambda: booster.inplace_predict(data))
+        t_ff, preds_ff = best_of(lambda: forest.predict(data, n_threads=n_threads))
+        print(
+            "{0}-contiguous, {1} threads: xgboost {2:.3f} s, fastforest {3:.3f} s, max difference {4:.2e}".format(
+                layout, n_threads, t_xgb, t_ff, np.max(np.abs(preds_xgb - preds_ff))
+            )
+        )
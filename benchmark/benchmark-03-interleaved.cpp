@@ -0,0 +1,133 @@
+// compile with g++ -O2 -o benchmark-03-interleaved benchmark-03-interleaved.cpp -lfastforest
+//
+// Compares FastForest::evaluate_batch with the interleaved traversal for different numbers of interleaved rows, on a
+// random forest that is several times larger than the last-level cache. The forest size in MB can be given as the
+// first argument (default 512).
+//
+// usage: benchmark-03-interleaved [MB] [--perf] [--json results.json]
+//   --perf  reads the cycles, instructions, branch-misses and cache-misses counters around each timed loop
+//   --json  writes the results as JSON, for regression tracking
+
+#include "fastforest.h"
+#include "perf_counters.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // Appends a random tree of the given depth, with the nodes in depth-first order like in the loaded forests.
+    int appendRandomTree(fastforest::FastForest& ff, int depth, int nFeatures, std::mt19937& rng) {
+        std::uniform_int_distribution<unsigned> feature(0, nFeatures - 1);
+        std::normal_distribution<float> value(0.f, 1.f);
+        if (depth == 0) {
+            ff.responses_.push_back(value(rng) * 0.01f);
+            return -static_cast<int>(ff.responses_.size() - 1);
+        }
+        const int index = ff.cutValues_.size();
+        ff.cutIndices_.push_back(feature(rng));
+        ff.cutValues_.push_back(value(rng));
+        ff.leftIndices_.push_back(0);
+        ff.rightIndices_.push_back(0);
+        const int left = appendRandomTree(ff, depth - 1, nFeatures, rng);
+        const int right = appendRandomTree(ff, depth - 1, nFeatures, rng);
+        ff.leftIndices_[index] = left;
+        ff.rightIndices_[index] = right;
+        return index;
+    }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    double megabytes = 512.;
+    bool usePerf = false;
+    std::string jsonPath;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--perf") {
+            usePerf = true;
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (arg[0] != '-') {
+            megabytes = std::atof(arg.c_str());
+        } else {
+            std::cerr << "usage: " << argv[0] << " [MB] [--perf] [--json results.json]" << std::endl;
+            return 1;
+        }
+    }
+    const int depth = 12;
+    const int nFeatures = 20;
+    const int nRows = 2000;
+
+    // 16 bytes per node and 4 per leaf
+    const double treeBytes = ((1 << depth) - 1) * 16. + (1 << depth) * 4.;
+    const int nTrees = std::ceil(megabytes * 1024 * 1024 / treeBytes);
+
+    std::mt19937 rng(42);
+    fastforest::FastForest ff;
+    for (int iTree = 0; iTree < nTrees; ++iTree) {
+        // the root of every tree but the first one is a child, so it can't have index zero
+        ff.rootIndices_.push_back(appendRandomTree(ff, depth, nFeatures, rng));
+    }
+
+    std::vector<float> input(static_cast<std::size_t>(nRows) * nFeatures);
+    std::normal_distribution<float> dist(0.f, 1.f);
+    for (auto& x : input) {
+        x = dist(rng);
+    }
+    std::vector<float> out(nRows);
+    std::vector<float> ref(nRows);
+
+    std::cout << nTrees << " trees of depth " << depth << ", " << megabytes << " MB, " << nRows << " rows"
+              << std::endl;
+
+    // the number of visited nodes is the same for all traversals
+    const unsigned long long nNodeVisits = perf::countNodeVisits(ff, input.data(), nRows, nFeatures);
+    perf::Counters counters{usePerf};
+    std::vector<perf::Measurement> measurements;
+
+    auto timeIt = [&](const char* name, std::function<void()> const& func) {
+        func();  // warm-up
+        auto begin = std::chrono::steady_clock::now();
+        counters.start();
+        func();
+        counters.stop();
+        auto end = std::chrono::steady_clock::now();
+        perf::Measurement measurement;
+        measurement.name = name;
+        measurement.nRows = nRows;
+        measurement.nNodeVisits = nNodeVisits;
+        measurement.seconds = std::chrono::duration<double>(end - begin).count();
+        measurement.counters = counters.counters();
+        if (usePerf) {
+            perf::print(measurement);
+        } else {
+            std::cout << name << ": " << measurement.seconds * 1e6 / nRows << " us per row" << std::endl;
+        }
+        measurements.push_back(measurement);
+    };
+
+    timeIt("evaluate_batch", [&]() { ff.evaluate_batch(input.data(), nRows, nFeatures, ref.data()); });
+    for (int nInterleaved : {1, 2, 4, 8, 16, 32, 64}) {
+        const std::string name = "evaluate_batch_interleaved, " + std::to_string(nInterleaved) + " rows";
+        timeIt(name.c_str(), [&]() {
+            ff.evaluate_batch_interleaved(input.data(), nRows, nFeatures, out.data(), 1, 0.5, 1, nInterleaved);
+        });
+        for (int i = 0; i < nRows; ++i) {
+            if (out[i] != ref[i]) {
+                std::cerr << "the interleaved traversal gives different results" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    if (!jsonPath.empty()) {
+        perf::writeJson(measurements, jsonPath);
+    }
+}
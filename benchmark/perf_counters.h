@@ -0,0 +1,207 @@
+// Hardware performance counters for the benchmarks, read with the Linux perf_event_open system call around the
+// evaluation loops. Counters that can't be opened (missing permissions, see /proc/sys/kernel/perf_event_paranoid,
+// virtual machines without a PMU, or other operating systems) are reported as unavailable instead of failing the
+// benchmark. The results can be written as JSON for regression tracking.
+
+#ifndef FASTFOREST_BENCHMARK_PERF_COUNTERS_H
+#define FASTFOREST_BENCHMARK_PERF_COUNTERS_H
+
+#include "fastforest.h"
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace perf {
+
+    struct Counter {
+        std::string name;
+        int fd = -1;
+        // value of the last measurement, scaled up if the counter was multiplexed, NaN if unavailable
+        double value = NAN;
+    };
+
+    class Counters {
+      public:
+        // Opens the counters for the calling thread if enabled, otherwise they are all unavailable.
+        explicit Counters(bool enabled) {
+            const char* names[] = {"cycles", "instructions", "branch-misses", "cache-misses"};
+#ifdef __linux__
+            const std::uint64_t configs[] = {PERF_COUNT_HW_CPU_CYCLES,
+                                             PERF_COUNT_HW_INSTRUCTIONS,
+                                             PERF_COUNT_HW_BRANCH_MISSES,
+                                             PERF_COUNT_HW_CACHE_MISSES};
+#endif
+            for (int i = 0; i < 4; ++i) {
+                Counter counter;
+                counter.name = names[i];
+#ifdef __linux__
+                if (enabled) {
+                    perf_event_attr attr{};
+                    attr.size = sizeof(attr);
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = configs[i];
+                    attr.disabled = 1;
+                    // user space only, which is allowed with the default perf_event_paranoid setting
+                    attr.exclude_kernel = 1;
+                    attr.exclude_hv = 1;
+                    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                    counter.fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+                }
+#else
+                (void)enabled;
+#endif
+                counters_.push_back(counter);
+            }
+        }
+
+        ~Counters() {
+#ifdef __linux__
+            for (auto const& counter : counters_) {
+                if (counter.fd >= 0) {
+                    close(counter.fd);
+                }
+            }
+#endif
+        }
+        Counters(Counters const&) = delete;
+        Counters& operator=(Counters const&) = delete;
+
+        void start() {
+#ifdef __linux__
+            for (auto const& counter : counters_) {
+                if (counter.fd >= 0) {
+                    ioctl(counter.fd, PERF_EVENT_IOC_RESET, 0);
+                    ioctl(counter.fd, PERF_EVENT_IOC_ENABLE, 0);
+                }
+            }
+#endif
+        }
+
+        void stop() {
+#ifdef __linux__
+            for (auto& counter : counters_) {
+                if (counter.fd < 0) {
+                    continue;
+                }
+                ioctl(counter.fd, PERF_EVENT_IOC_DISABLE, 0);
+                // value, time enabled and time running, see PERF_FORMAT_TOTAL_TIME_*
+                std::uint64_t data[3];
+                if (read(counter.fd, data, sizeof(data)) == sizeof(data) && data[2] > 0) {
+                    counter.value = static_cast<double>(data[0]) * data[1] / data[2];
+                } else {
+                    counter.value = NAN;
+                }
+            }
+#endif
+        }
+
+        std::vector<Counter> const& counters() const { return counters_; }
+
+      private:
+        std::vector<Counter> counters_;
+    };
+
+    // Number of cut nodes that the rows visit in all trees of the forest, to normalize the counters per node.
+    inline unsigned long long countNodeVisits(fastforest::FastForest const& ff,
+                                              const float* rows,
+                                              int nRows,
+                                              int nFeatures) {
+        unsigned long long nVisits = 0;
+        for (int iRow = 0; iRow < nRows; ++iRow) {
+            const float* row = rows + static_cast<std::size_t>(iRow) * nFeatures;
+            for (int index : ff.rootIndices_) {
+                if (index < 0) {
+                    continue;
+                }
+                // the first step is taken unconditionally, because a root can have index zero
+                do {
+                    ++nVisits;
+                    index = row[ff.cutIndices_[index]] > ff.cutValues_[index] ? ff.rightIndices_[index]
+                                                                              : ff.leftIndices_[index];
+                } while (index > 0);
+            }
+        }
+        return nVisits;
+    }
+
+    // One timed evaluation loop with its counters.
+    struct Measurement {
+        std::string name;
+        long nRows = 0;
+        unsigned long long nNodeVisits = 0;
+        double seconds = 0.;
+        std::vector<Counter> counters;
+    };
+
+    inline void print(Measurement const& m, std::ostream& os = std::cout) {
+        os << m.name << ": " << m.seconds / m.nRows * 1e6 << " us per row";
+        if (m.nNodeVisits > 0) {
+            os << ", " << static_cast<double>(m.nNodeVisits) / m.nRows << " nodes visited per row";
+        }
+        os << '\n';
+        std::string unavailable;
+        for (auto const& counter : m.counters) {
+            if (std::isnan(counter.value)) {
+                unavailable += (unavailable.empty() ? "" : ", ") + counter.name;
+                continue;
+            }
+            os << "    " << counter.name << ": ";
+            os << counter.value / m.nRows << " per row";
+            if (m.nNodeVisits > 0) {
+                os << ", " << counter.value / m.nNodeVisits << " per node";
+            }
+            os << '\n';
+        }
+        if (!unavailable.empty()) {
+            os << "    unavailable counters: " << unavailable << '\n';
+        }
+    }
+
+    // Writes the measurements as a JSON array, with null for the unavailable counters.
+    inline void writeJson(std::vector<Measurement> const& measurements, std::string const& path) {
+        std::ofstream os(path);
+        auto number = [&](double x) {
+            if (std::isnan(x)) {
+                os << "null";
+            } else {
+                os << x;
+            }
+        };
+        os.precision(10);
+        os << "[\n";
+        for (std::size_t i = 0; i < measurements.size(); ++i) {
+            auto const& m = measurements[i];
+            os << "  {\"name\": \"" << m.name << "\", \"rows\": " << m.nRows << ", \"node_visits\": " << m.nNodeVisits
+               << ", \"seconds\": " << m.seconds << ", \"counters\": {";
+            for (std::size_t j = 0; j < m.counters.size(); ++j) {
+                auto const& counter = m.counters[j];
+                os << (j ? ", " : "") << "\"" << counter.name << "\": {\"total\": ";
+                number(counter.value);
+                os << ", \"per_row\": ";
+                number(counter.value / m.nRows);
+                os << ", \"per_node\": ";
+                number(m.nNodeVisits > 0 ? counter.value / m.nNodeVisits : NAN);
+                os << "}";
+            }
+            os << "}}" << (i + 1 < measurements.size() ? "," : "") << "\n";
+        }
+        os << "]\n";
+        if (!os) {
+            std::cerr << "can't write " << path << std::endl;
+        }
+    }
+
+}  // namespace perf
+
+#endif
@@ -30,8 +30,13 @@ SOFTWARE.
 #include <vector>
 #include <string>
 #include <array>
+#include <atomic>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <istream>
+#include <memory>
+#include <type_traits>
 
 namespace fastforest {
 
@@ -56,7 +61,206 @@ namespace fastforest {
 
     }
 
+    // Transformations from the raw forest responses to the predictions of the different XGBoost objectives:
+    //  * Logistic: 1/(1+exp(-x)) for binary:logistic
+    //  * Softmax: class probabilities for multi:softmax and multi:softprob
+    //  * Exp: exp(x) for the count:poisson, reg:tweedie and reg:gamma objectives
+    //  * Tanh: tanh(x) for gradient boosted TMVA classifiers (objective tmva:grad)
+    enum class Transform { Identity, Logistic, Softmax, Exp, Tanh };
+
+    // Applies the transformation in place to nRows rows of nOut raw responses each. The transformations use a
+    // vectorized exponential function with a relative error below 1e-7 for arguments in [-87.3, 88.3]. For those
+    // arguments, the relative error of the logistic function is below 2e-7 and the absolute error of tanh below 3e-7.
+    // Arguments outside that range are clamped to it, so Exp saturates at about 2.4e38 instead of overflowing to
+    // infinity, and the logistic function of arguments below -87.3 stays at about 4e-39 instead of going to zero.
+    void transform_inplace(TreeEnsembleResponseType* out, int nRows, int nOut, Transform transform);
+
+#ifdef FASTFOREST_PROFILING
+    // Statistics collected by the instrumented evaluation mode (see FastForest::profile). The per-node vectors are
+    // indexed like the cut arrays of the FastForest and the per-leaf vector like its responses.
+    struct ForestProfile {
+        // number of rows that were evaluated
+        unsigned long nRows = 0;
+
+        // maximum depth of each tree, counted in cut nodes (zero for single-leaf trees)
+        std::vector<int> treeDepths;
+        // number of cut nodes visited summed over all rows, for each tree
+        std::vector<unsigned long> treePathLengths;
+
+        // index of the tree that each node belongs to
+        std::vector<int> nodeTrees;
+        // how often each cut node was visited
+        std::vector<unsigned long> nodeVisits;
+        // how often the right child (the "no" branch of the XGBoost dump) was taken at each cut node
+        std::vector<unsigned long> nodeRightTaken;
+
+        // how often each leaf was reached
+        std::vector<unsigned long> leafVisits;
+
+        double averagePathLength(int iTree) const {
+            return nRows == 0 ? 0. : static_cast<double>(treePathLengths[iTree]) / nRows;
+        }
+
+        // Writes the per-tree and per-node statistics as whitespace separated tables.
+        void write_txt(std::string const& filename) const;
+    };
+#endif
+
+    // Interface for the memory the forest arrays are allocated from, modeled after std::pmr::memory_resource so it
+    // can also be used in C++11 builds.
+    class MemoryResource {
+      public:
+        virtual ~MemoryResource() {}
+
+        void* allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t)) {
+            return do_allocate(bytes, alignment);
+        }
+        void deallocate(void* p, std::size_t bytes, std::size_t alignment = alignof(std::max_align_t)) {
+            do_deallocate(p, bytes, alignment);
+        }
+        bool is_equal(MemoryResource const& other) const noexcept { return do_is_equal(other); }
+
+      private:
+        virtual void* do_allocate(std::size_t bytes, std::size_t alignment) = 0;
+        virtual void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) = 0;
+        virtual bool do_is_equal(MemoryResource const& other) const noexcept { return this == &other; }
+    };
+
+    // The resource used when nothing else is specified, which just uses operator new and delete.
+    MemoryResource* defaultResource();
+    // Places allocations of at least 2 MB on huge pages. Explicit huge pages are used if the system has some
+    // reserved, otherwise transparent huge pages are requested. Smaller allocations go to the default resource.
+    MemoryResource* hugePageResource();
+    // Places all allocations on the memory of the given NUMA node (on huge pages if requested). If the node does not
+    // exist or the system has no NUMA support, the allocations are placed like with the huge page or default resource.
+    MemoryResource* numaResource(int numaNode, bool hugePages = true);
+
+    // Arena that hands out memory from a single buffer and never frees individual allocations, like
+    // std::pmr::monotonic_buffer_resource. When the buffer is exhausted, further chunks are requested upstream.
+    // After release(), all memory is available again. If chunks had to be requested since the last release, the
+    // buffer is grown to the total size that was handed out, so repeating the same allocations (e.g. reloading a
+    // model of the same size) does not request any more memory upstream.
+    class MonotonicResource : public MemoryResource {
+      public:
+        // Uses the caller-supplied buffer first, which has to outlive the resource and is never grown.
+        MonotonicResource(void* buffer, std::size_t size, MemoryResource* upstream = defaultResource());
+        // Allocates an initial buffer of the given size from the upstream resource.
+        explicit MonotonicResource(std::size_t initialSize, MemoryResource* upstream = defaultResource());
+        ~MonotonicResource();
+
+        MonotonicResource(MonotonicResource const&) = delete;
+        MonotonicResource& operator=(MonotonicResource const&) = delete;
+
+        void release();
+
+        MemoryResource* upstream() const { return upstream_; }
+
+      private:
+        struct Chunk {
+            char* data;
+            std::size_t size;
+        };
+
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+        void do_deallocate(void*, std::size_t, std::size_t) override {}
+
+        MemoryResource* upstream_;
+        bool ownsBuffer_;
+        Chunk buffer_;
+        std::vector<Chunk> chunks_;
+        char* current_;
+        char* end_;
+        std::size_t nAllocatedBytes_ = 0;
+    };
+
+    // Number of NUMA nodes of the system, and the NUMA node of the CPU the calling thread currently runs on.
+    int numaNodeCount();
+    int currentNumaNode();
+
+    // Allocator for the forest arrays that forwards to a MemoryResource, like std::pmr::polymorphic_allocator.
+    // Moving and swapping forests carries the resource along, while copies use the default resource unless the
+    // target of a copy assignment already has one.
+    template <class T>
+    class Allocator {
+      public:
+        typedef T value_type;
+        typedef std::true_type propagate_on_container_move_assignment;
+        typedef std::true_type propagate_on_container_swap;
+
+        Allocator() noexcept : resource_{defaultResource()} {}
+        Allocator(MemoryResource* resource) noexcept : resource_{resource} {}
+        template <class U>
+        Allocator(Allocator<U> const& other) noexcept : resource_{other.resource()} {}
+
+        T* allocate(std::size_t n) { return static_cast<T*>(resource_->allocate(n * sizeof(T), alignof(T))); }
+        void deallocate(T* p, std::size_t n) { resource_->deallocate(p, n * sizeof(T), alignof(T)); }
+
+        Allocator select_on_container_copy_construction() const { return Allocator(); }
+
+        MemoryResource* resource() const noexcept { return resource_; }
+
+      private:
+        MemoryResource* resource_;
+    };
+
+    template <class T, class U>
+    bool operator==(Allocator<T> const& a, Allocator<U> const& b) noexcept {
+        return a.resource() == b.resource() || a.resource()->is_equal(*b.resource());
+    }
+
+    template <class T, class U>
+    bool operator!=(Allocator<T> const& a, Allocator<U> const& b) noexcept {
+        return !(a == b);
+    }
+
+    template <class T>
+    using Vector = std::vector<T, Allocator<T>>;
+
+    // Information about the model that is not contained in the node arrays.
+    struct Metadata {
+        // number of outputs per row: the number of classes for multiclass models, otherwise one
+        int nClasses = 1;
+        // raw response that all tree responses are added to
+        TreeEnsembleResponseType baseResponse = defaultBaseResponse;
+        // name of the XGBoost objective, e.g. "binary:logistic", which decides the output transformation (models
+        // loaded from TMVA use "tmva:grad" or "tmva:adaboost")
+        std::string objective;
+        // names of the features in the order they are expected in the input rows
+        std::vector<std::string> features;
+        // Whether the leaves hold one value per output, like the trees that XGBoost trains with
+        // multi_strategy="multi_output_tree". Each leaf index then refers to nClasses consecutive values in the
+        // responses, and every tree contributes to all outputs instead of every nClasses-th tree to each.
+        bool vectorLeaves = false;
+    };
+
+    // The output transformation for an XGBoost or TMVA objective. Throws for unknown objectives, an empty objective means
+    // no transformation.
+    Transform objectiveTransform(std::string const& objective);
+
+    // Sizes of a forest before and after FastForest::simplify.
+    struct SimplifyReport {
+        int nTreesBefore = 0;
+        int nTreesAfter = 0;
+        int nNodesBefore = 0;
+        int nNodesAfter = 0;
+        int nLeavesBefore = 0;
+        int nLeavesAfter = 0;
+        std::size_t bytesBefore = 0;
+        std::size_t bytesAfter = 0;
+    };
+
     struct FastForest {
+        FastForest() = default;
+        // empty forest with the arrays allocated from the given resource
+        explicit FastForest(MemoryResource* resource)
+            : rootIndices_{resource},
+              cutIndices_{resource},
+              cutValues_{resource},
+              leftIndices_{resource},
+              rightIndices_{resource},
+              responses_{resource},
+              categorySets_{resource} {}
+
         TreeEnsembleResponseType operator()(const FeatureType* array,
                                             TreeEnsembleResponseType baseResponse = defaultBaseResponse) const {
             TreeEnsembleResponseType out{0.};
@@ -70,6 +274,7 @@ namespace fastforest {
             // static softmax interface: no manual memory allocation, but requires to know nClasses at compile time
             static_assert(nClasses >= 3, "nClasses should be >= 3");
             std::array<TreeEnsembleResponseType, nClasses> out{};
+            checkClasses(nClasses);
             evaluate(array, out.data(), nClasses, baseResponse);
             details::softmaxTransformInplace(out.data(), nClasses);
             return out;
@@ -77,32 +282,469 @@ namespace fastforest {
         // dynamic softmax interface with manually allocated std::vector: simple but inefficient
         std::vector<TreeEnsembleResponseType> softmax(
             const FeatureType* array, int nClasses, TreeEnsembleResponseType baseResponse = defaultBaseResponse) const;
+        // dynamic softmax interface with the output vector allocated from the given resource (e.g. an arena)
+        Vector<TreeEnsembleResponseType> softmax(const FeatureType* array,
+                                                 int nClasses,
+                                                 MemoryResource* resource,
+                                                 TreeEnsembleResponseType baseResponse = defaultBaseResponse) const;
         // softmax interface that is not a pure function, but no manual allocation and no compile-time knowledge needed
         void softmax(const FeatureType* array,
                      TreeEnsembleResponseType* out,
                      int nClasses,
                      TreeEnsembleResponseType baseResponse = defaultBaseResponse) const;
 
-        void write_bin(std::string const& filename) const;
+        // Evaluates a row according to the metadata: writes metadata().nClasses responses to out, starting from the
+        // stored base response and with the output transformation of the objective applied.
+        void predict(const FeatureType* array, TreeEnsembleResponseType* out) const;
+        // Same as predict for nRows rows with nFeatures features each, see also evaluate_batch.
+        void predict_batch(
+            const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads = 1) const;
 
-        std::vector<int> rootIndices_;
-        std::vector<CutIndexType> cutIndices_;
-        std::vector<FeatureType> cutValues_;
-        std::vector<int> leftIndices_;
-        std::vector<int> rightIndices_;
-        std::vector<TreeResponseType> responses_;
+        // Sets the metadata after checking that it is consistent with the forest. The metadata of forests loaded
+        // from binary files is already set, for text dumps only the features are known.
+        void set_metadata(Metadata metadata);
+        Metadata const& metadata() const { return metadata_; }
+
+        // Writes the forest with its metadata in the binary format, see load_bin. The compressed variant of the
+        // format is typically several times smaller and is decoded transparently by load_bin.
+        void write_bin(std::string const& filename, bool compress = false) const;
+
+        // Profile-guided layout optimization: evaluates the nRows sample rows (with nFeatures features each, stored
+        // contiguously) and rearranges the nodes of each tree such that the more frequently taken child of each
+        // node directly follows its parent in memory. The predictions of the forest don't change.
+        void reorder(const FeatureType* array, int nRows, int nFeatures);
+
+#ifdef FASTFOREST_PROFILING
+        // Instrumented evaluation: writes the same raw responses as the regular evaluation to out, and records the
+        // visited nodes and leaves in the profile. An empty profile is initialized for this forest on the first call.
+        void profile(const FeatureType* array,
+                     TreeEnsembleResponseType* out,
+                     int nOut,
+                     ForestProfile& profile,
+                     TreeEnsembleResponseType baseResponse = defaultBaseResponse) const;
+#endif
+
+        // Batch interface: evaluates nRows rows with nFeatures features each, stored contiguously, and writes the
+        // nOut raw responses of each row to out. The rows are split in equal chunks over nThreads threads.
+        void evaluate_batch(const FeatureType* array,
+                            int nRows,
+                            int nFeatures,
+                            TreeEnsembleResponseType* out,
+                            int nOut = 1,
+                            TreeEnsembleResponseType baseResponse = defaultBaseResponse,
+                            int nThreads = 1) const;
+
+        // Same as evaluate_batch, but nInterleaved rows at a time walk through each tree together, one level per
+        // round, and the next node of each row is prefetched before moving on to the next row. This keeps several
+        // cache misses in flight for forests that don't fit in the cache, at the cost of some bookkeeping for the
+        // ones that do. The best number of interleaved rows depends on the machine, typically 4 to 16.
+        static constexpr int maxInterleavedRows = 64;
+        void evaluate_batch_interleaved(const FeatureType* array,
+                                        int nRows,
+                                        int nFeatures,
+                                        TreeEnsembleResponseType* out,
+                                        int nOut = 1,
+                                        TreeEnsembleResponseType baseResponse = defaultBaseResponse,
+                                        int nThreads = 1,
+                                        int nInterleaved = 16) const;
+
+        // Same as evaluate_batch, but each tree is evaluated node by node for a whole block of rows instead of row by
+        // row: at every node, the indices of the rows that reach it are partitioned by the cut into the ones for the
+        // left and the right child, and at the leaves the leaf response is added to the outputs of the rows. The
+        // parameters of a node are loaded once per block rather than once per row, and the comparisons at a node don't
+        // depend on each other. With columnMajor, the input holds the nFeatures columns of nRows values each one after
+        // the other, e.g. from a columnar file format, so the values a node compares are read from a single column.
+        void evaluate_batch_partitioned(const FeatureType* array,
+                                        int nRows,
+                                        int nFeatures,
+                                        TreeEnsembleResponseType* out,
+                                        int nOut = 1,
+                                        TreeEnsembleResponseType baseResponse = defaultBaseResponse,
+                                        int nThreads = 1,
+                                        bool columnMajor = false) const;
+
+        // Rebuilds the node and leaf arrays such that the nodes of the trees belonging to each class are contiguous.
+        // The trees keep their order, and for each class the trees are still every nClasses-th tree. The number of
+        // classes is stored in the metadata.
+        void group_classes(int nClasses);
+
+        // Removes redundancy from the forest: splits with two identical subtrees are replaced by the subtree,
+        // identical subtrees and leaves are stored only once and shared by all their parents, and the trees that are
+        // just a constant are folded into one single-leaf tree per class. Like for group_classes, every nClasses-th
+        // tree belongs to the same class, and the number of classes is stored in the metadata. The folded constants
+        // stay in the trees instead of going to Metadata::baseResponse, which is one value for all classes and is
+        // only applied by predict, so the outputs of all evaluation functions only change by the rounding of the
+        // folded constants. Since the other layout passes copy shared subtrees for each parent, simplify should run
+        // after them.
+        SimplifyReport simplify(int nClasses);
+
+        // Moves the forest arrays to memory from the given resource, e.g. hugePageResource().
+        void relocate(MemoryResource* resource);
+
+        Vector<int> rootIndices_;
+        Vector<CutIndexType> cutIndices_;
+        Vector<FeatureType> cutValues_;
+        Vector<int> leftIndices_;
+        Vector<int> rightIndices_;
+        Vector<TreeResponseType> responses_;
+        // Category sets of the categorical splits. The cut value of a categorical node is a NaN with the offset of
+        // its set in this array as payload, and the set is stored as its number of 32 bit words followed by the
+        // bitset words. Rows whose feature value is in the set go right, all others go left like for missing values
+        // in numerical splits. Empty for forests without categorical splits, which are then evaluated without any
+        // check for them.
+        Vector<std::uint32_t> categorySets_;
 
       private:
+        void checkClasses(int nOut) const;
         void evaluate(const FeatureType* array,
                       TreeEnsembleResponseType* out,
                       int nOut,
                       TreeEnsembleResponseType baseResponse) const;
+
+        Metadata metadata_;
+        // output transformation for the objective in the metadata, resolved when the metadata is set
+        Transform transform_ = Transform::Identity;
     };
 
-    FastForest load_txt(std::string const& txtpath, std::vector<std::string>& features);
-    FastForest load_txt(std::istream& is, std::vector<std::string>& features);
-    FastForest load_bin(std::string const& txtpath);
-    FastForest load_bin(std::istream& is);
+    // Keeps one copy of a forest on each NUMA node, so every thread can evaluate the copy in its local memory.
+    struct NumaForest {
+        explicit NumaForest(FastForest const& forest, bool hugePages = true);
+
+        // the replica on the NUMA node of the calling thread
+        FastForest const& local() const;
+
+        // Same as FastForest::evaluate_batch, but each thread evaluates the replica that is local to it.
+        void evaluate_batch(const FeatureType* array,
+                            int nRows,
+                            int nFeatures,
+                            TreeEnsembleResponseType* out,
+                            int nOut = 1,
+                            TreeEnsembleResponseType baseResponse = defaultBaseResponse,
+                            int nThreads = 1) const;
+
+        std::vector<FastForest> replicas_;
+    };
+
+    // A copy of a forest in which each tree is padded to a complete binary tree of its maximum depth, with the leaf
+    // values repeated down the short branches. A row then takes exactly D steps through a tree of depth D, computing
+    // the next node as 2 * index + 1 + (x[feature] > cut), so the loop has no data-dependent exit that could be
+    // mispredicted. The trees are grouped by depth and each group is evaluated by a kernel with the depth as
+    // compile-time constant.
+    //
+    // The padded size grows exponentially with the depth, so trees deeper than maxDepth, and trees whose padded
+    // version would have more than maxBlowup times as many nodes and leaves as the original, keep the regular layout.
+    // So do trees with categorical splits. Forests with vector leaves are not supported.
+    struct CompleteForest {
+        static constexpr int maxSupportedDepth = 16;
+
+        explicit CompleteForest(FastForest const& forest, int maxDepth = 10, double maxBlowup = 4.);
+
+        // Same as FastForest::predict_batch, and the raw responses without the output transformation.
+        void predict_batch(
+            const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads = 1) const;
+        void evaluate_batch(
+            const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads = 1) const;
+
+        Metadata const& metadata() const { return fallback_.metadata(); }
+
+        int n_padded_trees() const { return nPaddedTrees_; }
+        int n_fallback_trees() const { return nFallbackTrees_; }
+
+        // The cut of a padded node, next to the feature index so a step loads a single cache line.
+        struct Node {
+            FeatureType cut;
+            CutIndexType feature;
+        };
+
+        // The trees of one depth, each with 2^depth - 1 nodes in breadth-first order followed by 2^depth leaves.
+        struct Group {
+            int depth;
+            std::vector<int> classes;  // class of each tree
+            Vector<Node> nodes;
+            Vector<TreeResponseType> leaves;
+        };
+
+      private:
+        void evaluateBlock(const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out) const;
+
+        std::vector<Group> groups_;
+        // The trees that are not padded, interleaved by class like in the original forest and padded with zero
+        // trees if necessary, followed by a round of single-leaf trees with the summed constant trees of each class.
+        // Evaluating it initializes the responses.
+        FastForest fallback_;
+        int nPaddedTrees_ = 0;
+        int nFallbackTrees_ = 0;
+    };
+
+    // A compiled copy of a forest in which the child slots that point to leaves hold the leaf values themselves, so
+    // a row reaches the value of a leaf without the final load from the responses array. Each node stores its cut,
+    // feature index and both children together in 16 bytes, with two spare bits of the feature index flagging the
+    // children that are leaves. The nodes keep the order of the original forest, including a layout from reorder.
+    // Single-leaf trees are folded into one constant per class. Forests with vector leaves are not supported.
+    struct InlinedForest {
+        // feature indices have to fit in the bits below the leaf flags
+        static constexpr CutIndexType leftLeafFlag = 1u << 31;
+        static constexpr CutIndexType rightLeafFlag = 1u << 30;
+        static constexpr CutIndexType featureMask = rightLeafFlag - 1;
+
+        explicit InlinedForest(FastForest const& forest);
+
+        // Same as FastForest::predict_batch, and the raw responses starting from the base response in the metadata.
+        void predict_batch(
+            const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads = 1) const;
+        void evaluate_batch(
+            const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads = 1) const;
+
+        Metadata const& metadata() const { return metadata_; }
+
+        struct Node {
+            FeatureType cut;
+            // feature index, with leftLeafFlag and rightLeafFlag set for the children that are leaves
+            CutIndexType feature;
+            // index of the left and right child node, or the bits of the leaf value
+            std::uint32_t children[2];
+        };
+
+      private:
+        template <bool categorical>
+        void evaluateBlock(const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out) const;
+
+        Vector<Node> nodes_;
+        // the category sets of the original forest, see FastForest::categorySets_
+        Vector<std::uint32_t> categorySets_;
+        // root nodes of the trees with at least one cut, class by class, and the start of each class
+        std::vector<std::uint32_t> roots_;
+        std::vector<int> classBegins_;
+        // base response plus the single-leaf trees of each class
+        std::vector<TreeEnsembleResponseType> constants_;
+        Metadata metadata_;
+        Transform transform_;
+    };
+
+    // Incremental evaluation of one row of which only a few features change between evaluations, e.g. when the same
+    // events are rescored for many systematic variations of some inputs. The evaluator indexes which trees cut on
+    // each feature, and keeps the leaf that the current row reaches in every tree together with the summed responses.
+    // Updating some features then only walks the trees that use them again and patches the sums with the differences
+    // of their leaves. The sums are kept in double precision, so the responses agree with the ones of the regular
+    // evaluation up to the rounding of the latter. The evaluator holds the state of one row, so each thread needs its
+    // own.
+    struct DeltaEvaluator {
+        explicit DeltaEvaluator(FastForest const& forest);
+
+        // Evaluates all trees for a row with nFeatures features, which have to include all features the forest cuts
+        // on, and makes it the current row.
+        void set_row(const FeatureType* array, int nFeatures);
+        // Changes features of the current row and walks again only the trees that cut on one of them.
+        void update(int feature, FeatureType value);
+        void update(const int* features, const FeatureType* values, int n);
+
+        // The metadata().nClasses responses of the current row, like FastForest::predict, and the raw responses
+        // starting from the base response in the metadata.
+        void predict(TreeEnsembleResponseType* out) const;
+        void evaluate(TreeEnsembleResponseType* out) const;
+
+        FeatureType const* row() const { return row_.data(); }
+        // number of trees that cut on the feature, i.e. that an update of it walks again
+        int n_trees_using(int feature) const;
+        // number of tree walks by all updates since the last set_row
+        long n_updated_trees() const { return nUpdatedTrees_; }
+
+        Metadata const& metadata() const { return forest_.metadata(); }
+
+      private:
+        void walkTree(int iTree);
+
+        FastForest forest_;
+        // the trees that cut on feature i are featureTrees_[featureBegins_[i]] to featureTrees_[featureBegins_[i + 1]]
+        std::vector<int> featureBegins_;
+        std::vector<int> featureTrees_;
+        std::vector<FeatureType> row_;
+        // leaf index reached by the current row in each tree
+        std::vector<int> leaves_;
+        std::vector<double> sums_;
+        // the update in which each tree was last walked, so trees that cut on several updated features are walked once
+        std::vector<unsigned int> lastUpdate_;
+        unsigned int nUpdates_ = 0;
+        long nUpdatedTrees_ = 0;
+        Transform transform_;
+    };
+
+    struct CacheOptions {
+        // upper limit for the memory of the cached entries, including their keys and the bookkeeping
+        std::size_t maxBytes = std::size_t{64} << 20;
+        // The entries are split into this many shards by the hash of their key, each with its own lock and
+        // least-recently-used order, so concurrent evaluations rarely wait for each other.
+        int nShards = 16;
+        // Whether the rows are binned before the lookup: each feature value is replaced by the number of cut values
+        // of the forest for that feature that are below it. All rows that take the same path through every tree then
+        // share one entry, and the cached responses are still exact.
+        bool binned = false;
+    };
+
+    struct CacheStatistics {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+        std::size_t entries = 0;
+        std::size_t bytes = 0;
+    };
+
+    // A forest with a bounded cache of the responses of recently evaluated rows in front of it, for services in which
+    // many requests repeat the same rows. A repeated row costs a hash of the row and a lookup instead of a traversal
+    // of the forest. The keys are compared in full, so hash collisions can't mix up rows, and rows that are repeated
+    // within a batch are only evaluated once. All functions can be called concurrently.
+    struct CachedForest {
+        explicit CachedForest(FastForest forest, CacheOptions const& options = CacheOptions());
+        ~CachedForest();
+
+        // Same as FastForest::predict and predict_batch, and the raw responses starting from the base response in the
+        // metadata.
+        void predict(const FeatureType* array, TreeEnsembleResponseType* out) const;
+        void evaluate(const FeatureType* array, TreeEnsembleResponseType* out) const;
+        void predict_batch(
+            const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads = 1) const;
+        void evaluate_batch(
+            const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads = 1) const;
+
+        // The hits, misses and evictions since the construction, and the current number and size of the entries.
+        CacheStatistics statistics() const;
+        // Removes all entries.
+        void clear();
+
+        FastForest const& forest() const { return forest_; }
+        Metadata const& metadata() const { return forest_.metadata(); }
+
+      private:
+        struct Shard;
+
+        void makeKey(const FeatureType* row, std::uint32_t* key) const;
+        // Copies the cached responses of the key to out if there are any, and marks them as recently used.
+        bool lookup(const std::uint32_t* key, std::uint64_t hash, TreeEnsembleResponseType* out) const;
+        // Caches the responses of the key, and evicts the least recently used entries of its shard if it gets too
+        // large.
+        void insert(const std::uint32_t* key, std::uint64_t hash, const TreeEnsembleResponseType* responses) const;
+        void evaluateChunk(const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out) const;
+
+        FastForest forest_;
+        // number of leading features of a row that can change its responses, which make up the key
+        int nKeyFeatures_ = 0;
+        // the sorted numerical cut values of each feature for the binned keys, empty if the rows are not binned
+        std::vector<std::vector<FeatureType>> binEdges_;
+        // features with categorical cuts keep their values in the binned keys
+        std::vector<bool> categorical_;
+        std::vector<std::unique_ptr<Shard>> shards_;
+        std::size_t maxShardBytes_;
+        mutable std::atomic<std::uint64_t> hits_{0};
+        mutable std::atomic<std::uint64_t> misses_{0};
+        Transform transform_;
+    };
+
+    // The kernels a TunedForest can evaluate its forest with: FastForest::evaluate_batch, its interleaved variant
+    // FastForest::evaluate_batch_interleaved, the node-by-node FastForest::evaluate_batch_partitioned, or a
+    // CompleteForest or InlinedForest built from the forest.
+    enum class Engine { Batch, Interleaved, Complete, Inlined, Partitioned };
+
+    // Name of the engine as used in the autotune cache files, e.g. "interleaved".
+    std::string engineName(Engine engine);
+
+    // A forest together with the kernel it is evaluated with, usually chosen by autotune.
+    struct TunedForest {
+        explicit TunedForest(FastForest forest, Engine engine = Engine::Batch, int nInterleaved = 16);
+
+        // Same as FastForest::predict_batch, and the raw responses starting from the base response in the metadata.
+        void predict_batch(
+            const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads = 1) const;
+        void evaluate_batch(
+            const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads = 1) const;
+
+        // Switches the kernel. The CompleteForest and InlinedForest are only built (and kept) while their engine is
+        // selected.
+        void set_engine(Engine engine, int nInterleaved = 16);
+        Engine engine() const { return engine_; }
+        // number of interleaved rows for Engine::Interleaved
+        int n_interleaved() const { return nInterleaved_; }
+
+        FastForest const& forest() const { return forest_; }
+        Metadata const& metadata() const { return forest_.metadata(); }
+
+      private:
+        FastForest forest_;
+        std::unique_ptr<CompleteForest> complete_;
+        std::unique_ptr<InlinedForest> inlined_;
+        Engine engine_ = Engine::Batch;
+        int nInterleaved_ = 16;
+    };
+
+    struct AutotuneOptions {
+        // Sample rows with nFeatures features each, stored contiguously. If there are none, nRows rows are
+        // synthesized from the cut values of the forest, such that every split sees rows on both sides.
+        const FeatureType* rows = nullptr;
+        int nRows = 2048;
+        // number of features per row, by default the number of features in the metadata (or the minimum number of
+        // features the cuts need)
+        int nFeatures = 0;
+        // number of threads the forest will be evaluated with
+        int nThreads = 1;
+        // each kernel is timed this many times and its fastest run counts
+        int nRepetitions = 5;
+        // Path of the model file. If set, the decision is cached in the file modelPath + ".autotune", keyed by the
+        // CPU model, a hash of the forest and the number of threads, and later calls with the same key skip the
+        // timing. The cache is only an optimization, so failures to write it are ignored.
+        std::string modelPath;
+    };
+
+    // Timing of one kernel by autotune, in nanoseconds per row.
+    struct EngineTiming {
+        Engine engine;
+        int nInterleaved;
+        double nsPerRow;
+    };
+
+    // Times the batch kernel, the interleaved kernel with 4 to 32 interleaved rows, the partitioned kernel, the inlined
+    // leaves and the complete trees (if the forest has trees that can be padded, neither of them for vector leaves) on
+    // the sample rows, and returns the forest with the fastest one. The timings are written to timings if given,
+    // which stays empty if the decision was taken from the cache.
+    TunedForest autotune(FastForest forest,
+                         AutotuneOptions const& options = AutotuneOptions(),
+                         std::vector<EngineTiming>* timings = nullptr);
+
+    // The loaders allocate the forest arrays from the given memory resource.
+    //
+    // The binary format starts with a versioned header that contains the metadata of the model and the sizes of the
+    // array types, and ends with a checksum. Binary files written by older versions without header are still
+    // supported.
+    FastForest load_txt(std::string const& txtpath,
+                        std::vector<std::string>& features,
+                        MemoryResource* resource = defaultResource());
+    FastForest load_txt(std::istream& is,
+                        std::vector<std::string>& features,
+                        MemoryResource* resource = defaultResource());
+    FastForest load_bin(std::string const& txtpath, MemoryResource* resource = defaultResource());
+    FastForest load_bin(std::istream& is, MemoryResource* resource = defaultResource());
+
+    // Loader for the text model files of LightGBM. Models with categorical splits or linear trees are not supported.
+    FastForest load_lightgbm_txt(std::string const& txtpath,
+                                 std::vector<std::string>& features,
+                                 MemoryResource* resource = defaultResource());
+    FastForest load_lightgbm_txt(std::istream& is,
+                                 std::vector<std::string>& features,
+                                 MemoryResource* resource = defaultResource());
+
+    // Loader for the JSON model files of XGBoost, with the metadata of the model, categorical splits and the vector
+    // leaves of multi-target models. The features are mapped by name like in load_txt, or filled with the ones of the
+    // model if empty.
+    FastForest load_xgboost_json(std::string const& path,
+                                 std::vector<std::string>& features,
+                                 MemoryResource* resource = defaultResource());
+    FastForest load_xgboost_json(std::istream& is,
+                                 std::vector<std::string>& features,
+                                 MemoryResource* resource = defaultResource());
+
+    // Loader for ONNX models with a TreeEnsembleRegressor or TreeEnsembleClassifier node, e.g. converted from
+    // scikit-learn. The features are the columns of the input tensor.
+    FastForest load_onnx(std::string const& path, MemoryResource* resource = defaultResource());
+    FastForest load_onnx(std::istream& is, MemoryResource* resource = defaultResource());
+
 #ifdef EXPERIMENTAL_TMVA_SUPPORT
     FastForest load_tmva_xml(std::string const& xmlpath, std::vector<std::string>& features);
 #endif
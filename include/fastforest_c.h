@@ -0,0 +1,82 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef FastForestC_h
+#define FastForestC_h
+
+/* C interface of FastForest, for bindings from other languages such as the Python package in python/.
+ *
+ * Functions that can fail return NULL or a negative value, and the error message can then be retrieved with
+ * fastforest_last_error in the same thread. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fastforest_t fastforest_t;
+
+/* message of the last error in the calling thread, or an empty string */
+const char* fastforest_last_error(void);
+
+fastforest_t* fastforest_load_bin(const char* path);
+/* Loads an XGBoost text dump with the given features, in the order the features are expected in the rows. */
+fastforest_t* fastforest_load_txt(const char* path, const char* const* features, int nFeatures);
+fastforest_t* fastforest_load_lightgbm_txt(const char* path, const char* const* features, int nFeatures);
+fastforest_t* fastforest_load_xgboost_json(const char* path, const char* const* features, int nFeatures);
+fastforest_t* fastforest_load_onnx(const char* path);
+void fastforest_free(fastforest_t* forest);
+
+int fastforest_write_bin(const fastforest_t* forest, const char* path, int compress);
+/* see FastForest::set_metadata, the features are kept */
+int fastforest_set_metadata(fastforest_t* forest, int nClasses, float baseResponse, const char* objective);
+
+/* number of outputs per row */
+int fastforest_n_outputs(const fastforest_t* forest);
+/* minimum number of features per row, i.e. one more than the largest feature index used in a cut */
+int fastforest_min_features(const fastforest_t* forest);
+int fastforest_n_feature_names(const fastforest_t* forest);
+const char* fastforest_feature_name(const fastforest_t* forest, int index);
+const char* fastforest_objective(const fastforest_t* forest);
+float fastforest_base_response(const fastforest_t* forest);
+
+/* Same as FastForest::predict_batch for a matrix with arbitrary strides, given in elements: the feature j of row i
+ * is data[i * rowStride + j * featureStride]. Row-major matrices (featureStride 1) are evaluated in place, other
+ * layouts are gathered into row-major blocks of a few hundred rows on the fly. The nRows * fastforest_n_outputs
+ * predictions are written row-major to out. */
+int fastforest_predict(const fastforest_t* forest,
+                       const float* data,
+                       int nRows,
+                       int nFeatures,
+                       long rowStride,
+                       long featureStride,
+                       float* out,
+                       int nThreads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
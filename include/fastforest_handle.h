@@ -0,0 +1,138 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef FastForestHandle_h
+#define FastForestHandle_h
+
+#include "fastforest.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fastforest {
+
+    // Holds the current version of a model for a long-running service and replaces it without interrupting the
+    // evaluations, in the spirit of read-copy-update:
+    //
+    //  * Readers acquire a guard, which pins the current forest until the guard is destroyed. This takes two atomic
+    //    increments and no locks, so any number of threads can evaluate concurrently.
+    //  * A new forest is published with an atomic pointer swap. Readers that acquire a guard afterwards see the new
+    //    forest, while the ones that already hold a guard keep evaluating the old one.
+    //  * The readers are counted separately for even and odd epochs, and each publication starts a new epoch. The
+    //    old forest is freed once the counter of the previous epoch has drained, i.e. after the last reader that
+    //    could have seen it is done.
+    //
+    // The reload functions load the new forest on a background thread and publish it when loading succeeded.
+    class ModelHandle {
+      public:
+        explicit ModelHandle(FastForest forest);
+        ~ModelHandle();
+
+        ModelHandle(ModelHandle const&) = delete;
+        ModelHandle& operator=(ModelHandle const&) = delete;
+
+        // Keeps a version of the forest alive while it exists. Guards must not outlive the handle, and a thread
+        // must not publish while it holds a guard itself, as publishing waits for all readers of the old version.
+        class Guard {
+          public:
+            Guard(Guard&& other) noexcept : handle_{other.handle_}, forest_{other.forest_}, parity_{other.parity_} {
+                other.handle_ = nullptr;
+            }
+            Guard(Guard const&) = delete;
+            Guard& operator=(Guard const&) = delete;
+            Guard& operator=(Guard&&) = delete;
+            ~Guard() {
+                if (handle_) {
+                    handle_->readers_[parity_].count.fetch_sub(1, std::memory_order_release);
+                }
+            }
+
+            FastForest const& operator*() const { return *forest_; }
+            FastForest const* operator->() const { return forest_; }
+
+          private:
+            friend class ModelHandle;
+            Guard(ModelHandle const* handle, FastForest const* forest, int parity)
+                : handle_{handle}, forest_{forest}, parity_{parity} {}
+
+            ModelHandle const* handle_;
+            FastForest const* forest_;
+            int parity_;
+        };
+
+        // Pins the current version of the forest. Lock-free.
+        Guard acquire() const {
+            while (true) {
+                std::uint64_t epoch = epoch_.load();
+                int parity = epoch & 1;
+                readers_[parity].count.fetch_add(1);
+                // If a publication started a new epoch in the meantime, the reader might have registered too late
+                // to be waited for, so it has to try again in the new epoch.
+                if (epoch_.load() == epoch) {
+                    return Guard{this, current_.load(), parity};
+                }
+                readers_[parity].count.fetch_sub(1, std::memory_order_release);
+            }
+        }
+
+        // Replaces the forest and frees the old one after its last reader is done, which this function waits for.
+        void publish(FastForest forest);
+
+        // Loads a forest in the background and publishes it. Errors during loading are reported through the
+        // returned future and leave the current forest in place. A reload that is still running is finished first.
+        std::future<void> reload_bin(std::string const& path, MemoryResource* resource = defaultResource());
+        std::future<void> reload_txt(std::string const& path,
+                                     std::vector<std::string> features,
+                                     MemoryResource* resource = defaultResource());
+
+        // number of publications since the construction of the handle
+        std::uint64_t version() const { return epoch_.load(); }
+
+      private:
+        std::future<void> reloadInBackground(std::function<FastForest()> load);
+
+        std::atomic<FastForest const*> current_;
+        std::atomic<std::uint64_t> epoch_{0};
+        // readers that registered in even and odd epochs, on separate cache lines
+        struct alignas(64) Counter {
+            std::atomic<long> count{0};
+        };
+        mutable Counter readers_[2];
+
+        std::mutex publishMutex_;
+        std::mutex reloadMutex_;
+        std::thread reloadThread_;
+    };
+
+}  // namespace fastforest
+
+#endif
@@ -0,0 +1,185 @@
+"""Python bindings for FastForest, based on the C interface of the shared library (fastforest_c.h).
+
+The evaluation releases the GIL, and NumPy arrays of float32 are evaluated without copies in any memory layout.
+C-contiguous arrays go directly to the batch evaluation, other layouts are gathered in small blocks on the fly.
+
+The library is looked up in the FASTFOREST_LIBRARY environment variable, next to this package and on the system
+library path, in that order.
+"""
+
+import ctypes
+import ctypes.util
+import os
+
+import numpy as np
+
+__all__ = ["FastForest", "load_bin", "load_txt", "load_lightgbm_txt", "load_xgboost_json", "load_onnx"]
+
+
+def _find_library():
+    here = os.path.dirname(os.path.abspath(__file__))
+    candidates = [os.environ.get("FASTFOREST_LIBRARY", "")]
+    candidates += [os.path.join(here, name) for name in ("libfastforest.so", "libfastforest.dylib")]
+    for candidate in candidates:
+        if candidate and os.path.exists(candidate):
+            return candidate
+    system = ctypes.util.find_library("fastforest")
+    if system is None:
+        raise ImportError("libfastforest not found, set FASTFOREST_LIBRARY to its path")
+    return system
+
+
+# ctypes.CDLL releases the GIL for the duration of each call
+_lib = ctypes.CDLL(_find_library())
+
+_forest_p = ctypes.c_void_p
+_float_p = ctypes.POINTER(ctypes.c_float)
+
+_lib.fastforest_last_error.restype = ctypes.c_char_p
+_lib.fastforest_load_bin.argtypes = [ctypes.c_char_p]
+_lib.fastforest_load_bin.restype = _forest_p
+_lib.fastforest_load_txt.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_int]
+_lib.fastforest_load_txt.restype = _forest_p
+_lib.fastforest_load_lightgbm_txt.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_int]
+_lib.fastforest_load_lightgbm_txt.restype = _forest_p
+_lib.fastforest_load_xgboost_json.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_int]
+_lib.fastforest_load_xgboost_json.restype = _forest_p
+_lib.fastforest_load_onnx.argtypes = [ctypes.c_char_p]
+_lib.fastforest_load_onnx.restype = _forest_p
+_lib.fastforest_free.argtypes = [_forest_p]
+_lib.fastforest_free.restype = None
+_lib.fastforest_write_bin.argtypes = [_forest_p, ctypes.c_char_p, ctypes.c_int]
+_lib.fastforest_set_metadata.argtypes = [_forest_p, ctypes.c_int, ctypes.c_float, ctypes.c_char_p]
+for _name in ("n_outputs", "min_features", "n_feature_names"):
+    getattr(_lib, "fastforest_" + _name).argtypes = [_forest_p]
+_lib.fastforest_feature_name.argtypes = [_forest_p, ctypes.c_int]
+_lib.fastforest_feature_name.restype = ctypes.c_char_p
+_lib.fastforest_objective.argtypes = [_forest_p]
+_lib.fastforest_objective.restype = ctypes.c_char_p
+_lib.fastforest_base_response.argtypes = [_forest_p]
+_lib.fastforest_base_response.restype = ctypes.c_float
+_lib.fastforest_predict.argtypes = [
+    _forest_p,
+    _float_p,
+    ctypes.c_int,
+    ctypes.c_int,
+    ctypes.c_long,
+    ctypes.c_long,
+    _float_p,
+    ctypes.c_int,
+]
+
+
+def _check(result):
+    if result is None or (isinstance(result, int) and result < 0):
+        raise RuntimeError(_lib.fastforest_last_error().decode())
+    return result
+
+
+def _names(features):
+    features = [f.encode() for f in features]
+    return (ctypes.c_char_p * len(features))(*features), len(features)
+
+
+class FastForest:
+    """A forest loaded by one of the load functions of this module."""
+
+    def __init__(self, handle):
+        self._handle = _check(handle)
+
+    def __del__(self):
+        if getattr(self, "_handle", None):
+            _lib.fastforest_free(self._handle)
+            self._handle = None
+
+    @property
+    def n_outputs(self):
+        return _lib.fastforest_n_outputs(self._handle)
+
+    @property
+    def min_features(self):
+        """One more than the largest feature index used in a cut."""
+        return _lib.fastforest_min_features(self._handle)
+
+    @property
+    def features(self):
+        n = _lib.fastforest_n_feature_names(self._handle)
+        return [_lib.fastforest_feature_name(self._handle, i).decode() for i in range(n)]
+
+    @property
+    def objective(self):
+        return _lib.fastforest_objective(self._handle).decode()
+
+    @property
+    def base_response(self):
+        return _lib.fastforest_base_response(self._handle)
+
+    def set_metadata(self, n_classes=1, base_response=0.5, objective=""):
+        """Sets the metadata for models loaded from text dumps, see FastForest::set_metadata."""
+        _check(_lib.fastforest_set_metadata(self._handle, n_classes, base_response, objective.encode()))
+
+    def write_bin(self, path, compress=False):
+        _check(_lib.fastforest_write_bin(self._handle, os.fsencode(path), int(compress)))
+
+    def predict(self, X, n_threads=1, out=None):
+        """Predictions for the rows of the 2D array X with the output transformation of the objective applied.
+
+        Arrays of float32 are used without copies, other types are converted first. The result has the shape
+        (n_rows,) for models with one output and (n_rows, n_outputs) otherwise. A preallocated C-contiguous float32
+        array with n_rows * n_outputs elements can be passed as out.
+        """
+        X = np.asarray(X, dtype=np.float32)
+        if X.ndim == 1:
+            X = X.reshape(1, -1)
+        if X.ndim != 2:
+            raise ValueError("expected a 2D array, got {0} dimensions".format(X.ndim))
+        n_rows, n_features = X.shape
+        row_stride, feature_stride = (s // X.itemsize for s in X.strides)
+        if any(s % X.itemsize for s in X.strides):
+            X = np.ascontiguousarray(X)
+            row_stride, feature_stride = n_features, 1
+
+        n_outputs = self.n_outputs
+        shape = (n_rows,) if n_outputs == 1 else (n_rows, n_outputs)
+        if out is None:
+            out = np.empty(shape, dtype=np.float32)
+        elif out.dtype != np.float32 or not out.flags.c_contiguous or out.size != n_rows * n_outputs:
+            raise ValueError("out must be a C-contiguous float32 array with {0} elements".format(n_rows * n_outputs))
+
+        _check(
+            _lib.fastforest_predict(
+                self._handle,
+                X.ctypes.data_as(_float_p),
+                n_rows,
+                n_features,
+                row_stride,
+                feature_stride,
+                out.ctypes.data_as(_float_p),
+                n_threads,
+            )
+        )
+        return out
+
+
+def load_bin(path):
+    return FastForest(_lib.fastforest_load_bin(os.fsencode(path)))
+
+
+def load_txt(path, features):
+    """Loads an XGBoost text dump, with the features in the order of the columns of the input arrays."""
+    names, n = _names(features)
+    return FastForest(_lib.fastforest_load_txt(os.fsencode(path), names, n))
+
+
+def load_lightgbm_txt(path, features=()):
+    names, n = _names(features)
+    return FastForest(_lib.fastforest_load_lightgbm_txt(os.fsencode(path), names, n))
+
+
+def load_xgboost_json(path, features=()):
+    names, n = _names(features)
+    return FastForest(_lib.fastforest_load_xgboost_json(os.fsencode(path), names, n))
+
+
+def load_onnx(path):
+    return FastForest(_lib.fastforest_load_onnx(os.fsencode(path)))
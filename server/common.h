@@ -0,0 +1,254 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef fastforest_server_common_h
+#define fastforest_server_common_h
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+// The wire protocol of the scoring server. All integers and floats are in the byte order of the host, as client and
+// server run on the same machine.
+//
+// A request is a RequestHeader followed by nRows * nFeatures features in row-major order. A request with zero rows
+// asks for the server statistics instead. The reply is a ResponseHeader, followed by nRows * nOutputs predictions
+// and a text of textLength bytes, which is the error message for a failed request and the statistics for a
+// statistics request.
+namespace fastforest {
+    namespace server {
+
+        constexpr std::uint32_t requestMagic = 0x31534646;  // "FFS1"
+
+        struct RequestHeader {
+            std::uint32_t magic;
+            std::uint32_t nRows;
+            std::uint32_t nFeatures;
+        };
+
+        enum class Status : std::uint32_t { Ok = 0, Error = 1 };
+
+        struct ResponseHeader {
+            Status status;
+            std::uint32_t nRows;
+            std::uint32_t nOutputs;
+            std::uint32_t textLength;
+        };
+
+        // Reads or writes exactly n bytes. Returns false if the peer closed the connection.
+        inline bool readAll(int fd, void* data, std::size_t n) {
+            auto p = static_cast<char*>(data);
+            while (n > 0) {
+                ssize_t got = ::read(fd, p, n);
+                if (got < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (got <= 0) {
+                    return false;
+                }
+                p += got;
+                n -= got;
+            }
+            return true;
+        }
+
+        inline bool writeAll(int fd, const void* data, std::size_t n) {
+            auto p = static_cast<const char*>(data);
+            while (n > 0) {
+                ssize_t put = ::send(fd, p, n, MSG_NOSIGNAL);
+                if (put < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (put <= 0) {
+                    return false;
+                }
+                p += put;
+                n -= put;
+            }
+            return true;
+        }
+
+        inline std::runtime_error systemError(std::string const& what) {
+            return std::runtime_error("Error in fastforest-server : " + what + ": " + std::strerror(errno));
+        }
+
+        // The server listens either on a Unix domain socket, given by its path, or on a TCP port of the loopback
+        // interface.
+        struct Endpoint {
+            std::string socketPath;
+            int port = 0;
+
+            std::string str() const {
+                return socketPath.empty() ? "127.0.0.1:" + std::to_string(port) : "unix:" + socketPath;
+            }
+        };
+
+        inline int listenOn(Endpoint const& endpoint) {
+            int fd;
+            if (!endpoint.socketPath.empty()) {
+                sockaddr_un addr{};
+                if (endpoint.socketPath.size() >= sizeof(addr.sun_path)) {
+                    throw std::runtime_error("Error in fastforest-server : socket path too long");
+                }
+                addr.sun_family = AF_UNIX;
+                std::strcpy(addr.sun_path, endpoint.socketPath.c_str());
+                fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+                ::unlink(endpoint.socketPath.c_str());
+                if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+                    throw systemError("can't bind to " + endpoint.str());
+                }
+            } else {
+                sockaddr_in addr{};
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons(endpoint.port);
+                addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                fd = ::socket(AF_INET, SOCK_STREAM, 0);
+                int one = 1;
+                ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+                if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+                    throw systemError("can't bind to " + endpoint.str());
+                }
+            }
+            if (::listen(fd, 128) != 0) {
+                throw systemError("can't listen on " + endpoint.str());
+            }
+            return fd;
+        }
+
+        // Small requests and replies should not wait for Nagle's algorithm.
+        inline void setNoDelay(int fd, Endpoint const& endpoint) {
+            if (endpoint.socketPath.empty()) {
+                int one = 1;
+                ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+        }
+
+        inline int connectTo(Endpoint const& endpoint) {
+            int fd;
+            int result;
+            if (!endpoint.socketPath.empty()) {
+                sockaddr_un addr{};
+                addr.sun_family = AF_UNIX;
+                std::strncpy(addr.sun_path, endpoint.socketPath.c_str(), sizeof(addr.sun_path) - 1);
+                fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+                result = ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+            } else {
+                sockaddr_in addr{};
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons(endpoint.port);
+                addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                fd = ::socket(AF_INET, SOCK_STREAM, 0);
+                result = ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+            }
+            if (fd < 0 || result != 0) {
+                throw systemError("can't connect to " + endpoint.str());
+            }
+            setNoDelay(fd, endpoint);
+            return fd;
+        }
+
+        // Histogram with logarithmic buckets, which can be filled concurrently. Bucket i counts the values in
+        // [2^(i-1), 2^i), so quantiles are accurate to a factor of two, which is enough to tell where latency
+        // comes from.
+        class Histogram {
+          public:
+            static constexpr int nBuckets = 40;
+
+            void fill(std::uint64_t value) {
+                int bucket = 0;
+                while (bucket < nBuckets - 1 && (std::uint64_t(1) << bucket) <= value) {
+                    ++bucket;
+                }
+                counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+                sum_.fetch_add(value, std::memory_order_relaxed);
+                std::uint64_t max = max_.load(std::memory_order_relaxed);
+                while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+                }
+            }
+
+            std::uint64_t count() const {
+                std::uint64_t n = 0;
+                for (auto const& c : counts_) {
+                    n += c.load(std::memory_order_relaxed);
+                }
+                return n;
+            }
+
+            // upper edge of the bucket that contains the quantile q
+            std::uint64_t quantile(double q) const {
+                const std::uint64_t n = count();
+                std::uint64_t seen = 0;
+                for (int i = 0; i < nBuckets; ++i) {
+                    seen += counts_[i].load(std::memory_order_relaxed);
+                    if (seen > 0 && seen >= q * n) {
+                        return std::min(std::uint64_t(1) << i, max_.load(std::memory_order_relaxed));
+                    }
+                }
+                return max_.load(std::memory_order_relaxed);
+            }
+
+            // One summary line followed by one line per non-empty bucket.
+            std::string str(std::string const& name, std::string const& unit) const {
+                const std::uint64_t n = count();
+                std::stringstream ss;
+                ss << name << ": n=" << n;
+                if (n > 0) {
+                    ss << " mean=" << double(sum_.load()) / n << unit << " p50<=" << quantile(0.5) << unit
+                       << " p90<=" << quantile(0.9) << unit << " p99<=" << quantile(0.99) << unit
+                       << " max=" << max_.load() << unit;
+                }
+                ss << "\n";
+                for (int i = 0; i < nBuckets; ++i) {
+                    if (auto c = counts_[i].load(std::memory_order_relaxed)) {
+                        ss << "  [" << (i == 0 ? 0 : std::uint64_t(1) << (i - 1)) << ", " << (std::uint64_t(1) << i)
+                           << ") " << c << "\n";
+                    }
+                }
+                return ss.str();
+            }
+
+          private:
+            std::array<std::atomic<std::uint64_t>, nBuckets> counts_{};
+            std::atomic<std::uint64_t> sum_{0};
+            std::atomic<std::uint64_t> max_{0};
+        };
+
+    }  // namespace server
+}  // namespace fastforest
+
+#endif
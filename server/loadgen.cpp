@@ -0,0 +1,210 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// Load generator for fastforest-server. Each client sends its requests one after the other over its own connection
+// and waits for the predictions, so the number of clients controls how many requests the server can batch. The
+// latency seen by the clients and the statistics of the server are printed at the end.
+//
+// With --check, the predictions are compared with the ones of a local copy of the model.
+
+#include "common.h"
+
+#include "fastforest.h"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace fastforest;
+using namespace fastforest::server;
+
+namespace {
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Options {
+        Endpoint endpoint;
+        int nFeatures = 5;
+        int nClients = 4;
+        int nRequests = 1000;
+        int nRows = 1;
+        std::string check;
+    };
+
+    // Sends one request and receives the predictions, or the text for a request without rows.
+    void roundTrip(int fd,
+                   std::vector<FeatureType> const& rows,
+                   int nRows,
+                   int nFeatures,
+                   std::vector<TreeEnsembleResponseType>& out,
+                   std::string& text) {
+        RequestHeader request{requestMagic, static_cast<std::uint32_t>(nRows), static_cast<std::uint32_t>(nFeatures)};
+        ResponseHeader response;
+        if (!writeAll(fd, &request, sizeof(request)) ||
+            !writeAll(fd, rows.data(), static_cast<std::size_t>(nRows) * nFeatures * sizeof(FeatureType)) ||
+            !readAll(fd, &response, sizeof(response))) {
+            throw std::runtime_error("Error in fastforest-loadgen : connection lost");
+        }
+        out.resize(static_cast<std::size_t>(response.nRows) * response.nOutputs);
+        text.resize(response.textLength);
+        if (!readAll(fd, out.data(), out.size() * sizeof(TreeEnsembleResponseType)) ||
+            !readAll(fd, &text[0], text.size())) {
+            throw std::runtime_error("Error in fastforest-loadgen : connection lost");
+        }
+        if (response.status != Status::Ok) {
+            throw std::runtime_error("Error in fastforest-loadgen : the server replied: " + text);
+        }
+    }
+
+    void printUsage() {
+        std::cerr << "usage: fastforest-loadgen (--socket <path> | --port <port>) [--features <n>] [--clients <n>]\n"
+                     "                          [--requests <n per client>] [--rows <rows per request>]\n"
+                     "                          [--check <forest.bin>]\n";
+    }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 == argc) {
+            printUsage();
+            return 1;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--socket") {
+            options.endpoint.socketPath = value;
+        } else if (arg == "--port") {
+            options.endpoint.port = std::atoi(value.c_str());
+        } else if (arg == "--features") {
+            options.nFeatures = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--clients") {
+            options.nClients = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--requests") {
+            options.nRequests = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--rows") {
+            options.nRows = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--check") {
+            options.check = value;
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+    if (options.endpoint.socketPath.empty() && options.endpoint.port == 0) {
+        printUsage();
+        return 1;
+    }
+
+    try {
+        std::unique_ptr<FastForest> reference;
+        if (!options.check.empty()) {
+            reference.reset(new FastForest(load_bin(options.check)));
+        }
+
+        Histogram latency;
+        std::atomic<std::uint64_t> nMismatches{0};
+        std::vector<std::string> errors(options.nClients);
+
+        const auto start = Clock::now();
+        std::vector<std::thread> clients;
+        for (int iClient = 0; iClient < options.nClients; ++iClient) {
+            clients.emplace_back([&, iClient]() {
+                try {
+                    const int fd = connectTo(options.endpoint);
+                    std::mt19937 rng(iClient);
+                    std::uniform_real_distribution<FeatureType> dist(-5.f, 5.f);
+                    std::vector<FeatureType> rows(static_cast<std::size_t>(options.nRows) * options.nFeatures);
+                    std::vector<TreeEnsembleResponseType> out;
+                    std::vector<TreeEnsembleResponseType> expected;
+                    std::string text;
+                    for (int iRequest = 0; iRequest < options.nRequests; ++iRequest) {
+                        for (auto& x : rows) {
+                            x = dist(rng);
+                        }
+                        const auto sent = Clock::now();
+                        roundTrip(fd, rows, options.nRows, options.nFeatures, out, text);
+                        latency.fill(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - sent).count());
+                        if (reference) {
+                            expected.resize(out.size());
+                            reference->predict_batch(rows.data(), options.nRows, options.nFeatures, expected.data());
+                            for (std::size_t i = 0; i < out.size(); ++i) {
+                                if (std::abs(out[i] - expected[i]) > 1e-5 * (1 + std::abs(expected[i]))) {
+                                    ++nMismatches;
+                                }
+                            }
+                        }
+                    }
+                    ::close(fd);
+                } catch (std::exception const& e) {
+                    errors[iClient] = e.what();
+                }
+            });
+        }
+        for (auto& client : clients) {
+            client.join();
+        }
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        for (auto const& error : errors) {
+            if (!error.empty()) {
+                throw std::runtime_error(error);
+            }
+        }
+
+        const double nRequests = double(options.nClients) * options.nRequests;
+        std::cout << options.nClients << " clients sent " << nRequests << " requests with " << options.nRows
+                  << " rows in " << seconds << " s: " << nRequests / seconds << " requests/s, "
+                  << nRequests * options.nRows / seconds << " rows/s\n"
+                  << latency.str("client latency", "us");
+        if (reference) {
+            std::cout << "predictions that differ from the local model: " << nMismatches << "\n";
+        }
+
+        const int fd = connectTo(options.endpoint);
+        std::vector<TreeEnsembleResponseType> out;
+        std::string text;
+        roundTrip(fd, {}, 0, options.nFeatures, out, text);
+        ::close(fd);
+        std::cout << "server statistics:\n" << text;
+
+        if (nMismatches > 0) {
+            return 1;
+        }
+    } catch (std::exception const& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
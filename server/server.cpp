@@ -0,0 +1,438 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// A scoring server for a forest, which is shared between the clients over a Unix domain socket or loopback TCP. The
+// requests of concurrent clients are grouped into micro-batches, which wait at most for the latency budget before
+// they are scored with FastForest::predict_batch by a pool of scoring threads. The model is reloaded from the same
+// path on SIGHUP, and the latency histograms are printed on shutdown and returned for requests without rows.
+//
+// See loadgen.cpp for a client that generates load, and the README for the usage.
+
+#include "common.h"
+
+#include "fastforest.h"
+#include "fastforest_handle.h"
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace fastforest;
+using namespace fastforest::server;
+
+namespace {
+
+    typedef std::chrono::steady_clock Clock;
+
+    std::uint64_t microseconds(Clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    }
+
+    struct Options {
+        std::string model;
+        std::vector<std::string> features;
+        Endpoint endpoint;
+        int nThreads = std::max(1u, std::thread::hardware_concurrency());
+        int maxBatchRows = 256;
+        int latencyBudgetUs = 200;
+    };
+
+    struct Statistics {
+        Histogram latency;     // from the arrival of the request to the availability of the predictions
+        Histogram queueWait;   // from the arrival of the request to the start of the scoring
+        Histogram batchRows;   // rows per micro-batch
+        Histogram batchUs;     // scoring time per micro-batch
+        std::atomic<std::uint64_t> reloads{0};
+
+        std::string str() const {
+            return latency.str("request latency", "us") + queueWait.str("queue wait", "us") +
+                   batchRows.str("batch size", " rows") + batchUs.str("batch scoring time", "us") +
+                   "model reloads: " + std::to_string(reloads.load()) + "\n";
+        }
+    };
+
+    // A request that waits for its predictions. The rows and outputs are owned by the connection.
+    struct Request {
+        const FeatureType* rows;
+        int nRows;
+        TreeEnsembleResponseType* out;
+        Clock::time_point arrival;
+        std::promise<void> done;
+    };
+
+    // Groups the queued requests into micro-batches and scores them on a pool of threads. A scoring thread takes
+    // the requests in the queue as soon as they add up to the maximum batch size, or when the oldest one has
+    // waited for the latency budget. Larger batches amortize the per-call overhead and keep the trees in the cache
+    // while several rows go through them.
+    class Batcher {
+      public:
+        Batcher(ModelHandle const& model, int nFeatures, Options const& options, Statistics& stats)
+            : model_{model},
+              nFeatures_{nFeatures},
+              maxBatchRows_{options.maxBatchRows},
+              latencyBudget_{std::chrono::microseconds(options.latencyBudgetUs)},
+              stats_{stats} {
+            for (int i = 0; i < options.nThreads; ++i) {
+                threads_.emplace_back([this]() { run(); });
+            }
+        }
+
+        ~Batcher() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            for (auto& thread : threads_) {
+                thread.join();
+            }
+        }
+
+        void submit(Request& request) {
+            bool full;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                queue_.push_back(&request);
+                queuedRows_ += request.nRows;
+                full = queuedRows_ >= maxBatchRows_;
+            }
+            if (full) {
+                cv_.notify_all();
+            } else {
+                cv_.notify_one();
+            }
+        }
+
+      private:
+        void run() {
+            std::vector<Request*> batch;
+            std::vector<FeatureType> rows;
+            std::vector<TreeEnsembleResponseType> out;
+
+            while (true) {
+                batch.clear();
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+                    if (queue_.empty()) {
+                        return;
+                    }
+                    const auto deadline = queue_.front()->arrival + latencyBudget_;
+                    cv_.wait_until(lock, deadline, [this]() { return stop_ || queuedRows_ >= maxBatchRows_; });
+                    // another scoring thread might have taken the batch in the meantime
+                    int nRows = 0;
+                    while (!queue_.empty() && (batch.empty() || nRows + queue_.front()->nRows <= maxBatchRows_)) {
+                        batch.push_back(queue_.front());
+                        nRows += queue_.front()->nRows;
+                        queuedRows_ -= queue_.front()->nRows;
+                        queue_.pop_front();
+                    }
+                    if (!queue_.empty()) {
+                        cv_.notify_one();
+                    }
+                }
+                if (!batch.empty()) {
+                    score(batch, rows, out);
+                }
+            }
+        }
+
+        void score(std::vector<Request*> const& batch,
+                   std::vector<FeatureType>& rows,
+                   std::vector<TreeEnsembleResponseType>& out) {
+            const auto start = Clock::now();
+            auto forest = model_.acquire();
+            const int nOutputs = forest->metadata().nClasses;
+
+            // A single request is scored in place, otherwise the rows are gathered in one contiguous batch.
+            int nRows = 0;
+            for (auto request : batch) {
+                nRows += request->nRows;
+            }
+            if (batch.size() == 1) {
+                forest->predict_batch(batch[0]->rows, nRows, nFeatures_, batch[0]->out, 1);
+            } else {
+                rows.resize(static_cast<std::size_t>(nRows) * nFeatures_);
+                out.resize(static_cast<std::size_t>(nRows) * nOutputs);
+                auto dest = rows.begin();
+                for (auto request : batch) {
+                    dest = std::copy(request->rows, request->rows + request->nRows * nFeatures_, dest);
+                }
+                forest->predict_batch(rows.data(), nRows, nFeatures_, out.data(), 1);
+                auto src = out.begin();
+                for (auto request : batch) {
+                    std::copy(src, src + request->nRows * nOutputs, request->out);
+                    src += request->nRows * nOutputs;
+                }
+            }
+
+            const auto end = Clock::now();
+            stats_.batchRows.fill(nRows);
+            stats_.batchUs.fill(microseconds(end - start));
+            for (auto request : batch) {
+                stats_.queueWait.fill(microseconds(start - request->arrival));
+                stats_.latency.fill(microseconds(end - request->arrival));
+                request->done.set_value();
+            }
+        }
+
+        ModelHandle const& model_;
+        const int nFeatures_;
+        const int maxBatchRows_;
+        const Clock::duration latencyBudget_;
+        Statistics& stats_;
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::deque<Request*> queue_;
+        int queuedRows_ = 0;
+        bool stop_ = false;
+        std::vector<std::thread> threads_;
+    };
+
+    bool sendText(int fd, Status status, std::string const& text) {
+        ResponseHeader header{status, 0, 0, static_cast<std::uint32_t>(text.size())};
+        return writeAll(fd, &header, sizeof(header)) && writeAll(fd, text.data(), text.size());
+    }
+
+    // Serves the requests of one client until it disconnects.
+    void serveConnection(int fd, int nFeatures, int nOutputs, Batcher& batcher, Statistics& stats) {
+        // limits the memory a single request can allocate
+        constexpr std::uint32_t maxRows = 1 << 20;
+
+        std::vector<FeatureType> rows;
+        std::vector<TreeEnsembleResponseType> out;
+        RequestHeader header;
+        while (readAll(fd, &header, sizeof(header))) {
+            if (header.magic != requestMagic) {
+                sendText(fd, Status::Error, "bad request header");
+                break;
+            }
+            if (header.nRows == 0) {
+                if (!sendText(fd, Status::Ok, stats.str())) {
+                    break;
+                }
+                continue;
+            }
+            if (header.nFeatures != static_cast<std::uint32_t>(nFeatures) || header.nRows > maxRows) {
+                // the rows can't be skipped reliably, so the connection is closed after the error
+                sendText(fd, Status::Error,
+                         "expected up to " + std::to_string(maxRows) + " rows with " + std::to_string(nFeatures) +
+                             " features, got " + std::to_string(header.nRows) + " rows with " +
+                             std::to_string(header.nFeatures) + " features");
+                break;
+            }
+            rows.resize(static_cast<std::size_t>(header.nRows) * nFeatures);
+            if (!readAll(fd, rows.data(), rows.size() * sizeof(FeatureType))) {
+                break;
+            }
+
+            out.resize(static_cast<std::size_t>(header.nRows) * nOutputs);
+            Request request{rows.data(), static_cast<int>(header.nRows), out.data(), Clock::now(), {}};
+            auto done = request.done.get_future();
+            batcher.submit(request);
+            done.wait();
+
+            ResponseHeader response{Status::Ok, header.nRows, static_cast<std::uint32_t>(nOutputs), 0};
+            if (!writeAll(fd, &response, sizeof(response)) ||
+                !writeAll(fd, out.data(), out.size() * sizeof(TreeEnsembleResponseType))) {
+                break;
+            }
+        }
+    }
+
+    std::vector<std::string> split(std::string const& s, char sep) {
+        std::vector<std::string> parts;
+        std::stringstream ss(s);
+        std::string part;
+        while (std::getline(ss, part, sep)) {
+            parts.push_back(part);
+        }
+        return parts;
+    }
+
+    FastForest loadModel(Options const& options) {
+        auto const& path = options.model;
+        if (path.size() > 4 && path.compare(path.size() - 4, 4, ".bin") == 0) {
+            return load_bin(path);
+        }
+        if (options.features.empty()) {
+            throw std::runtime_error("Error in fastforest-server : models in the text format need --features");
+        }
+        auto features = options.features;
+        return load_txt(path, features);
+    }
+
+    void printUsage() {
+        std::cerr << "usage: fastforest-server --model <forest.bin|model.txt> (--socket <path> | --port <port>)\n"
+                     "                         [--features <f0,f1,...>] [--threads <n>] [--max-batch <rows>]\n"
+                     "                         [--latency-budget <us>]\n"
+                     "\n"
+                     "SIGHUP reloads the model, SIGINT and SIGTERM stop the server.\n";
+    }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 == argc) {
+            printUsage();
+            return 1;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--model") {
+            options.model = value;
+        } else if (arg == "--features") {
+            options.features = split(value, ',');
+        } else if (arg == "--socket") {
+            options.endpoint.socketPath = value;
+        } else if (arg == "--port") {
+            options.endpoint.port = std::atoi(value.c_str());
+        } else if (arg == "--threads") {
+            options.nThreads = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--max-batch") {
+            options.maxBatchRows = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--latency-budget") {
+            options.latencyBudgetUs = std::max(0, std::atoi(value.c_str()));
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+    if (options.model.empty() || (options.endpoint.socketPath.empty() && options.endpoint.port == 0)) {
+        printUsage();
+        return 1;
+    }
+
+    // The signals are handled synchronously by a dedicated thread, so they have to be blocked in all other threads,
+    // which inherit the signal mask from the main thread.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    try {
+        ModelHandle model{loadModel(options)};
+        const int nFeatures = model.acquire()->metadata().features.size();
+        if (nFeatures == 0) {
+            throw std::runtime_error("Error in fastforest-server : the model doesn't list its features");
+        }
+        const int nOutputs = model.acquire()->metadata().nClasses;
+
+        Statistics stats;
+        Batcher batcher{model, nFeatures, options, stats};
+        const int listenFd = listenOn(options.endpoint);
+        std::cerr << "fastforest-server: serving " << options.model << " with " << nFeatures << " features on "
+                  << options.endpoint.str() << std::endl;
+
+        std::thread signalThread([&]() {
+            while (true) {
+                int signal = 0;
+                sigwait(&signals, &signal);
+                if (signal != SIGHUP) {
+                    // unblocks the accept in the main thread
+                    ::shutdown(listenFd, SHUT_RDWR);
+                    return;
+                }
+                try {
+                    // the features and outputs have to stay the same, as they are fixed for the clients
+                    auto forest = loadModel(options);
+                    if (forest.metadata().features.size() != static_cast<std::size_t>(nFeatures) ||
+                        forest.metadata().nClasses != nOutputs) {
+                        throw std::runtime_error(
+                            "Error in fastforest-server : the reloaded model has different features or outputs");
+                    }
+                    model.publish(std::move(forest));
+                    ++stats.reloads;
+                    std::cerr << "fastforest-server: reloaded " << options.model << std::endl;
+                } catch (std::exception const& e) {
+                    std::cerr << e.what() << std::endl;
+                }
+            }
+        });
+
+        // The connections are served by one thread each, which block while their requests are in a batch.
+        std::mutex connectionsMutex;
+        std::condition_variable connectionsDone;
+        std::vector<int> connections;
+        while (true) {
+            const int fd = ::accept(listenFd, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                break;
+            }
+            setNoDelay(fd, options.endpoint);
+            std::lock_guard<std::mutex> lock(connectionsMutex);
+            connections.push_back(fd);
+            std::thread([&, fd]() {
+                serveConnection(fd, nFeatures, nOutputs, batcher, stats);
+                std::lock_guard<std::mutex> lock(connectionsMutex);
+                connections.erase(std::find(connections.begin(), connections.end(), fd));
+                ::close(fd);
+                connectionsDone.notify_all();
+            }).detach();
+        }
+
+        // Clients that are still connected are disconnected, which ends their threads after the current request.
+        {
+            std::unique_lock<std::mutex> lock(connectionsMutex);
+            for (int fd : connections) {
+                ::shutdown(fd, SHUT_RDWR);
+            }
+            connectionsDone.wait(lock, [&]() { return connections.empty(); });
+        }
+        // If accept failed for another reason than a signal, the signal thread is still waiting for one. The signal
+        // stays pending without harm if the thread is already gone.
+        ::kill(::getpid(), SIGTERM);
+        signalThread.join();
+        ::close(listenFd);
+        if (!options.endpoint.socketPath.empty()) {
+            ::unlink(options.endpoint.socketPath.c_str());
+        }
+        std::cerr << stats.str();
+    } catch (std::exception const& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Starts the scoring server on a Unix domain socket, sends load with a correctness check, and stops the server.
+# usage: smoke_test.sh <fastforest-server> <fastforest-loadgen> <forest.bin>
+set -e
+socket="${TMPDIR:-/tmp}/fastforest-smoke-test-$$.sock"
+"$1" --model "$3" --socket "$socket" --threads 2 --max-batch 64 --latency-budget 500 &
+server=$!
+trap 'kill $server 2>/dev/null || true' EXIT
+i=0
+while [ ! -S "$socket" ]; do
+    i=$((i + 1))
+    if [ $i -gt 100 ]; then
+        echo "server did not start" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+"$2" --socket "$socket" --clients 8 --requests 200 --rows 4 --check "$3"
+kill -HUP $server
+"$2" --socket "$socket" --clients 2 --requests 50 --rows 1 --check "$3"
+kill -INT $server
+wait $server
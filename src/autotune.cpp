@@ -0,0 +1,366 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "common_details.h"
+#include "fastforest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __unix__
+#include <unistd.h>
+#endif
+
+using namespace fastforest;
+
+std::string fastforest::engineName(Engine engine) {
+    switch (engine) {
+        case Engine::Batch:
+            return "batch";
+        case Engine::Interleaved:
+            return "interleaved";
+        case Engine::Complete:
+            return "complete";
+        case Engine::Inlined:
+            return "inlined";
+        case Engine::Partitioned:
+            return "partitioned";
+    }
+    return "";
+}
+
+TunedForest::TunedForest(FastForest forest, Engine engine, int nInterleaved) : forest_{std::move(forest)} {
+    set_engine(engine, nInterleaved);
+}
+
+void TunedForest::set_engine(Engine engine, int nInterleaved) {
+    if (engine == Engine::Interleaved && (nInterleaved < 1 || nInterleaved > FastForest::maxInterleavedRows)) {
+        throw std::runtime_error("Error in fastforest::TunedForest::set_engine : invalid number of interleaved rows " +
+                                 std::to_string(nInterleaved));
+    }
+    if (engine == Engine::Complete && !complete_) {
+        complete_.reset(new CompleteForest(forest_));
+    } else if (engine != Engine::Complete) {
+        complete_.reset();
+    }
+    if (engine == Engine::Inlined && !inlined_) {
+        inlined_.reset(new InlinedForest(forest_));
+    } else if (engine != Engine::Inlined) {
+        inlined_.reset();
+    }
+    engine_ = engine;
+    nInterleaved_ = nInterleaved;
+}
+
+void TunedForest::evaluate_batch(
+    const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads) const {
+    auto const& metadata = forest_.metadata();
+    switch (engine_) {
+        case Engine::Batch:
+            forest_.evaluate_batch(array, nRows, nFeatures, out, metadata.nClasses, metadata.baseResponse, nThreads);
+            break;
+        case Engine::Interleaved:
+            forest_.evaluate_batch_interleaved(
+                array, nRows, nFeatures, out, metadata.nClasses, metadata.baseResponse, nThreads, nInterleaved_);
+            break;
+        case Engine::Complete:
+            complete_->evaluate_batch(array, nRows, nFeatures, out, nThreads);
+            break;
+        case Engine::Inlined:
+            inlined_->evaluate_batch(array, nRows, nFeatures, out, nThreads);
+            break;
+        case Engine::Partitioned:
+            forest_.evaluate_batch_partitioned(
+                array, nRows, nFeatures, out, metadata.nClasses, metadata.baseResponse, nThreads);
+            break;
+    }
+}
+
+void TunedForest::predict_batch(
+    const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads) const {
+    evaluate_batch(array, nRows, nFeatures, out, nThreads);
+    transform_inplace(out, nRows, forest_.metadata().nClasses, objectiveTransform(forest_.metadata().objective));
+}
+
+namespace {
+
+    // The CPU model from /proc/cpuinfo, or "unknown" on systems without it.
+    std::string cpuModel() {
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        std::string line;
+        while (std::getline(cpuinfo, line)) {
+            if (line.compare(0, 10, "model name") == 0) {
+                auto begin = line.find(':');
+                if (begin != std::string::npos) {
+                    begin = line.find_first_not_of(" \t", begin + 1);
+                    return begin == std::string::npos ? "unknown" : line.substr(begin);
+                }
+            }
+        }
+        return "unknown";
+    }
+
+    // FNV-1a hash of the forest arrays, which identifies the forest in the cache independently of the file format.
+    class Hash {
+      public:
+        template <class T>
+        void add(Vector<T> const& v) {
+            add(v.size());
+            auto bytes = reinterpret_cast<const unsigned char*>(v.data());
+            for (std::size_t i = 0; i < v.size() * sizeof(T); ++i) {
+                hash_ = (hash_ ^ bytes[i]) * 0x100000001b3ull;
+            }
+        }
+        void add(std::uint64_t x) {
+            for (int i = 0; i < 8; ++i) {
+                hash_ = (hash_ ^ ((x >> (8 * i)) & 0xff)) * 0x100000001b3ull;
+            }
+        }
+        std::string str() const {
+            char buffer[17];
+            std::snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(hash_));
+            return buffer;
+        }
+
+      private:
+        std::uint64_t hash_ = 0xcbf29ce484222325ull;
+    };
+
+    std::string forestHash(FastForest const& ff) {
+        Hash hash;
+        hash.add(ff.rootIndices_);
+        hash.add(ff.cutIndices_);
+        hash.add(ff.cutValues_);
+        hash.add(ff.leftIndices_);
+        hash.add(ff.rightIndices_);
+        hash.add(ff.responses_);
+        hash.add(ff.categorySets_);
+        hash.add(ff.metadata().nClasses);
+        return hash.str();
+    }
+
+    // Each line of a cache file is a decision: the CPU model, the forest hash and the number of threads, followed by
+    // the engine and the number of interleaved rows, separated by tabs.
+    std::string cacheKey(FastForest const& ff, int nThreads) {
+        return cpuModel() + '\t' + forestHash(ff) + '\t' + std::to_string(nThreads);
+    }
+
+    bool readCache(std::string const& path, std::string const& key, Engine& engine, int& nInterleaved) {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.size() <= key.size() || line.compare(0, key.size(), key) != 0 || line[key.size()] != '\t') {
+                continue;
+            }
+            std::istringstream value(line.substr(key.size() + 1));
+            std::string name;
+            if (!(value >> name >> nInterleaved)) {
+                return false;
+            }
+            for (Engine candidate :
+                 {Engine::Batch, Engine::Interleaved, Engine::Complete, Engine::Inlined, Engine::Partitioned}) {
+                if (engineName(candidate) == name) {
+                    engine = candidate;
+                    return true;
+                }
+            }
+            return false;
+        }
+        return false;
+    }
+
+    // A name for the temporary copy of the cache that no other process or thread uses at the same time, from the
+    // process id and a counter for the threads of this process.
+    std::string temporaryPath(std::string const& path) {
+        static std::atomic<unsigned> counter{0};
+#ifdef __unix__
+        const unsigned long processId = ::getpid();
+#else
+        static const unsigned long processId = std::random_device{}();
+#endif
+        return path + ".tmp." + std::to_string(processId) + '.' + std::to_string(counter++);
+    }
+
+    // Replaces the line with the given key, or appends one. The file is written next to the cache under a unique
+    // name and renamed, so processes that tune concurrently never see a partially written cache.
+    void writeCache(std::string const& path, std::string const& key, Engine engine, int nInterleaved) {
+        std::vector<std::string> lines;
+        {
+            std::ifstream file(path);
+            std::string line;
+            while (std::getline(file, line)) {
+                if (line.compare(0, key.size() + 1, key + '\t') != 0) {
+                    lines.push_back(line);
+                }
+            }
+        }
+        lines.push_back(key + '\t' + engineName(engine) + '\t' + std::to_string(nInterleaved));
+
+        const std::string tmpPath = temporaryPath(path);
+        {
+            std::ofstream file(tmpPath);
+            for (auto const& line : lines) {
+                file << line << '\n';
+            }
+            if (!file) {
+                std::remove(tmpPath.c_str());
+                return;
+            }
+        }
+        if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            std::remove(tmpPath.c_str());
+        }
+    }
+
+    // Rows in which each feature takes the value of a random cut on it, or the next larger value, so every split is
+    // taken both ways. Categorical features take a random category of the range covered by their sets.
+    std::vector<FeatureType> synthesizeRows(FastForest const& ff, int nRows, int nFeatures) {
+        std::vector<std::vector<FeatureType>> featureCuts(nFeatures);
+        std::vector<std::uint32_t> nCategories(nFeatures, 0);
+        for (std::size_t i = 0; i < ff.cutValues_.size(); ++i) {
+            const auto feature = ff.cutIndices_[i];
+            const FeatureType cut = ff.cutValues_[i];
+            if (static_cast<int>(feature) >= nFeatures) {
+                continue;
+            }
+            if (!ff.categorySets_.empty() && detail::isCategoricalCut(cut)) {
+                nCategories[feature] =
+                    std::max(nCategories[feature], 32 * ff.categorySets_[detail::categorySetOffset(cut)]);
+            } else {
+                featureCuts[feature].push_back(cut);
+            }
+        }
+
+        std::mt19937 rng(42);
+        std::vector<FeatureType> rows(static_cast<std::size_t>(nRows) * nFeatures, 0.f);
+        for (int iRow = 0; iRow < nRows; ++iRow) {
+            for (int iFeature = 0; iFeature < nFeatures; ++iFeature) {
+                auto const& cuts = featureCuts[iFeature];
+                FeatureType& x = rows[static_cast<std::size_t>(iRow) * nFeatures + iFeature];
+                const bool categorical = nCategories[iFeature] > 0 && (cuts.empty() || rng() % 2);
+                if (categorical) {
+                    x = rng() % nCategories[iFeature];
+                } else if (!cuts.empty()) {
+                    x = cuts[rng() % cuts.size()];
+                    if (rng() % 2) {
+                        x = std::nextafter(x, std::numeric_limits<FeatureType>::infinity());
+                    }
+                }
+            }
+        }
+        return rows;
+    }
+
+    int requiredFeatures(FastForest const& ff) {
+        int nFeatures = ff.metadata().features.size();
+        for (auto feature : ff.cutIndices_) {
+            nFeatures = std::max(nFeatures, static_cast<int>(feature) + 1);
+        }
+        return nFeatures;
+    }
+
+}  // namespace
+
+TunedForest fastforest::autotune(FastForest forest,
+                                 AutotuneOptions const& options,
+                                 std::vector<EngineTiming>* timings) {
+    if (timings) {
+        timings->clear();
+    }
+    if (options.nRows < 1 || options.nRepetitions < 1 || options.nThreads < 1) {
+        throw std::runtime_error("Error in fastforest::autotune : the number of rows, repetitions and threads has to "
+                                 "be positive");
+    }
+    const int nFeatures = options.nFeatures > 0 ? options.nFeatures : requiredFeatures(forest);
+
+    const std::string cachePath = options.modelPath.empty() ? "" : options.modelPath + ".autotune";
+    const std::string key = cachePath.empty() ? "" : cacheKey(forest, options.nThreads);
+    Engine engine;
+    int nInterleaved;
+    if (!cachePath.empty() && readCache(cachePath, key, engine, nInterleaved)) {
+        return TunedForest{std::move(forest), engine, nInterleaved};
+    }
+
+    std::vector<FeatureType> synthesized;
+    const FeatureType* rows = options.rows;
+    if (!rows) {
+        synthesized = synthesizeRows(forest, options.nRows, nFeatures);
+        rows = synthesized.data();
+    }
+
+    TunedForest tuned{std::move(forest)};
+    std::vector<EngineTiming> candidates{{Engine::Batch, 16, 0.}};
+    for (int k : {4, 8, 16, 32}) {
+        candidates.push_back({Engine::Interleaved, k, 0.});
+    }
+    candidates.push_back({Engine::Partitioned, 16, 0.});
+    // the compiled layouts don't support vector leaves
+    if (!tuned.metadata().vectorLeaves) {
+        candidates.push_back({Engine::Inlined, 16, 0.});
+        if (CompleteForest(tuned.forest()).n_padded_trees() > 0) {
+            candidates.push_back({Engine::Complete, 16, 0.});
+        }
+    }
+
+    std::vector<TreeEnsembleResponseType> out(static_cast<std::size_t>(options.nRows) * tuned.metadata().nClasses);
+    EngineTiming const* best = nullptr;
+    for (auto& candidate : candidates) {
+        tuned.set_engine(candidate.engine, candidate.nInterleaved);
+        // one run to warm up the caches
+        tuned.evaluate_batch(rows, options.nRows, nFeatures, out.data(), options.nThreads);
+        double fastest = std::numeric_limits<double>::infinity();
+        for (int i = 0; i < options.nRepetitions; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            tuned.evaluate_batch(rows, options.nRows, nFeatures, out.data(), options.nThreads);
+            std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+            fastest = std::min(fastest, elapsed.count());
+        }
+        candidate.nsPerRow = fastest / options.nRows;
+        if (!best || candidate.nsPerRow < best->nsPerRow) {
+            best = &candidate;
+        }
+    }
+
+    tuned.set_engine(best->engine, best->nInterleaved);
+    if (!cachePath.empty()) {
+        writeCache(cachePath, key, best->engine, best->nInterleaved);
+    }
+    if (timings) {
+        *timings = candidates;
+    }
+    return tuned;
+}
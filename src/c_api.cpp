@@ -0,0 +1,200 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "fastforest_c.h"
+
+#include "common_details.h"
+#include "fastforest.h"
+
+#include <algorithm>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+static_assert(std::is_same<fastforest::FeatureType, float>::value &&
+                  std::is_same<fastforest::TreeEnsembleResponseType, float>::value,
+              "the C interface uses float for the features and responses");
+
+struct fastforest_t {
+    fastforest::FastForest forest;
+    int minFeatures;
+};
+
+namespace {
+
+    thread_local std::string lastError;
+
+    // Runs func and turns exceptions into the error value of the C function.
+    template <class Func, class Result>
+    Result guarded(Func const& func, Result errorValue) {
+        try {
+            lastError.clear();
+            return func();
+        } catch (std::exception const& e) {
+            lastError = e.what();
+        } catch (...) {
+            lastError = "unknown error";
+        }
+        return errorValue;
+    }
+
+    fastforest_t* wrap(fastforest::FastForest forest) {
+        int minFeatures = 0;
+        for (auto cutIndex : forest.cutIndices_) {
+            minFeatures = std::max(minFeatures, static_cast<int>(cutIndex) + 1);
+        }
+        return new fastforest_t{std::move(forest), minFeatures};
+    }
+
+    std::vector<std::string> featureNames(const char* const* features, int nFeatures) {
+        return std::vector<std::string>(features, features + std::max(nFeatures, 0));
+    }
+
+    // Rows per block when a strided matrix is gathered, small enough for the block to stay in the L1 cache for
+    // typical feature counts.
+    constexpr int gatherBlockSize = 256;
+
+}  // namespace
+
+const char* fastforest_last_error(void) { return lastError.c_str(); }
+
+fastforest_t* fastforest_load_bin(const char* path) {
+    return guarded([&]() { return wrap(fastforest::load_bin(path)); }, static_cast<fastforest_t*>(nullptr));
+}
+
+fastforest_t* fastforest_load_txt(const char* path, const char* const* features, int nFeatures) {
+    return guarded(
+        [&]() {
+            auto names = featureNames(features, nFeatures);
+            return wrap(fastforest::load_txt(path, names));
+        },
+        static_cast<fastforest_t*>(nullptr));
+}
+
+fastforest_t* fastforest_load_lightgbm_txt(const char* path, const char* const* features, int nFeatures) {
+    return guarded(
+        [&]() {
+            auto names = featureNames(features, nFeatures);
+            return wrap(fastforest::load_lightgbm_txt(path, names));
+        },
+        static_cast<fastforest_t*>(nullptr));
+}
+
+fastforest_t* fastforest_load_xgboost_json(const char* path, const char* const* features, int nFeatures) {
+    return guarded(
+        [&]() {
+            auto names = featureNames(features, nFeatures);
+            return wrap(fastforest::load_xgboost_json(path, names));
+        },
+        static_cast<fastforest_t*>(nullptr));
+}
+
+fastforest_t* fastforest_load_onnx(const char* path) {
+    return guarded([&]() { return wrap(fastforest::load_onnx(path)); }, static_cast<fastforest_t*>(nullptr));
+}
+
+void fastforest_free(fastforest_t* forest) { delete forest; }
+
+int fastforest_write_bin(const fastforest_t* forest, const char* path, int compress) {
+    return guarded(
+        [&]() {
+            forest->forest.write_bin(path, compress != 0);
+            return 0;
+        },
+        -1);
+}
+
+int fastforest_set_metadata(fastforest_t* forest, int nClasses, float baseResponse, const char* objective) {
+    return guarded(
+        [&]() {
+            fastforest::Metadata metadata = forest->forest.metadata();
+            metadata.nClasses = nClasses;
+            metadata.baseResponse = baseResponse;
+            metadata.objective = objective ? objective : "";
+            forest->forest.set_metadata(std::move(metadata));
+            return 0;
+        },
+        -1);
+}
+
+int fastforest_n_outputs(const fastforest_t* forest) { return forest->forest.metadata().nClasses; }
+
+int fastforest_min_features(const fastforest_t* forest) { return forest->minFeatures; }
+
+int fastforest_n_feature_names(const fastforest_t* forest) { return forest->forest.metadata().features.size(); }
+
+const char* fastforest_feature_name(const fastforest_t* forest, int index) {
+    auto const& features = forest->forest.metadata().features;
+    return index >= 0 && index < static_cast<int>(features.size()) ? features[index].c_str() : nullptr;
+}
+
+const char* fastforest_objective(const fastforest_t* forest) { return forest->forest.metadata().objective.c_str(); }
+
+float fastforest_base_response(const fastforest_t* forest) { return forest->forest.metadata().baseResponse; }
+
+int fastforest_predict(const fastforest_t* forest,
+                       const float* data,
+                       int nRows,
+                       int nFeatures,
+                       long rowStride,
+                       long featureStride,
+                       float* out,
+                       int nThreads) {
+    return guarded(
+        [&]() {
+            if (nRows < 0 || nFeatures < forest->minFeatures) {
+                throw std::runtime_error("Error in fastforest_predict : the forest needs at least " +
+                                         std::to_string(forest->minFeatures) + " features, got " +
+                                         std::to_string(nFeatures));
+            }
+            auto const& ff = forest->forest;
+            if (featureStride == 1 && rowStride == nFeatures) {
+                ff.predict_batch(data, nRows, nFeatures, out, nThreads);
+                return 0;
+            }
+            // Only the features up to the last one used in a cut are gathered.
+            const int nUsed = forest->minFeatures;
+            const int nOut = ff.metadata().nClasses;
+            const int nBlocks = (nRows + gatherBlockSize - 1) / gatherBlockSize;
+            fastforest::detail::splitRange(nBlocks, nThreads, [&](int blockBegin, int blockEnd) {
+                std::vector<float> block(static_cast<std::size_t>(gatherBlockSize) * std::max(nUsed, 1));
+                for (int iBlock = blockBegin; iBlock < blockEnd; ++iBlock) {
+                    const int rowBegin = iBlock * gatherBlockSize;
+                    const int blockRows = std::min(gatherBlockSize, nRows - rowBegin);
+                    // feature by feature, so a column-major matrix is read contiguously
+                    for (int j = 0; j < nUsed; ++j) {
+                        const float* column = data + j * featureStride + rowBegin * rowStride;
+                        for (int i = 0; i < blockRows; ++i) {
+                            block[i * nUsed + j] = column[i * rowStride];
+                        }
+                    }
+                    ff.predict_batch(block.data(), blockRows, nUsed, out + static_cast<std::size_t>(rowBegin) * nOut);
+                }
+            });
+            return 0;
+        },
+        -1);
+}
@@ -0,0 +1,311 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "common_details.h"
+#include "fastforest.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace fastforest;
+
+namespace {
+
+    std::uint64_t hashKey(const std::uint32_t* key, int n) {
+        std::uint64_t h = 0x9e3779b97f4a7c15ull ^ n;
+        for (int i = 0; i < n; ++i) {
+            h = (h ^ key[i]) * 0x100000001b3ull;
+            h ^= h >> 29;
+        }
+        // final mix, such that the bits used to pick the shard depend on all words
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    std::uint32_t valueBits(FeatureType value) {
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    // estimated size of an entry in addition to its key and responses: the list node and the hash table node
+    constexpr std::size_t entryOverhead = 96;
+
+}  // namespace
+
+// The entries of one shard in least-recently-used order, with an index by the hash of their key.
+struct fastforest::CachedForest::Shard {
+    struct Entry {
+        std::uint64_t hash;
+        // the key words followed by the responses
+        std::vector<std::uint32_t> data;
+    };
+
+    std::mutex mutex;
+    std::list<Entry> entries;
+    std::unordered_map<std::uint64_t, std::list<Entry>::iterator> index;
+    std::size_t bytes = 0;
+    std::uint64_t evictions = 0;
+};
+
+fastforest::CachedForest::CachedForest(FastForest forest, CacheOptions const& options)
+    : forest_{std::move(forest)}, transform_{objectiveTransform(forest_.metadata().objective)} {
+    if (options.nShards < 1) {
+        throw std::runtime_error("Error in fastforest::CachedForest : the number of shards should be at least one");
+    }
+    for (CutIndexType feature : forest_.cutIndices_) {
+        nKeyFeatures_ = std::max(nKeyFeatures_, static_cast<int>(feature) + 1);
+    }
+    if (options.binned) {
+        binEdges_.resize(nKeyFeatures_);
+        categorical_.resize(nKeyFeatures_);
+        for (std::size_t i = 0; i < forest_.cutValues_.size(); ++i) {
+            const FeatureType cut = forest_.cutValues_[i];
+            if (detail::isCategoricalCut(cut)) {
+                categorical_[forest_.cutIndices_[i]] = true;
+            } else {
+                binEdges_[forest_.cutIndices_[i]].push_back(cut);
+            }
+        }
+        for (auto& edges : binEdges_) {
+            std::sort(edges.begin(), edges.end());
+            edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+        }
+    }
+    for (int i = 0; i < options.nShards; ++i) {
+        shards_.emplace_back(new Shard);
+    }
+    maxShardBytes_ = options.maxBytes / options.nShards;
+}
+
+fastforest::CachedForest::~CachedForest() = default;
+
+void fastforest::CachedForest::makeKey(const FeatureType* row, std::uint32_t* key) const {
+    if (binEdges_.empty()) {
+        std::memcpy(key, row, nKeyFeatures_ * sizeof(FeatureType));
+        return;
+    }
+    for (int i = 0; i < nKeyFeatures_; ++i) {
+        const FeatureType value = row[i];
+        if (categorical_[i]) {
+            key[i] = valueBits(value);
+        } else if (value != value) {
+            // missing values go left at every numerical cut, like values below the smallest cut
+            key[i] = 0;
+        } else {
+            // the row goes right at the cuts that are below its value
+            auto const& edges = binEdges_[i];
+            key[i] = std::lower_bound(edges.begin(), edges.end(), value) - edges.begin();
+        }
+    }
+}
+
+bool fastforest::CachedForest::lookup(const std::uint32_t* key,
+                                     std::uint64_t hash,
+                                     TreeEnsembleResponseType* out) const {
+    const int nKey = nKeyFeatures_;
+    Shard& shard = *shards_[(hash >> 32) % shards_.size()];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(hash);
+    if (found == shard.index.end() || !std::equal(key, key + nKey, found->second->data.begin())) {
+        return false;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+    std::memcpy(out, found->second->data.data() + nKey, forest_.metadata().nClasses * sizeof(TreeEnsembleResponseType));
+    return true;
+}
+
+void fastforest::CachedForest::insert(const std::uint32_t* key,
+                                      std::uint64_t hash,
+                                      const TreeEnsembleResponseType* responses) const {
+    const int nKey = nKeyFeatures_;
+    const int nOut = forest_.metadata().nClasses;
+    const std::size_t entryBytes = entryOverhead + (nKey + nOut) * sizeof(std::uint32_t);
+    if (entryBytes > maxShardBytes_) {
+        return;
+    }
+
+    Shard& shard = *shards_[(hash >> 32) % shards_.size()];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(hash);
+    if (found == shard.index.end()) {
+        shard.entries.push_front(Shard::Entry{hash, std::vector<std::uint32_t>(nKey + nOut)});
+        shard.index.emplace(hash, shard.entries.begin());
+        shard.bytes += entryBytes;
+    } else {
+        // another thread inserted the same row in the meantime, or the hash collides with the one of another row
+        shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+    }
+    std::uint32_t* data = shard.entries.front().data.data();
+    std::copy(key, key + nKey, data);
+    std::memcpy(data + nKey, responses, nOut * sizeof(TreeEnsembleResponseType));
+
+    while (shard.bytes > maxShardBytes_) {
+        shard.index.erase(shard.entries.back().hash);
+        shard.entries.pop_back();
+        shard.bytes -= entryBytes;
+        ++shard.evictions;
+    }
+}
+
+void fastforest::CachedForest::evaluateChunk(const FeatureType* array,
+                                             int nRows,
+                                             int nFeatures,
+                                             TreeEnsembleResponseType* out) const {
+    const int nOut = forest_.metadata().nClasses;
+    const int nKey = nKeyFeatures_;
+
+    std::vector<std::uint32_t> keys(static_cast<std::size_t>(nRows) * nKey);
+    std::vector<std::uint64_t> hashes(nRows);
+    // rows that were not found, the first row with the same key for the ones that are repeated within the chunk
+    std::vector<int> misses;
+    std::vector<std::pair<int, int>> repeats;
+    std::unordered_map<std::uint64_t, int> pending;
+
+    for (int iRow = 0; iRow < nRows; ++iRow) {
+        std::uint32_t* key = keys.data() + static_cast<std::size_t>(iRow) * nKey;
+        makeKey(array + static_cast<std::size_t>(iRow) * nFeatures, key);
+        const std::uint64_t hash = hashKey(key, nKey);
+        hashes[iRow] = hash;
+
+        if (lookup(key, hash, out + static_cast<std::size_t>(iRow) * nOut)) {
+            continue;
+        }
+        auto first = pending.find(hash);
+        if (first != pending.end() &&
+            std::equal(key, key + nKey, keys.data() + static_cast<std::size_t>(first->second) * nKey)) {
+            repeats.emplace_back(iRow, first->second);
+            continue;
+        }
+        pending.emplace(hash, iRow);
+        misses.push_back(iRow);
+    }
+    hits_ += nRows - misses.size();
+    misses_ += misses.size();
+    if (misses.empty()) {
+        return;
+    }
+
+    // the rows that were not found are evaluated together
+    const int nMisses = misses.size();
+    std::vector<FeatureType> rows(static_cast<std::size_t>(nMisses) * nFeatures);
+    for (int i = 0; i < nMisses; ++i) {
+        const FeatureType* row = array + static_cast<std::size_t>(misses[i]) * nFeatures;
+        std::copy(row, row + nFeatures, rows.begin() + static_cast<std::size_t>(i) * nFeatures);
+    }
+    std::vector<TreeEnsembleResponseType> responses(static_cast<std::size_t>(nMisses) * nOut);
+    forest_.evaluate_batch(rows.data(), nMisses, nFeatures, responses.data(), nOut, forest_.metadata().baseResponse);
+
+    for (int i = 0; i < nMisses; ++i) {
+        const int iRow = misses[i];
+        const TreeEnsembleResponseType* rowResponses = &responses[static_cast<std::size_t>(i) * nOut];
+        std::copy(rowResponses, rowResponses + nOut, out + static_cast<std::size_t>(iRow) * nOut);
+        insert(keys.data() + static_cast<std::size_t>(iRow) * nKey, hashes[iRow], rowResponses);
+    }
+
+    for (auto const& repeat : repeats) {
+        std::copy(out + static_cast<std::size_t>(repeat.second) * nOut,
+                  out + static_cast<std::size_t>(repeat.second + 1) * nOut,
+                  out + static_cast<std::size_t>(repeat.first) * nOut);
+    }
+}
+
+void fastforest::CachedForest::evaluate_batch(
+    const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads) const {
+    if (nFeatures < nKeyFeatures_) {
+        throw std::runtime_error("Error in fastforest::CachedForest : the forest cuts on " +
+                                 std::to_string(nKeyFeatures_) + " features, but the rows only have " +
+                                 std::to_string(nFeatures));
+    }
+    const int nOut = forest_.metadata().nClasses;
+    // chunks of a limited size keep the keys and the rows that are not found in the cache
+    constexpr int chunkSize = 256;
+    detail::splitRange(nRows, nThreads, [&](int begin, int end) {
+        for (int chunkBegin = begin; chunkBegin < end; chunkBegin += chunkSize) {
+            evaluateChunk(array + static_cast<std::size_t>(chunkBegin) * nFeatures,
+                          std::min(chunkSize, end - chunkBegin),
+                          nFeatures,
+                          out + static_cast<std::size_t>(chunkBegin) * nOut);
+        }
+    });
+}
+
+void fastforest::CachedForest::predict_batch(
+    const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads) const {
+    evaluate_batch(array, nRows, nFeatures, out, nThreads);
+    transform_inplace(out, nRows, forest_.metadata().nClasses, transform_);
+}
+
+void fastforest::CachedForest::evaluate(const FeatureType* array, TreeEnsembleResponseType* out) const {
+    // a single row is looked up without any allocation
+    thread_local std::vector<std::uint32_t> key;
+    key.resize(nKeyFeatures_);
+    makeKey(array, key.data());
+    const std::uint64_t hash = hashKey(key.data(), nKeyFeatures_);
+    if (lookup(key.data(), hash, out)) {
+        ++hits_;
+        return;
+    }
+    ++misses_;
+    forest_.evaluate_batch(array, 1, nKeyFeatures_, out, forest_.metadata().nClasses, forest_.metadata().baseResponse);
+    insert(key.data(), hash, out);
+}
+
+void fastforest::CachedForest::predict(const FeatureType* array, TreeEnsembleResponseType* out) const {
+    evaluate(array, out);
+    transform_inplace(out, 1, forest_.metadata().nClasses, transform_);
+}
+
+CacheStatistics fastforest::CachedForest::statistics() const {
+    CacheStatistics statistics;
+    statistics.hits = hits_;
+    statistics.misses = misses_;
+    for (auto const& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        statistics.evictions += shard->evictions;
+        statistics.entries += shard->entries.size();
+        statistics.bytes += shard->bytes;
+    }
+    return statistics;
+}
+
+void fastforest::CachedForest::clear() {
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->entries.clear();
+        shard->index.clear();
+        shard->bytes = 0;
+    }
+}
@@ -26,12 +26,14 @@ SOFTWARE.
 
 #include "common_details.h"
 
+#include <algorithm>
+#include <string>
 #include <vector>
 #include <unordered_map>
 #include <stdexcept>
 
-void fastforest::detail::correctIndices(std::vector<int>::iterator begin,
-                                        std::vector<int>::iterator end,
+void fastforest::detail::correctIndices(Vector<int>::iterator begin,
+                                        Vector<int>::iterator end,
                                         fastforest::detail::IndexMap const& nodeIndices,
                                         fastforest::detail::IndexMap const& leafIndices) {
     for (auto it = begin; it != end; ++it) {
@@ -44,3 +46,35 @@ void fastforest::detail::correctIndices(std::vector<int>::iterator begin,
         }
     }
 }
+
+fastforest::FeatureType fastforest::detail::appendCategorySet(FastForest& ff,
+                                                              std::vector<std::uint32_t> const& categories) {
+    const std::size_t offset = ff.categorySets_.size();
+    if (offset > maxCategorySetOffset) {
+        throw std::runtime_error("Error in fastforest::detail::appendCategorySet : too many category sets");
+    }
+    const std::uint32_t nWords =
+        categories.empty() ? 0 : *std::max_element(categories.begin(), categories.end()) / 32 + 1;
+    ff.categorySets_.resize(offset + 1 + nWords, 0);
+    ff.categorySets_[offset] = nWords;
+    for (auto category : categories) {
+        ff.categorySets_[offset + 1 + category / 32] |= std::uint32_t(1) << (category % 32);
+    }
+    const std::uint32_t bits = categoricalCutBits | static_cast<std::uint32_t>(offset);
+    FeatureType cut;
+    std::memcpy(&cut, &bits, sizeof(cut));
+    return cut;
+}
+
+void fastforest::detail::validateCategorySets(FastForest const& ff, std::string const& errorPrefix) {
+    const std::size_t nWords = ff.categorySets_.size();
+    for (auto cut : ff.cutValues_) {
+        if (!isCategoricalCut(cut)) {
+            continue;
+        }
+        const std::size_t offset = categorySetOffset(cut);
+        if (offset >= nWords || ff.categorySets_[offset] > nWords - offset - 1) {
+            throw std::runtime_error(errorPrefix + "category set at " + std::to_string(offset) + " is out of range");
+        }
+    }
+}
@@ -27,20 +27,176 @@ SOFTWARE.
 #ifndef common_details_h
 #define common_details_h
 
+#include "fastforest.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <vector>
 #include <unordered_map>
 #include <stdexcept>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <thread>
+
 namespace fastforest {
     namespace detail {
 
         typedef std::unordered_map<int, int> IndexMap;
 
-        void correctIndices(std::vector<int>::iterator begin,
-                            std::vector<int>::iterator end,
+        void correctIndices(Vector<int>::iterator begin,
+                            Vector<int>::iterator end,
                             IndexMap const& nodeIndices,
                             IndexMap const& leafIndices);
 
+        // Runs func(begin, end) for nThreads equal chunks of the range [0, n), each in its own thread.
+        template <class Func>
+        void splitRange(int n, int nThreads, Func const& func) {
+            if (nThreads <= 1 || n <= 1) {
+                func(0, n);
+                return;
+            }
+            nThreads = std::min(nThreads, n);
+            std::vector<std::thread> threads;
+            threads.reserve(nThreads);
+            for (int iThread = 0; iThread < nThreads; ++iThread) {
+                int begin = static_cast<long>(n) * iThread / nThreads;
+                int end = static_cast<long>(n) * (iThread + 1) / nThreads;
+                threads.emplace_back(func, begin, end);
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        }
+
+        // Categorical nodes have a quiet NaN as cut value, with the offset of their category set in
+        // FastForest::categorySets_ as payload. The numerical comparison sends every row left at such a node.
+        constexpr std::uint32_t categoricalCutBits = 0x7fc00000;
+        constexpr std::uint32_t maxCategorySetOffset = (1u << 22) - 1;
+
+        inline bool isCategoricalCut(FeatureType cut) { return cut != cut; }
+
+        inline std::uint32_t categorySetOffset(FeatureType cut) {
+            std::uint32_t bits;
+            std::memcpy(&bits, &cut, sizeof(bits));
+            return bits & maxCategorySetOffset;
+        }
+
+        // Appends the set of the given categories to the category sets of the forest and returns the cut value for
+        // a node that tests it.
+        FeatureType appendCategorySet(FastForest& ff, std::vector<std::uint32_t> const& categories);
+
+        inline bool inCategorySet(const std::uint32_t* sets, FeatureType cut, FeatureType value) {
+            const std::uint32_t* set = sets + categorySetOffset(cut);
+            // also false for missing values
+            if (!(value >= 0.f && value < 32.f * set[0])) {
+                return false;
+            }
+            const auto category = static_cast<std::uint32_t>(value);
+            return (set[1 + category / 32] >> (category % 32)) & 1;
+        }
+
+        // Whether a row goes to the right child of a node. Only forests with category sets can have categorical
+        // nodes, so the check for them can be compiled out for the others.
+        template <bool categorical>
+        inline bool goesRight(FastForest const& ff, const FeatureType* row, int index) {
+            const FeatureType cut = ff.cutValues_[index];
+            const FeatureType value = row[ff.cutIndices_[index]];
+            if (categorical && isCategoricalCut(cut)) {
+                return inCategorySet(ff.categorySets_.data(), cut, value);
+            }
+            return value > cut;
+        }
+
+        inline bool goesRight(FastForest const& ff, const FeatureType* row, int index) {
+            return ff.categorySets_.empty() ? goesRight<false>(ff, row, index) : goesRight<true>(ff, row, index);
+        }
+
+        // Checks that the category sets of all categorical nodes lie within FastForest::categorySets_.
+        void validateCategorySets(FastForest const& ff, std::string const& errorPrefix);
+
+        // Number of values per leaf in the responses of the forest, see Metadata::vectorLeaves.
+        inline int leafSize(FastForest const& ff) { return ff.metadata().vectorLeaves ? ff.metadata().nClasses : 1; }
+
+        // Adds the n values of a vector leaf to the outputs.
+        inline void addLeafVector(TreeEnsembleResponseType* out, const TreeResponseType* leaf, int n) {
+            int i = 0;
+#ifdef __SSE2__
+            static_assert(sizeof(TreeResponseType) == sizeof(float) &&
+                              sizeof(TreeEnsembleResponseType) == sizeof(float),
+                          "the vectorized addition works on floats");
+            for (; i + 4 <= n; i += 4) {
+                _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_loadu_ps(leaf + i)));
+            }
+#endif
+            for (; i < n; ++i) {
+                out[i] += leaf[i];
+            }
+        }
+
+        // Appends the leaf with the given index in src to the responses of dst and returns its new index.
+        inline int appendLeaf(FastForest const& src, int leaf, FastForest& dst) {
+            const int size = leafSize(src);
+            const int newLeaf = dst.responses_.size() / size;
+            auto begin = src.responses_.begin() + static_cast<std::size_t>(leaf) * size;
+            dst.responses_.insert(dst.responses_.end(), begin, begin + size);
+            return newLeaf;
+        }
+
+        // Copies the tree with the given root index from src to the end of the arrays of dst and appends its new root
+        // index to dst.rootIndices_. The nodes and leaves are placed in depth-first order, and at each node the
+        // predicate rightFirst(index) decides whether the right child is placed first.
+        template <class RightFirst>
+        void appendTree(FastForest const& src, int root, FastForest& dst, RightFirst const& rightFirst) {
+            if (root < 0) {
+                dst.rootIndices_.push_back(-appendLeaf(src, -(root + 1), dst) - 1);
+                return;
+            }
+            dst.rootIndices_.push_back(dst.cutValues_.size());
+
+            struct StackEntry {
+                int index;      // index of the node or leaf in the source arrays
+                int newParent;  // index of the already placed parent node in the destination arrays
+                bool isRight;   // if this is the right child of the parent
+            };
+            std::vector<StackEntry> stack{{root, -1, false}};
+
+            while (!stack.empty()) {
+                StackEntry entry = stack.back();
+                stack.pop_back();
+
+                // Except for the root, a non-positive index refers to a leaf (see FastForest::evaluate).
+                bool isNode = entry.newParent < 0 || entry.index > 0;
+
+                int newIndex;
+                if (isNode) {
+                    int index = entry.index;
+                    newIndex = dst.cutValues_.size();
+                    dst.cutIndices_.push_back(src.cutIndices_[index]);
+                    dst.cutValues_.push_back(src.cutValues_[index]);
+                    dst.leftIndices_.push_back(0);
+                    dst.rightIndices_.push_back(0);
+
+                    // the child that is pushed last gets placed first
+                    if (rightFirst(index)) {
+                        stack.push_back({src.leftIndices_[index], newIndex, false});
+                        stack.push_back({src.rightIndices_[index], newIndex, true});
+                    } else {
+                        stack.push_back({src.rightIndices_[index], newIndex, true});
+                        stack.push_back({src.leftIndices_[index], newIndex, false});
+                    }
+                } else {
+                    newIndex = -appendLeaf(src, -entry.index, dst);
+                }
+
+                if (entry.newParent >= 0) {
+                    (entry.isRight ? dst.rightIndices_ : dst.leftIndices_)[entry.newParent] = newIndex;
+                }
+            }
+        }
+
     }  // namespace detail
 
 }  // namespace fastforest
@@ -0,0 +1,258 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "common_details.h"
+#include "fastforest.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace fastforest;
+
+namespace {
+
+    // number of rows that are evaluated together, such that the nodes of a tree stay in the cache
+    constexpr int blockSize = 64;
+
+    struct TreeShape {
+        int depth = 0;             // maximum depth in cut nodes, zero for single-leaf trees
+        int nSlots = 0;            // number of nodes and leaves
+        bool categorical = false;  // if the tree has categorical nodes
+    };
+
+    TreeShape treeShape(FastForest const& ff, int root) {
+        TreeShape shape;
+        if (root < 0) {
+            shape.nSlots = 1;
+            return shape;
+        }
+        std::vector<std::pair<int, int>> stack{{root, 0}};
+        while (!stack.empty()) {
+            auto entry = stack.back();
+            stack.pop_back();
+            ++shape.nSlots;
+            // Except for the root, a non-positive index refers to a leaf (see FastForest::evaluate).
+            if (entry.first > 0 || entry.second == 0) {
+                shape.depth = std::max(shape.depth, entry.second + 1);
+                shape.categorical |= detail::isCategoricalCut(ff.cutValues_[entry.first]);
+                stack.emplace_back(ff.leftIndices_[entry.first], entry.second + 1);
+                stack.emplace_back(ff.rightIndices_[entry.first], entry.second + 1);
+            }
+        }
+        return shape;
+    }
+
+    // Writes the subtree at index of the source forest to the position pos of a complete tree of the given depth.
+    // Leaves above the last level are repeated to all positions below them, with cuts that send every row left.
+    void padSubtree(FastForest const& ff,
+                    int index,
+                    bool isRoot,
+                    int pos,
+                    int depth,
+                    CompleteForest::Node* nodes,
+                    TreeResponseType* leaves) {
+        const int nNodes = (1 << depth) - 1;
+        if (isRoot || index > 0) {
+            nodes[pos] = {ff.cutValues_[index], ff.cutIndices_[index]};
+            padSubtree(ff, ff.leftIndices_[index], false, 2 * pos + 1, depth, nodes, leaves);
+            padSubtree(ff, ff.rightIndices_[index], false, 2 * pos + 2, depth, nodes, leaves);
+            return;
+        }
+        // the positions below a leaf form a complete subtree, so each level is a contiguous range
+        for (int begin = pos, width = 1; begin < 2 * nNodes + 1; begin = 2 * begin + 1, width *= 2) {
+            for (int p = begin; p < begin + width; ++p) {
+                if (p < nNodes) {
+                    nodes[p] = {std::numeric_limits<FeatureType>::infinity(), 0};
+                } else {
+                    leaves[p - nNodes] = ff.responses_[-index];
+                }
+            }
+        }
+    }
+
+    template <int depth>
+    void addGroup(CompleteForest::Group const& group,
+                  const FeatureType* array,
+                  int nRows,
+                  int nFeatures,
+                  TreeEnsembleResponseType* out,
+                  int nOut) {
+        constexpr int nNodes = (1 << depth) - 1;
+        const int nTrees = group.classes.size();
+        for (int iTree = 0; iTree < nTrees; ++iTree) {
+            const CompleteForest::Node* nodes = group.nodes.data() + static_cast<std::size_t>(iTree) * nNodes;
+            const TreeResponseType* leaves = group.leaves.data() + static_cast<std::size_t>(iTree) * (nNodes + 1);
+            TreeEnsembleResponseType* treeOut = out + group.classes[iTree];
+            for (int iRow = 0; iRow < nRows; ++iRow) {
+                const FeatureType* row = array + iRow * nFeatures;
+                int index = 0;
+                for (int step = 0; step < depth; ++step) {
+                    index = 2 * index + 1 + (row[nodes[index].feature] > nodes[index].cut);
+                }
+                treeOut[iRow * nOut] += leaves[index - nNodes];
+            }
+        }
+    }
+
+    typedef void (*GroupKernel)(
+        CompleteForest::Group const&, const FeatureType*, int, int, TreeEnsembleResponseType*, int);
+
+    template <int depth>
+    struct KernelTable {
+        static void fill(GroupKernel* table) {
+            table[depth] = &addGroup<depth>;
+            KernelTable<depth - 1>::fill(table);
+        }
+    };
+
+    template <>
+    struct KernelTable<0> {
+        static void fill(GroupKernel* table) { table[0] = nullptr; }
+    };
+
+    GroupKernel groupKernel(int depth) {
+        static const std::vector<GroupKernel> table = []() {
+            std::vector<GroupKernel> out(CompleteForest::maxSupportedDepth + 1);
+            KernelTable<CompleteForest::maxSupportedDepth>::fill(out.data());
+            return out;
+        }();
+        return table[depth];
+    }
+
+}  // namespace
+
+fastforest::CompleteForest::CompleteForest(FastForest const& forest, int maxDepth, double maxBlowup)
+    : fallback_{forest.cutValues_.get_allocator().resource()} {
+    if (forest.metadata().vectorLeaves) {
+        throw std::runtime_error("Error in fastforest::CompleteForest : forests with vector leaves are not supported");
+    }
+    if (maxDepth > maxSupportedDepth) {
+        throw std::runtime_error("Error in fastforest::CompleteForest : trees can only be padded up to depth " +
+                                 std::to_string(maxSupportedDepth));
+    }
+    auto resource = forest.cutValues_.get_allocator().resource();
+    const int nOut = forest.metadata().nClasses;
+    const int nTrees = forest.rootIndices_.size();
+
+    // Sort the trees into the depth groups and the ones that keep the regular layout, per class.
+    std::vector<std::vector<int>> treesByDepth(maxDepth + 1);
+    std::vector<std::vector<int>> fallbackTrees(nOut);
+    std::vector<double> classConstants(nOut, 0.);
+    for (int iTree = 0; iTree < nTrees; ++iTree) {
+        const int root = forest.rootIndices_[iTree];
+        const TreeShape shape = treeShape(forest, root);
+        if (shape.depth == 0) {
+            classConstants[iTree % nOut] += forest.responses_[-(root + 1)];
+        } else if (!shape.categorical && shape.depth <= maxDepth &&
+                   (2 << shape.depth) - 1 <= maxBlowup * shape.nSlots) {
+            treesByDepth[shape.depth].push_back(iTree);
+            ++nPaddedTrees_;
+        } else {
+            fallbackTrees[iTree % nOut].push_back(iTree);
+            ++nFallbackTrees_;
+        }
+    }
+
+    for (int depth = 1; depth <= maxDepth; ++depth) {
+        auto const& trees = treesByDepth[depth];
+        if (trees.empty()) {
+            continue;
+        }
+        const std::size_t nNodes = (std::size_t(1) << depth) - 1;
+        groups_.push_back({depth, {}, Vector<Node>{resource}, Vector<TreeResponseType>{resource}});
+        Group& group = groups_.back();
+        group.nodes.resize(trees.size() * nNodes);
+        group.leaves.resize(trees.size() * (nNodes + 1));
+        for (std::size_t i = 0; i < trees.size(); ++i) {
+            group.classes.push_back(trees[i] % nOut);
+            padSubtree(forest,
+                       forest.rootIndices_[trees[i]],
+                       true,
+                       0,
+                       depth,
+                       group.nodes.data() + i * nNodes,
+                       group.leaves.data() + i * (nNodes + 1));
+        }
+    }
+
+    // The remaining trees stay interleaved by class, with zero trees where a class has fewer of them.
+    std::size_t nRounds = 0;
+    for (auto const& trees : fallbackTrees) {
+        nRounds = std::max(nRounds, trees.size());
+    }
+    auto appendLeafTree = [this](TreeResponseType value) {
+        fallback_.rootIndices_.push_back(-static_cast<int>(fallback_.responses_.size()) - 1);
+        fallback_.responses_.push_back(value);
+    };
+    for (std::size_t iRound = 0; iRound < nRounds; ++iRound) {
+        for (int iClass = 0; iClass < nOut; ++iClass) {
+            if (iRound < fallbackTrees[iClass].size()) {
+                const int root = forest.rootIndices_[fallbackTrees[iClass][iRound]];
+                detail::appendTree(forest, root, fallback_, [](int) { return false; });
+            } else {
+                appendLeafTree(0);
+            }
+        }
+    }
+    for (double constant : classConstants) {
+        appendLeafTree(static_cast<TreeResponseType>(constant));
+    }
+    fallback_.categorySets_ = forest.categorySets_;
+    fallback_.set_metadata(forest.metadata());
+}
+
+void fastforest::CompleteForest::evaluateBlock(const FeatureType* array,
+                                               int nRows,
+                                               int nFeatures,
+                                               TreeEnsembleResponseType* out) const {
+    const int nOut = metadata().nClasses;
+    fallback_.evaluate_batch(array, nRows, nFeatures, out, nOut, metadata().baseResponse);
+    for (auto const& group : groups_) {
+        groupKernel(group.depth)(group, array, nRows, nFeatures, out, nOut);
+    }
+}
+
+void fastforest::CompleteForest::evaluate_batch(
+    const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads) const {
+    const int nOut = metadata().nClasses;
+    detail::splitRange(nRows, nThreads, [&](int begin, int end) {
+        for (int blockBegin = begin; blockBegin < end; blockBegin += blockSize) {
+            evaluateBlock(array + static_cast<std::size_t>(blockBegin) * nFeatures,
+                          std::min(blockSize, end - blockBegin),
+                          nFeatures,
+                          out + static_cast<std::size_t>(blockBegin) * nOut);
+        }
+    });
+}
+
+void fastforest::CompleteForest::predict_batch(
+    const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads) const {
+    evaluate_batch(array, nRows, nFeatures, out, nThreads);
+    transform_inplace(out, nRows, metadata().nClasses, objectiveTransform(metadata().objective));
+}
@@ -0,0 +1,218 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "compression.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+using namespace fastforest::detail;
+
+namespace {
+
+    constexpr std::size_t minMatch = 4;
+    constexpr std::size_t maxOffset = 65535;
+    constexpr int hashBits = 16;
+
+    inline std::uint32_t read32(const char* p) {
+        std::uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    inline std::uint32_t hash(std::uint32_t sequence) { return (sequence * 2654435761u) >> (32 - hashBits); }
+
+    // lengths that don't fit into the four bits of the token continue with bytes of up to 255
+    void putLength(std::string& out, std::size_t length) {
+        for (; length >= 255; length -= 255) {
+            out.push_back(static_cast<char>(255));
+        }
+        out.push_back(static_cast<char>(length));
+    }
+
+    void putSequence(std::string& out,
+                     const char* literals,
+                     std::size_t nLiterals,
+                     std::size_t offset,
+                     std::size_t matchLength) {
+        const std::size_t extraMatch = matchLength ? matchLength - minMatch : 0;
+        const std::size_t token = (std::min<std::size_t>(nLiterals, 15) << 4) | std::min<std::size_t>(extraMatch, 15);
+        out.push_back(static_cast<char>(token));
+        if (nLiterals >= 15) {
+            putLength(out, nLiterals - 15);
+        }
+        out.append(literals, nLiterals);
+        if (matchLength == 0) {
+            return;
+        }
+        out.push_back(static_cast<char>(offset & 0xff));
+        out.push_back(static_cast<char>(offset >> 8));
+        if (extraMatch >= 15) {
+            putLength(out, extraMatch - 15);
+        }
+    }
+
+}  // namespace
+
+void ByteReader::fail(std::string const& what) const { throw std::runtime_error(errorPrefix_ + what); }
+
+std::string fastforest::detail::shuffleBytes(const char* data, std::size_t n, std::size_t elementSize) {
+    std::string out(n * elementSize, '\0');
+    for (std::size_t b = 0; b < elementSize; ++b) {
+        char* plane = &out[b * n];
+        for (std::size_t i = 0; i < n; ++i) {
+            plane[i] = data[i * elementSize + b];
+        }
+    }
+    return out;
+}
+
+void fastforest::detail::unshuffleBytes(const char* shuffled, std::size_t n, std::size_t elementSize, char* out) {
+    if (elementSize == 4) {
+        // the common case of floats, where gathering the four bytes of each element at once vectorizes well
+        auto planes = reinterpret_cast<const unsigned char*>(shuffled);
+        for (std::size_t i = 0; i < n; ++i) {
+            std::uint32_t value = planes[i] | std::uint32_t(planes[n + i]) << 8 |
+                                  std::uint32_t(planes[2 * n + i]) << 16 | std::uint32_t(planes[3 * n + i]) << 24;
+            std::memcpy(out + 4 * i, &value, 4);
+        }
+        return;
+    }
+    for (std::size_t b = 0; b < elementSize; ++b) {
+        const char* plane = shuffled + b * n;
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i * elementSize + b] = plane[i];
+        }
+    }
+}
+
+std::string fastforest::detail::lzCompress(const char* data, std::size_t n) {
+    std::string out;
+    out.reserve(n / 2 + 16);
+    // last position plus one of each hashed four-byte sequence, zero meaning none
+    std::vector<std::size_t> table(std::size_t(1) << hashBits, 0);
+
+    std::size_t anchor = 0;
+    std::size_t pos = 0;
+    while (pos + minMatch <= n) {
+        const std::uint32_t sequence = read32(data + pos);
+        std::size_t& entry = table[hash(sequence)];
+        const std::size_t candidate = entry;
+        entry = pos + 1;
+        if (candidate == 0 || pos - (candidate - 1) > maxOffset || read32(data + candidate - 1) != sequence) {
+            ++pos;
+            continue;
+        }
+        const std::size_t matchPos = candidate - 1;
+        std::size_t length = minMatch;
+        while (pos + length < n && data[matchPos + length] == data[pos + length]) {
+            ++length;
+        }
+        putSequence(out, data + anchor, pos - anchor, pos - matchPos, length);
+        pos += length;
+        anchor = pos;
+    }
+    // the last sequence only has literals
+    putSequence(out, data + anchor, n - anchor, 0, 0);
+    return out;
+}
+
+void fastforest::detail::lzDecompress(
+    const char* data, std::size_t n, char* out, std::size_t outSize, const char* errorPrefix) {
+    // the reader is only used for reporting errors, the hot loop works with plain pointers
+    const ByteReader errors{data, data + n, errorPrefix};
+    auto in = reinterpret_cast<const unsigned char*>(data);
+    auto const inEnd = in + n;
+    char* const outBegin = out;
+    char* const outEnd = out + outSize;
+
+    auto readLength = [&](std::size_t length) {
+        if (length == 15) {
+            unsigned char byte;
+            do {
+                if (in == inEnd) {
+                    errors.fail("truncated data");
+                }
+                byte = *in++;
+                length += byte;
+            } while (byte == 255);
+        }
+        return length;
+    };
+
+    while (true) {
+        if (in == inEnd) {
+            errors.fail("truncated data");
+        }
+        const unsigned char token = *in++;
+        const std::size_t nLiterals = readLength(token >> 4);
+        if (static_cast<std::size_t>(inEnd - in) < nLiterals || static_cast<std::size_t>(outEnd - out) < nLiterals) {
+            errors.fail("literals out of range");
+        }
+        if (nLiterals <= 16 && inEnd - in >= 16 && outEnd - out >= 16) {
+            // short literal runs are copied with a fixed size, the bytes beyond the run get overwritten later
+            std::memcpy(out, in, 16);
+        } else {
+            std::memcpy(out, in, nLiterals);
+        }
+        in += nLiterals;
+        out += nLiterals;
+        if (in == inEnd) {
+            break;
+        }
+
+        if (inEnd - in < 2) {
+            errors.fail("truncated data");
+        }
+        const std::size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        const std::size_t length = readLength(token & 15) + minMatch;
+        if (offset == 0 || offset > static_cast<std::size_t>(out - outBegin)) {
+            errors.fail("match offset out of range");
+        }
+        if (static_cast<std::size_t>(outEnd - out) < length) {
+            errors.fail("decompressed data too large");
+        }
+        const char* match = out - offset;
+        if (offset >= 8 && static_cast<std::size_t>(outEnd - out) >= length + 8) {
+            // copy in words, which may write up to seven bytes beyond the match that are overwritten later
+            for (std::size_t i = 0; i < length; i += 8) {
+                std::memcpy(out + i, match + i, 8);
+            }
+        } else {
+            // overlapping match, which repeats the last offset bytes, or a match at the end of the output
+            for (std::size_t i = 0; i < length; ++i) {
+                out[i] = match[i];
+            }
+        }
+        out += length;
+    }
+    if (out != outEnd) {
+        errors.fail("decompressed data too small");
+    }
+}
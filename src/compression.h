@@ -0,0 +1,143 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef compression_h
+#define compression_h
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace fastforest {
+    namespace detail {
+
+        // LEB128 variable-length integers, with zigzag coding for signed numbers.
+        inline void putVarint(std::string& out, std::uint64_t value) {
+            while (value >= 0x80) {
+                out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<char>(value));
+        }
+
+        inline std::uint64_t zigzag(std::int64_t value) {
+            return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+        }
+
+        inline std::int64_t unzigzag(std::uint64_t value) {
+            return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+        }
+
+        // Sequential reader for encoded data, which throws with the given error prefix on truncated input.
+        class ByteReader {
+          public:
+            ByteReader(const char* begin, const char* end, const char* errorPrefix)
+                : cur_{reinterpret_cast<const unsigned char*>(begin)},
+                  end_{reinterpret_cast<const unsigned char*>(end)},
+                  errorPrefix_{errorPrefix} {}
+
+            std::uint64_t varint() {
+                // fast path for the common single-byte case
+                if (cur_ != end_ && *cur_ < 0x80) {
+                    return *cur_++;
+                }
+                std::uint64_t value = 0;
+                for (int shift = 0; shift < 64; shift += 7) {
+                    if (cur_ == end_) {
+                        fail("truncated varint");
+                    }
+                    const unsigned char byte = *cur_++;
+                    value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+                    if (byte < 0x80) {
+                        return value;
+                    }
+                }
+                fail("malformed varint");
+            }
+
+            // Decodes n varints and calls func(i, value) for each. Faster than single varint calls, since the
+            // bounds are only checked once for most values.
+            template <class Func>
+            void varints(std::size_t n, Func const& func) {
+                for (std::size_t i = 0; i < n; ++i) {
+                    if (end_ - cur_ < 10) {
+                        func(i, varint());
+                        continue;
+                    }
+                    const unsigned char* cur = cur_;
+                    std::uint64_t value = *cur++;
+                    if (value >= 0x80) {
+                        value &= 0x7f;
+                        unsigned char byte;
+                        int shift = 7;
+                        do {
+                            byte = *cur++;
+                            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+                            shift += 7;
+                        } while (byte >= 0x80 && shift < 70);
+                        if (byte >= 0x80) {
+                            fail("malformed varint");
+                        }
+                    }
+                    cur_ = cur;
+                    func(i, value);
+                }
+            }
+
+            const char* take(std::size_t n) {
+                if (static_cast<std::size_t>(end_ - cur_) < n) {
+                    fail("truncated data");
+                }
+                auto out = reinterpret_cast<const char*>(cur_);
+                cur_ += n;
+                return out;
+            }
+
+            bool atEnd() const { return cur_ == end_; }
+
+            [[noreturn]] void fail(std::string const& what) const;
+
+          private:
+            const unsigned char* cur_;
+            const unsigned char* end_;
+            const char* errorPrefix_;
+        };
+
+        // Transposes n elements of elementSize bytes each, such that the first bytes of all elements come first,
+        // then the second bytes and so on. Similar values then give long runs of similar bytes.
+        std::string shuffleBytes(const char* data, std::size_t n, std::size_t elementSize);
+        void unshuffleBytes(const char* shuffled, std::size_t n, std::size_t elementSize, char* out);
+
+        // A byte-oriented LZ77 codec in the spirit of LZ4: sequences of literals followed by a match of at least four
+        // bytes within the last 64 kB. It compresses moderately, but decompresses at several GB/s.
+        std::string lzCompress(const char* data, std::size_t n);
+        // Decompresses exactly outSize bytes, throwing with the error prefix if the input is malformed.
+        void lzDecompress(const char* data, std::size_t n, char* out, std::size_t outSize, const char* errorPrefix);
+
+    }  // namespace detail
+}  // namespace fastforest
+
+#endif
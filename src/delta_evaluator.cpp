@@ -0,0 +1,190 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "common_details.h"
+#include "fastforest.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace fastforest;
+
+fastforest::DeltaEvaluator::DeltaEvaluator(FastForest const& forest)
+    : forest_{forest}, transform_{objectiveTransform(forest.metadata().objective)} {
+    const int nTrees = forest_.rootIndices_.size();
+    const int nFeatures =
+        forest_.cutIndices_.empty() ? 0 : *std::max_element(forest_.cutIndices_.begin(), forest_.cutIndices_.end()) + 1;
+
+    // the features each tree cuts on, collected by walking the tree since simplified forests share subtrees
+    std::vector<std::vector<int>> treeFeatures(nTrees);
+    std::vector<int> stack;
+    for (int iTree = 0; iTree < nTrees; ++iTree) {
+        auto& features = treeFeatures[iTree];
+        if (forest_.rootIndices_[iTree] >= 0) {
+            stack.push_back(forest_.rootIndices_[iTree]);
+        }
+        while (!stack.empty()) {
+            const int index = stack.back();
+            stack.pop_back();
+            features.push_back(forest_.cutIndices_[index]);
+            // Except for the root, a non-positive index refers to a leaf (see FastForest::evaluate).
+            for (int child : {forest_.leftIndices_[index], forest_.rightIndices_[index]}) {
+                if (child > 0) {
+                    stack.push_back(child);
+                }
+            }
+        }
+        std::sort(features.begin(), features.end());
+        features.erase(std::unique(features.begin(), features.end()), features.end());
+    }
+
+    featureBegins_.assign(nFeatures + 1, 0);
+    for (auto const& features : treeFeatures) {
+        for (int feature : features) {
+            ++featureBegins_[feature + 1];
+        }
+    }
+    for (int i = 0; i < nFeatures; ++i) {
+        featureBegins_[i + 1] += featureBegins_[i];
+    }
+    featureTrees_.resize(featureBegins_.back());
+    std::vector<int> fill(featureBegins_.begin(), featureBegins_.end() - 1);
+    for (int iTree = 0; iTree < nTrees; ++iTree) {
+        for (int feature : treeFeatures[iTree]) {
+            featureTrees_[fill[feature]++] = iTree;
+        }
+    }
+
+    leaves_.resize(nTrees);
+    lastUpdate_.assign(nTrees, 0);
+    sums_.resize(forest_.metadata().nClasses);
+}
+
+int fastforest::DeltaEvaluator::n_trees_using(int feature) const {
+    if (feature < 0 || feature + 1 >= static_cast<int>(featureBegins_.size())) {
+        return 0;
+    }
+    return featureBegins_[feature + 1] - featureBegins_[feature];
+}
+
+void fastforest::DeltaEvaluator::walkTree(int iTree) {
+    int index = forest_.rootIndices_[iTree];
+    int leaf;
+    if (index < 0) {
+        leaf = -(index + 1);
+    } else {
+        do {
+            index = detail::goesRight(forest_, row_.data(), index) ? forest_.rightIndices_[index]
+                                                                   : forest_.leftIndices_[index];
+        } while (index > 0);
+        leaf = -index;
+    }
+    leaves_[iTree] = leaf;
+}
+
+void fastforest::DeltaEvaluator::set_row(const FeatureType* array, int nFeatures) {
+    if (nFeatures + 1 < static_cast<int>(featureBegins_.size())) {
+        throw std::runtime_error("Error in fastforest::DeltaEvaluator : the forest cuts on " +
+                                 std::to_string(featureBegins_.size() - 1) + " features, but the row only has " +
+                                 std::to_string(nFeatures));
+    }
+    row_.assign(array, array + nFeatures);
+    nUpdatedTrees_ = 0;
+
+    auto const& metadata = forest_.metadata();
+    const int nOut = metadata.nClasses;
+    const int size = detail::leafSize(forest_);
+    std::fill(sums_.begin(), sums_.end(), metadata.baseResponse);
+    const int nTrees = leaves_.size();
+    for (int iTree = 0; iTree < nTrees; ++iTree) {
+        walkTree(iTree);
+        const TreeResponseType* leaf = &forest_.responses_[static_cast<std::size_t>(leaves_[iTree]) * size];
+        if (metadata.vectorLeaves) {
+            for (int iOut = 0; iOut < nOut; ++iOut) {
+                sums_[iOut] += leaf[iOut];
+            }
+        } else {
+            sums_[iTree % nOut] += *leaf;
+        }
+    }
+}
+
+void fastforest::DeltaEvaluator::update(const int* features, const FeatureType* values, int n) {
+    for (int i = 0; i < n; ++i) {
+        if (features[i] < 0 || features[i] >= static_cast<int>(row_.size())) {
+            throw std::runtime_error("Error in fastforest::DeltaEvaluator : feature " + std::to_string(features[i]) +
+                                     " is not in the current row with " + std::to_string(row_.size()) +
+                                     " features, see set_row");
+        }
+        row_[features[i]] = values[i];
+    }
+
+    auto const& metadata = forest_.metadata();
+    const int nOut = metadata.nClasses;
+    const int size = detail::leafSize(forest_);
+    ++nUpdates_;
+    for (int i = 0; i < n; ++i) {
+        if (features[i] + 1 >= static_cast<int>(featureBegins_.size())) {
+            continue;
+        }
+        for (int j = featureBegins_[features[i]]; j < featureBegins_[features[i] + 1]; ++j) {
+            const int iTree = featureTrees_[j];
+            if (lastUpdate_[iTree] == nUpdates_) {
+                continue;
+            }
+            lastUpdate_[iTree] = nUpdates_;
+            ++nUpdatedTrees_;
+
+            const int oldLeaf = leaves_[iTree];
+            walkTree(iTree);
+            if (leaves_[iTree] == oldLeaf) {
+                continue;
+            }
+            const TreeResponseType* oldValues = &forest_.responses_[static_cast<std::size_t>(oldLeaf) * size];
+            const TreeResponseType* newValues = &forest_.responses_[static_cast<std::size_t>(leaves_[iTree]) * size];
+            if (metadata.vectorLeaves) {
+                for (int iOut = 0; iOut < nOut; ++iOut) {
+                    sums_[iOut] += double(newValues[iOut]) - oldValues[iOut];
+                }
+            } else {
+                sums_[iTree % nOut] += double(*newValues) - *oldValues;
+            }
+        }
+    }
+}
+
+void fastforest::DeltaEvaluator::update(int feature, FeatureType value) { update(&feature, &value, 1); }
+
+void fastforest::DeltaEvaluator::evaluate(TreeEnsembleResponseType* out) const {
+    std::copy(sums_.begin(), sums_.end(), out);
+}
+
+void fastforest::DeltaEvaluator::predict(TreeEnsembleResponseType* out) const {
+    evaluate(out);
+    transform_inplace(out, 1, forest_.metadata().nClasses, transform_);
+}
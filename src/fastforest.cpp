@@ -25,35 +25,15 @@ SOFTWARE.
 */
 
 #include "fastforest.h"
+#include "common_details.h"
 
-#include <fstream>
+#include <algorithm>
 #include <string>
-#include <sstream>
 #include <stdexcept>
+#include <utility>
 
 using namespace fastforest;
 
-void fastforest::details::softmaxTransformInplace(TreeEnsembleResponseType* out, int nOut) {
-    // Do softmax transformation inplace, mimicing exactly the Softmax function
-    // in the src/common/math.h source file of xgboost.
-    double norm = 0.;
-    TreeEnsembleResponseType wmax = *out;
-    int i = 1;
-    for (; i < nOut; ++i) {
-        wmax = std::max(out[i], wmax);
-    }
-    i = 0;
-    for (; i < nOut; ++i) {
-        auto& x = out[i];
-        x = std::exp(x - wmax);
-        norm += x;
-    }
-    i = 0;
-    for (; i < nOut; ++i) {
-        out[i] /= static_cast<float>(norm);
-    }
-}
-
 std::vector<TreeEnsembleResponseType> fastforest::FastForest::softmax(const FeatureType* array,
                                                                       int nClasses,
                                                                       TreeEnsembleResponseType baseResponse) const {
@@ -62,6 +42,15 @@ std::vector<TreeEnsembleResponseType> fastforest::FastForest::softmax(const Feat
     return out;
 }
 
+Vector<TreeEnsembleResponseType> fastforest::FastForest::softmax(const FeatureType* array,
+                                                                 int nClasses,
+                                                                 MemoryResource* resource,
+                                                                 TreeEnsembleResponseType baseResponse) const {
+    auto out = Vector<TreeEnsembleResponseType>(nClasses, resource);
+    softmax(array, out.data(), nClasses, baseResponse);
+    return out;
+}
+
 void fastforest::FastForest::softmax(const FeatureType* array,
                                      TreeEnsembleResponseType* out,
                                      int nClasses,
@@ -72,94 +61,560 @@ void fastforest::FastForest::softmax(const FeatureType* array,
                                  " multiclassification to make sense.");
     }
 
+    checkClasses(nClasses);
     evaluate(array, out, nClasses, baseResponse);
     fastforest::details::softmaxTransformInplace(out, nClasses);
 }
 
-void fastforest::FastForest::evaluate(const FeatureType* array,
-                                      TreeEnsembleResponseType* out,
-                                      int nOut,
-                                      TreeEnsembleResponseType baseResponse) const {
-    if (rootIndices_.size() % nOut != 0) {
-        throw std::runtime_error(std::string{"Error in FastForest::softmax : Forest has "} +
-                                 std::to_string(rootIndices_.size()) + " trees, " + "which is not compatible with " +
-                                 std::to_string(nOut) + " classes!");
-    }
-
-    for (int i = 0; i < nOut; ++i) {
-        out[i] = baseResponse;
-    }
+namespace {
 
-    int iRootIndex = 0;
-    for (int iRootIndex = 0; iRootIndex < rootIndices_.size(); ++iRootIndex) {
-        int index = rootIndices_[iRootIndex];
+    // Walks down a tree from the given root index and returns the (non-positive) index of the leaf that is reached.
+    template <bool categorical>
+    inline int leafIndex(FastForest const& ff, const FeatureType* array, int index) {
         bool isSingleLeafTree = index < 0;
         if (isSingleLeafTree) {
             // If the root index is negative, it means that the tree only has a
             // single leaf and we should jump straight into the leaves array.
             // However, the actual index is encoded as the index minus one, so
             // we don't get an ambiguity of zero. We add back that one now.
-            index++;
-        } else {
-            do {
-                auto r = rightIndices_[index];
-                auto l = leftIndices_[index];
-                index = array[cutIndices_[index]] > cutValues_[index] ? r : l;
-            } while (index > 0);
+            return index + 1;
         }
-        out[iRootIndex % nOut] += responses_[-index];
+        do {
+            auto r = ff.rightIndices_[index];
+            auto l = ff.leftIndices_[index];
+            index = detail::goesRight<categorical>(ff, array, index) ? r : l;
+        } while (index > 0);
+        return index;
+    }
+
+    // number of rows that are evaluated together in the batch interface
+    constexpr int batchBlockSize = 64;
+
+}  // namespace
+
+Transform fastforest::objectiveTransform(std::string const& objective) {
+    if (objective.empty() || objective == "binary:logitraw" || objective == "reg:squarederror" ||
+        objective == "reg:linear" || objective == "reg:squaredlogerror" || objective == "reg:pseudohubererror" ||
+        objective == "reg:absoluteerror" || objective.compare(0, 5, "rank:") == 0 || objective == "tmva:adaboost") {
+        return Transform::Identity;
+    }
+    if (objective == "binary:logistic" || objective == "reg:logistic") {
+        return Transform::Logistic;
+    }
+    if (objective == "multi:softmax" || objective == "multi:softprob") {
+        return Transform::Softmax;
     }
+    if (objective == "count:poisson" || objective == "reg:tweedie" || objective == "reg:gamma") {
+        return Transform::Exp;
+    }
+    if (objective == "tmva:grad") {
+        return Transform::Tanh;
+    }
+    throw std::runtime_error("Error in fastforest::objectiveTransform : unknown objective " + objective);
 }
 
-FastForest fastforest::load_bin(std::string const& txtpath) {
-    std::ifstream ifs(txtpath, std::ios::binary);
-    return load_bin(ifs);
+void fastforest::FastForest::set_metadata(Metadata metadata) {
+    if (metadata.nClasses < 1) {
+        throw std::runtime_error("Error in FastForest::set_metadata : nClasses should be at least one, but it is " +
+                                 std::to_string(metadata.nClasses));
+    }
+    if (metadata.vectorLeaves) {
+        if (responses_.size() % metadata.nClasses != 0) {
+            throw std::runtime_error("Error in FastForest::set_metadata : the " + std::to_string(responses_.size()) +
+                                     " responses are not a whole number of leaves with " +
+                                     std::to_string(metadata.nClasses) + " values each");
+        }
+    } else if (rootIndices_.size() % metadata.nClasses != 0) {
+        throw std::runtime_error(std::string{"Error in FastForest::set_metadata : Forest has "} +
+                                 std::to_string(rootIndices_.size()) + " trees, which is not compatible with " +
+                                 std::to_string(metadata.nClasses) + " classes!");
+    }
+    transform_ = objectiveTransform(metadata.objective);
+    if (transform_ == Transform::Softmax && metadata.nClasses < 3) {
+        throw std::runtime_error("Error in FastForest::set_metadata : objective " + metadata.objective +
+                                 " needs at least three classes");
+    }
+    metadata_ = std::move(metadata);
 }
 
-FastForest fastforest::load_bin(std::istream& is) {
-    FastForest ff;
+void fastforest::FastForest::predict(const FeatureType* array, TreeEnsembleResponseType* out) const {
+    evaluate(array, out, metadata_.nClasses, metadata_.baseResponse);
+    transform_inplace(out, 1, metadata_.nClasses, transform_);
+}
 
-    int nRootNodes = ff.rootIndices_.size();
-    int nNodes = ff.cutValues_.size();
-    int nLeaves = ff.responses_.size();
+void fastforest::FastForest::predict_batch(
+    const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads) const {
+    evaluate_batch(array, nRows, nFeatures, out, metadata_.nClasses, metadata_.baseResponse, nThreads);
+    transform_inplace(out, nRows, metadata_.nClasses, transform_);
+}
 
-    is.read((char*)&nRootNodes, sizeof(int));
-    is.read((char*)&nNodes, sizeof(int));
-    is.read((char*)&nLeaves, sizeof(int));
+void fastforest::FastForest::checkClasses(int nOut) const {
+    if (metadata_.vectorLeaves && nOut != metadata_.nClasses) {
+        throw std::runtime_error("Error in FastForest : the forest has vector leaves with " +
+                                 std::to_string(metadata_.nClasses) + " values, but " + std::to_string(nOut) +
+                                 " outputs were requested");
+    }
+    // the number of classes in the metadata was already validated
+    if (nOut != metadata_.nClasses && rootIndices_.size() % nOut != 0) {
+        throw std::runtime_error(std::string{"Error in FastForest::softmax : Forest has "} +
+                                 std::to_string(rootIndices_.size()) + " trees, " + "which is not compatible with " +
+                                 std::to_string(nOut) + " classes!");
+    }
+}
 
-    ff.rootIndices_.resize(nRootNodes);
-    ff.cutIndices_.resize(nNodes);
-    ff.cutValues_.resize(nNodes);
-    ff.leftIndices_.resize(nNodes);
-    ff.rightIndices_.resize(nNodes);
-    ff.responses_.resize(nLeaves);
+namespace {
 
-    is.read((char*)ff.rootIndices_.data(), nRootNodes * sizeof(int));
-    is.read((char*)ff.cutIndices_.data(), nNodes * sizeof(CutIndexType));
-    is.read((char*)ff.cutValues_.data(), nNodes * sizeof(FeatureType));
-    is.read((char*)ff.leftIndices_.data(), nNodes * sizeof(int));
-    is.read((char*)ff.rightIndices_.data(), nNodes * sizeof(int));
-    is.read((char*)ff.responses_.data(), nLeaves * sizeof(TreeResponseType));
+    template <bool categorical>
+    void evaluateRow(FastForest const& ff,
+                     const FeatureType* array,
+                     TreeEnsembleResponseType* out,
+                     int nOut,
+                     TreeEnsembleResponseType baseResponse) {
+        // The trees for the different classes alternate, so the trees of each class are every nOut-th tree. Summing
+        // up one class after the other keeps the sum in a register, and with a forest that is grouped by class (see
+        // FastForest::group_classes) the nodes of each class are contiguous in memory.
+        const int nTrees = ff.rootIndices_.size();
+        for (int iClass = 0; iClass < nOut; ++iClass) {
+            TreeEnsembleResponseType sum = baseResponse;
+            for (int iTree = iClass; iTree < nTrees; iTree += nOut) {
+                sum += ff.responses_[-leafIndex<categorical>(ff, array, ff.rootIndices_[iTree])];
+            }
+            out[iClass] = sum;
+        }
+    }
 
-    return ff;
+    // With vector leaves, every tree adds its leaf vector to all outputs.
+    template <bool categorical>
+    void evaluateRowVector(FastForest const& ff,
+                           const FeatureType* array,
+                           TreeEnsembleResponseType* out,
+                           int nOut,
+                           TreeEnsembleResponseType baseResponse) {
+        std::fill(out, out + nOut, baseResponse);
+        for (int root : ff.rootIndices_) {
+            const std::size_t leaf = -leafIndex<categorical>(ff, array, root);
+            detail::addLeafVector(out, &ff.responses_[leaf * nOut], nOut);
+        }
+    }
+
+}  // namespace
+
+void fastforest::FastForest::evaluate(const FeatureType* array,
+                                      TreeEnsembleResponseType* out,
+                                      int nOut,
+                                      TreeEnsembleResponseType baseResponse) const {
+    if (metadata_.vectorLeaves) {
+        checkClasses(nOut);
+        if (categorySets_.empty()) {
+            evaluateRowVector<false>(*this, array, out, nOut, baseResponse);
+        } else {
+            evaluateRowVector<true>(*this, array, out, nOut, baseResponse);
+        }
+    } else if (categorySets_.empty()) {
+        evaluateRow<false>(*this, array, out, nOut, baseResponse);
+    } else {
+        evaluateRow<true>(*this, array, out, nOut, baseResponse);
+    }
 }
 
-void fastforest::FastForest::write_bin(std::string const& filename) const {
-    std::ofstream os(filename, std::ios::binary);
+namespace {
+
+    // Evaluates the rows in blocks of batchBlockSize rows, class by class and tree by tree for each block, such that
+    // the nodes of a tree stay in the cache. addTree(root, block, blockSize, sums) adds the responses of the tree
+    // with the given root for the rows of the block to the sums.
+    template <class AddTree>
+    void evaluateInBlocks(FastForest const& ff,
+                          const FeatureType* array,
+                          int nRows,
+                          int nFeatures,
+                          TreeEnsembleResponseType* out,
+                          int nOut,
+                          TreeEnsembleResponseType baseResponse,
+                          int nThreads,
+                          AddTree const& addTree) {
+        // Evaluates the classes in [classBegin, classEnd) for the rows in [rowBegin, rowEnd).
+        auto evaluateBlock = [&](int rowBegin, int rowEnd, int classBegin, int classEnd) {
+            const int nTrees = ff.rootIndices_.size();
+            std::array<TreeEnsembleResponseType, batchBlockSize> sums;
+            for (int iClass = classBegin; iClass < classEnd; ++iClass) {
+                for (int blockBegin = rowBegin; blockBegin < rowEnd; blockBegin += batchBlockSize) {
+                    const int blockSize = std::min(batchBlockSize, rowEnd - blockBegin);
+                    const FeatureType* block = array + static_cast<std::size_t>(blockBegin) * nFeatures;
+                    sums.fill(baseResponse);
+                    for (int iTree = iClass; iTree < nTrees; iTree += nOut) {
+                        addTree(ff.rootIndices_[iTree], block, blockSize, sums.data());
+                    }
+                    for (int iRow = 0; iRow < blockSize; ++iRow) {
+                        out[static_cast<std::size_t>(blockBegin + iRow) * nOut + iClass] = sums[iRow];
+                    }
+                }
+            }
+        };
+
+        // Parallelize over the rows, or over the classes for small batches of many-class models.
+        if (nRows < nThreads && nOut > 1) {
+            detail::splitRange(nOut, nThreads, [&](int begin, int end) { evaluateBlock(0, nRows, begin, end); });
+        } else {
+            detail::splitRange(nRows, nThreads, [&](int begin, int end) { evaluateBlock(begin, end, 0, nOut); });
+        }
+    }
+
+    inline void prefetch(const void* p) {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(p);
+#else
+        (void)p;
+#endif
+    }
+
+    // Walks the nRows rows of the block through the tree with the given root index in a round-robin fashion, one
+    // level per round, and prefetches the next node of each row before moving on to the next row. The cache misses
+    // of up to nRows rows are then in flight at the same time, instead of one at a time. Writes the (non-positive)
+    // index of the leaf that each row reaches to indices.
+    template <bool categorical>
+    void leafIndicesInterleaved(FastForest const& ff,
+                                int root,
+                                const FeatureType* block,
+                                int nRows,
+                                int nFeatures,
+                                int leafSize,
+                                int* indices) {
+        if (root < 0) {
+            std::fill(indices, indices + nRows, root + 1);
+            return;
+        }
+        std::array<const FeatureType*, FastForest::maxInterleavedRows> rows;
+        for (int iRow = 0; iRow < nRows; ++iRow) {
+            rows[iRow] = block + iRow * nFeatures;
+            indices[iRow] = root;
+        }
+        // The root can have index zero, so the first step is taken unconditionally (see leafIndex).
+        int nActive = nRows;
+        bool first = true;
+        while (nActive > 0) {
+            nActive = 0;
+            for (int iRow = 0; iRow < nRows; ++iRow) {
+                const int index = indices[iRow];
+                if (index > 0 || first) {
+                    const int next = detail::goesRight<categorical>(ff, rows[iRow], index) ? ff.rightIndices_[index]
+                                                                                          : ff.leftIndices_[index];
+                    indices[iRow] = next;
+                    if (next > 0) {
+                        prefetch(&ff.cutIndices_[next]);
+                        prefetch(&ff.cutValues_[next]);
+                        prefetch(&ff.leftIndices_[next]);
+                        prefetch(&ff.rightIndices_[next]);
+                        ++nActive;
+                    } else {
+                        prefetch(&ff.responses_[static_cast<std::size_t>(-next) * leafSize]);
+                    }
+                }
+            }
+            first = false;
+        }
+    }
+
+    template <bool categorical>
+    void addTreeInterleaved(FastForest const& ff,
+                            int root,
+                            const FeatureType* block,
+                            int nRows,
+                            int nFeatures,
+                            TreeEnsembleResponseType* sums) {
+        std::array<int, FastForest::maxInterleavedRows> indices;
+        leafIndicesInterleaved<categorical>(ff, root, block, nRows, nFeatures, 1, indices.data());
+        for (int iRow = 0; iRow < nRows; ++iRow) {
+            sums[iRow] += ff.responses_[-indices[iRow]];
+        }
+    }
+
+    template <bool categorical>
+    void evaluateBatch(FastForest const& ff,
+                       const FeatureType* array,
+                       int nRows,
+                       int nFeatures,
+                       TreeEnsembleResponseType* out,
+                       int nOut,
+                       TreeEnsembleResponseType baseResponse,
+                       int nThreads) {
+        evaluateInBlocks(ff,
+                         array,
+                         nRows,
+                         nFeatures,
+                         out,
+                         nOut,
+                         baseResponse,
+                         nThreads,
+                         [&](int root, const FeatureType* block, int blockSize, TreeEnsembleResponseType* sums) {
+                             for (int iRow = 0; iRow < blockSize; ++iRow) {
+                                 const FeatureType* row = block + iRow * nFeatures;
+                                 sums[iRow] += ff.responses_[-leafIndex<categorical>(ff, row, root)];
+                             }
+                         });
+    }
 
-    int nRootNodes = rootIndices_.size();
-    int nNodes = cutValues_.size();
-    int nLeaves = responses_.size();
+    template <bool categorical>
+    void evaluateBatchInterleaved(FastForest const& ff,
+                                  const FeatureType* array,
+                                  int nRows,
+                                  int nFeatures,
+                                  TreeEnsembleResponseType* out,
+                                  int nOut,
+                                  TreeEnsembleResponseType baseResponse,
+                                  int nThreads,
+                                  int nInterleaved) {
+        evaluateInBlocks(ff,
+                         array,
+                         nRows,
+                         nFeatures,
+                         out,
+                         nOut,
+                         baseResponse,
+                         nThreads,
+                         [&](int root, const FeatureType* block, int blockSize, TreeEnsembleResponseType* sums) {
+                             for (int begin = 0; begin < blockSize; begin += nInterleaved) {
+                                 addTreeInterleaved<categorical>(ff,
+                                                                 root,
+                                                                 block + begin * nFeatures,
+                                                                 std::min(nInterleaved, blockSize - begin),
+                                                                 nFeatures,
+                                                                 sums + begin);
+                             }
+                         });
+    }
+
+    // Batch evaluation of forests with vector leaves. The rows are evaluated in blocks, and every tree adds its leaf
+    // vectors to the outputs of the rows in the block, which stay in the cache. With nInterleaved rows, the trees are
+    // walked like in evaluateBatchInterleaved, otherwise one row at a time.
+    template <bool categorical>
+    void evaluateBatchVector(FastForest const& ff,
+                             const FeatureType* array,
+                             int nRows,
+                             int nFeatures,
+                             TreeEnsembleResponseType* out,
+                             int nOut,
+                             TreeEnsembleResponseType baseResponse,
+                             int nThreads,
+                             int nInterleaved) {
+        detail::splitRange(nRows, nThreads, [&](int rowBegin, int rowEnd) {
+            std::array<int, FastForest::maxInterleavedRows> indices;
+            for (int blockBegin = rowBegin; blockBegin < rowEnd; blockBegin += batchBlockSize) {
+                const int blockSize = std::min(batchBlockSize, rowEnd - blockBegin);
+                const FeatureType* block = array + static_cast<std::size_t>(blockBegin) * nFeatures;
+                TreeEnsembleResponseType* blockOut = out + static_cast<std::size_t>(blockBegin) * nOut;
+                std::fill(blockOut, blockOut + blockSize * nOut, baseResponse);
+                for (int root : ff.rootIndices_) {
+                    if (nInterleaved == 0) {
+                        for (int iRow = 0; iRow < blockSize; ++iRow) {
+                            const std::size_t leaf = -leafIndex<categorical>(ff, block + iRow * nFeatures, root);
+                            detail::addLeafVector(blockOut + iRow * nOut, &ff.responses_[leaf * nOut], nOut);
+                        }
+                        continue;
+                    }
+                    for (int begin = 0; begin < blockSize; begin += nInterleaved) {
+                        const int n = std::min(nInterleaved, blockSize - begin);
+                        leafIndicesInterleaved<categorical>(
+                            ff, root, block + begin * nFeatures, n, nFeatures, nOut, indices.data());
+                        for (int iRow = 0; iRow < n; ++iRow) {
+                            const std::size_t leaf = -indices[iRow];
+                            detail::addLeafVector(
+                                blockOut + (begin + iRow) * nOut, &ff.responses_[leaf * nOut], nOut);
+                        }
+                    }
+                }
+            }
+        });
+    }
 
-    os.write((const char*)&nRootNodes, sizeof(int));
-    os.write((const char*)&nNodes, sizeof(int));
-    os.write((const char*)&nLeaves, sizeof(int));
+    // number of rows that are partitioned together, as many as fit in the cache together with their outputs
+    constexpr int partitionBlockSize = 2048;
 
-    os.write((const char*)rootIndices_.data(), nRootNodes * sizeof(int));
-    os.write((const char*)cutIndices_.data(), nNodes * sizeof(CutIndexType));
-    os.write((const char*)cutValues_.data(), nNodes * sizeof(FeatureType));
-    os.write((const char*)leftIndices_.data(), nNodes * sizeof(int));
-    os.write((const char*)rightIndices_.data(), nNodes * sizeof(int));
-    os.write((const char*)responses_.data(), nLeaves * sizeof(TreeResponseType));
-    os.close();
+    // Reorders the row indices in [begin, end) such that the ones for which goesRight(iRow) is false come first,
+    // keeping the order of the rows on each side, and returns the index of the first row that goes right. Each row
+    // is written to both sides and only the positions move on, so there is no branch that depends on the data.
+    template <class GoesRight>
+    inline int partitionRows(int* rows, int* rightRows, int begin, int end, GoesRight const& goesRight) {
+        int nLeft = 0;
+        int nRight = 0;
+        for (int i = begin; i < end; ++i) {
+            const int iRow = rows[i];
+            const bool right = goesRight(iRow);
+            rows[begin + nLeft] = iRow;
+            rightRows[nRight] = iRow;
+            nLeft += !right;
+            nRight += right;
+        }
+        std::copy(rightRows, rightRows + nRight, rows + begin + nLeft);
+        return begin + nLeft;
+    }
+
+    // Evaluates the rows in blocks of partitionBlockSize rows, and each tree node by node for all rows of a block:
+    // the indices of the rows that reach a node are partitioned into the ones that go left and right, and at the
+    // leaves the leaf responses are added to the outputs of the rows. The rows are walked in increasing order at
+    // every node. The trees add to the outputs in the same order as in evaluateBatch, so the sums are identical.
+    template <bool categorical, bool columnMajor>
+    void evaluateBatchPartitioned(FastForest const& ff,
+                                  const FeatureType* array,
+                                  int nRows,
+                                  int nFeatures,
+                                  TreeEnsembleResponseType* out,
+                                  int nOut,
+                                  TreeEnsembleResponseType baseResponse,
+                                  int nThreads) {
+        const bool vectorLeaves = ff.metadata().vectorLeaves;
+        const int leafSize = detail::leafSize(ff);
+        const int nTrees = ff.rootIndices_.size();
+        detail::splitRange(nRows, nThreads, [&](int rowBegin, int rowEnd) {
+            std::vector<int> rows(partitionBlockSize);
+            std::vector<int> rightRows(partitionBlockSize);
+            int* rowIndices = rows.data();
+            int* rightIndices = rightRows.data();
+            struct Range {
+                int index;  // node that the rows in [begin, end) reach
+                int begin;
+                int end;
+            };
+            std::vector<Range> stack;
+
+            for (int blockBegin = rowBegin; blockBegin < rowEnd; blockBegin += partitionBlockSize) {
+                const int blockSize = std::min(partitionBlockSize, rowEnd - blockBegin);
+                // the features of the rows in the block, by their index in the block
+                const FeatureType* block = columnMajor ? array + blockBegin
+                                                       : array + static_cast<std::size_t>(blockBegin) * nFeatures;
+                const std::size_t featureStride = columnMajor ? nRows : 1;
+                const std::size_t rowStride = columnMajor ? 1 : nFeatures;
+                TreeEnsembleResponseType* blockOut = out + static_cast<std::size_t>(blockBegin) * nOut;
+                std::fill(blockOut, blockOut + static_cast<std::size_t>(blockSize) * nOut, baseResponse);
+
+                for (int iTree = 0; iTree < nTrees; ++iTree) {
+                    const int iOut = vectorLeaves ? 0 : iTree % nOut;
+                    auto addLeaf = [&](int leaf, int begin, int end) {
+                        const TreeResponseType* values = &ff.responses_[static_cast<std::size_t>(leaf) * leafSize];
+                        for (int i = begin; i < end; ++i) {
+                            TreeEnsembleResponseType* rowOut = blockOut + static_cast<std::size_t>(rows[i]) * nOut;
+                            if (vectorLeaves) {
+                                detail::addLeafVector(rowOut, values, nOut);
+                            } else {
+                                rowOut[iOut] += *values;
+                            }
+                        }
+                    };
+
+                    for (int i = 0; i < blockSize; ++i) {
+                        rows[i] = i;
+                    }
+                    const int root = ff.rootIndices_[iTree];
+                    if (root < 0) {
+                        addLeaf(-(root + 1), 0, blockSize);
+                        continue;
+                    }
+                    stack.push_back({root, 0, blockSize});
+                    while (!stack.empty()) {
+                        const Range range = stack.back();
+                        stack.pop_back();
+                        const FeatureType cut = ff.cutValues_[range.index];
+                        const FeatureType* column = block + ff.cutIndices_[range.index] * featureStride;
+                        int middle;
+                        if (categorical && detail::isCategoricalCut(cut)) {
+                            const std::uint32_t* sets = ff.categorySets_.data();
+                            middle = partitionRows(rowIndices, rightIndices, range.begin, range.end, [&](int iRow) {
+                                return detail::inCategorySet(sets, cut, column[iRow * rowStride]);
+                            });
+                        } else {
+                            middle = partitionRows(rowIndices, rightIndices, range.begin, range.end, [&](int iRow) {
+                                return column[iRow * rowStride] > cut;
+                            });
+                        }
+                        // Except for the root, a non-positive index refers to a leaf (see FastForest::evaluate).
+                        const Range children[2] = {{ff.leftIndices_[range.index], range.begin, middle},
+                                                   {ff.rightIndices_[range.index], middle, range.end}};
+                        for (Range const& child : children) {
+                            if (child.begin == child.end) {
+                                continue;
+                            }
+                            if (child.index > 0) {
+                                stack.push_back(child);
+                            } else {
+                                addLeaf(-child.index, child.begin, child.end);
+                            }
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+}  // namespace
+
+void fastforest::FastForest::evaluate_batch(const FeatureType* array,
+                                            int nRows,
+                                            int nFeatures,
+                                            TreeEnsembleResponseType* out,
+                                            int nOut,
+                                            TreeEnsembleResponseType baseResponse,
+                                            int nThreads) const {
+    checkClasses(nOut);
+    if (metadata_.vectorLeaves) {
+        if (categorySets_.empty()) {
+            evaluateBatchVector<false>(*this, array, nRows, nFeatures, out, nOut, baseResponse, nThreads, 0);
+        } else {
+            evaluateBatchVector<true>(*this, array, nRows, nFeatures, out, nOut, baseResponse, nThreads, 0);
+        }
+    } else if (categorySets_.empty()) {
+        evaluateBatch<false>(*this, array, nRows, nFeatures, out, nOut, baseResponse, nThreads);
+    } else {
+        evaluateBatch<true>(*this, array, nRows, nFeatures, out, nOut, baseResponse, nThreads);
+    }
+}
+
+void fastforest::FastForest::evaluate_batch_interleaved(const FeatureType* array,
+                                                        int nRows,
+                                                        int nFeatures,
+                                                        TreeEnsembleResponseType* out,
+                                                        int nOut,
+                                                        TreeEnsembleResponseType baseResponse,
+                                                        int nThreads,
+                                                        int nInterleaved) const {
+    checkClasses(nOut);
+    if (nInterleaved < 1 || nInterleaved > maxInterleavedRows) {
+        throw std::runtime_error("Error in FastForest::evaluate_batch_interleaved : the number of interleaved rows "
+                                 "has to be between 1 and " +
+                                 std::to_string(maxInterleavedRows));
+    }
+    if (metadata_.vectorLeaves) {
+        if (categorySets_.empty()) {
+            evaluateBatchVector<false>(
+                *this, array, nRows, nFeatures, out, nOut, baseResponse, nThreads, nInterleaved);
+        } else {
+            evaluateBatchVector<true>(*this, array, nRows, nFeatures, out, nOut, baseResponse, nThreads, nInterleaved);
+        }
+    } else if (categorySets_.empty()) {
+        evaluateBatchInterleaved<false>(
+            *this, array, nRows, nFeatures, out, nOut, baseResponse, nThreads, nInterleaved);
+    } else {
+        evaluateBatchInterleaved<true>(
+            *this, array, nRows, nFeatures, out, nOut, baseResponse, nThreads, nInterleaved);
+    }
+}
+
+void fastforest::FastForest::evaluate_batch_partitioned(const FeatureType* array,
+                                                        int nRows,
+                                                        int nFeatures,
+                                                        TreeEnsembleResponseType* out,
+                                                        int nOut,
+                                                        TreeEnsembleResponseType baseResponse,
+                                                        int nThreads,
+                                                        bool columnMajor) const {
+    checkClasses(nOut);
+    if (columnMajor) {
+        if (categorySets_.empty()) {
+            evaluateBatchPartitioned<false, true>(*this, array, nRows, nFeatures, out, nOut, baseResponse, nThreads);
+        } else {
+            evaluateBatchPartitioned<true, true>(*this, array, nRows, nFeatures, out, nOut, baseResponse, nThreads);
+        }
+    } else if (categorySets_.empty()) {
+        evaluateBatchPartitioned<false, false>(*this, array, nRows, nFeatures, out, nOut, baseResponse, nThreads);
+    } else {
+        evaluateBatchPartitioned<true, false>(*this, array, nRows, nFeatures, out, nOut, baseResponse, nThreads);
+    }
 }
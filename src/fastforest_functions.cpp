@@ -124,7 +124,9 @@ namespace {
 
 }  // namespace
 
-FastForest fastforest::load_txt(std::string const& txtpath, std::vector<std::string>& features) {
+FastForest fastforest::load_txt(std::string const& txtpath,
+                                std::vector<std::string>& features,
+                                MemoryResource* resource) {
     const std::string info = "constructing FastForest from " + txtpath + ": ";
 
     if (!util::exists(txtpath)) {
@@ -132,13 +134,40 @@ FastForest fastforest::load_txt(std::string const& txtpath, std::vector<std::str
     }
 
     std::ifstream file(txtpath);
-    return load_txt(file, features);
+    return load_txt(file, features, resource);
 }
 
-FastForest fastforest::load_txt(std::istream& file, std::vector<std::string>& features) {
+FastForest fastforest::load_txt(std::istream& file, std::vector<std::string>& features, MemoryResource* resource) {
     const std::string info = "constructing FastForest from istream: ";
 
-    FastForest ff;
+    FastForest ff{resource};
+
+    // If the stream is seekable, count the nodes and leaves first such that the arrays can be allocated only once.
+    const auto begin = file.tellg();
+    if (begin != std::istream::pos_type(-1)) {
+        int nNodes = 0;
+        int nLeaves = 0;
+        int nTrees = 0;
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.find("leaf=") != std::string::npos) {
+                ++nLeaves;
+            } else if (line.find(":[") != std::string::npos) {
+                ++nNodes;
+            } else if (line.find("booster[") != std::string::npos) {
+                ++nTrees;
+            }
+        }
+        file.clear();
+        file.seekg(begin);
+
+        ff.rootIndices_.reserve(nTrees);
+        ff.cutIndices_.reserve(nNodes);
+        ff.cutValues_.reserve(nNodes);
+        ff.leftIndices_.reserve(nNodes);
+        ff.rightIndices_.reserve(nNodes);
+        ff.responses_.reserve(nLeaves);
+    }
 
     int nVariables = 0;
     std::unordered_map<std::string, int> varIndices;
@@ -173,9 +202,28 @@ FastForest fastforest::load_txt(std::istream& file, std::vector<std::string>& fe
                 ss >> index;
                 line = ss.str();
 
-                auto splitstring = util::split(subline, '<');
-                auto const& varName = splitstring[0];
-                FeatureType cutValue = std::stold(splitstring[1]);
+                // Numerical splits are written as [feature<cut], categorical ones as [feature:{c0,c1,...}].
+                const auto categoriesBegin = subline.find(":{");
+                const bool isCategorical = categoriesBegin != std::string::npos;
+                FeatureType cutValue;
+                std::string varName;
+                if (isCategorical) {
+                    varName = subline.substr(0, categoriesBegin);
+                    std::vector<std::uint32_t> categories;
+                    const auto categoriesEnd = subline.find('}', categoriesBegin);
+                    for (auto const& category :
+                         util::split(subline.substr(categoriesBegin + 2, categoriesEnd - categoriesBegin - 2), ',')) {
+                        if (!util::isInteger(category) || category[0] == '-') {
+                            throw std::runtime_error(info + "invalid category " + category);
+                        }
+                        categories.push_back(std::stoul(category));
+                    }
+                    cutValue = detail::appendCategorySet(ff, categories);
+                } else {
+                    auto splitstring = util::split(subline, '<');
+                    varName = splitstring[0];
+                    cutValue = std::stold(splitstring[1]);
+                }
                 if (!varIndices.count(varName)) {
                     if (fixFeatures) {
                         throw std::runtime_error(info + "feature " + varName + " not in list of features");
@@ -199,10 +247,11 @@ FastForest fastforest::load_txt(std::istream& file, std::vector<std::string>& fe
                     throw std::runtime_error(info + "problem while parsing the text dump");
                 }
 
+                // The categories in the set take the "yes" branch, which FastForest evaluates as the right child.
                 ff.cutValues_.push_back(cutValue);
                 ff.cutIndices_.push_back(varIndices[varName]);
-                ff.leftIndices_.push_back(yes);
-                ff.rightIndices_.push_back(no);
+                ff.leftIndices_.push_back(isCategorical ? no : yes);
+                ff.rightIndices_.push_back(isCategorical ? yes : no);
                 auto nNodeIndices = nodeIndices.size();
                 nodeIndices[index] = nNodeIndices + nPreviousNodes;
             }
@@ -223,5 +272,9 @@ FastForest fastforest::load_txt(std::istream& file, std::vector<std::string>& fe
     }
     terminateTree(ff, nPreviousNodes, nPreviousLeaves, nodeIndices, leafIndices);
 
+    Metadata metadata;
+    metadata.features = features;
+    ff.set_metadata(std::move(metadata));
+
     return ff;
 }
@@ -0,0 +1,78 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "fastforest_handle.h"
+
+#include <utility>
+
+using namespace fastforest;
+
+ModelHandle::ModelHandle(FastForest forest) : current_{new FastForest(std::move(forest))} {}
+
+ModelHandle::~ModelHandle() {
+    {
+        std::lock_guard<std::mutex> lock(reloadMutex_);
+        if (reloadThread_.joinable()) {
+            reloadThread_.join();
+        }
+    }
+    delete current_.load();
+}
+
+void ModelHandle::publish(FastForest forest) {
+    auto next = new FastForest(std::move(forest));
+
+    std::lock_guard<std::mutex> lock(publishMutex_);
+    FastForest const* old = current_.exchange(next);
+    // Readers that register from now on belong to the new epoch and see the new forest. The ones that registered
+    // in the old epoch might still use the old forest, so it can only be freed when they are all done.
+    const int parity = epoch_.fetch_add(1) & 1;
+    while (readers_[parity].count.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+    delete old;
+}
+
+std::future<void> ModelHandle::reloadInBackground(std::function<FastForest()> load) {
+    std::lock_guard<std::mutex> lock(reloadMutex_);
+    if (reloadThread_.joinable()) {
+        reloadThread_.join();
+    }
+    std::packaged_task<void()> task([this, load]() { publish(load()); });
+    auto future = task.get_future();
+    reloadThread_ = std::thread(std::move(task));
+    return future;
+}
+
+std::future<void> ModelHandle::reload_bin(std::string const& path, MemoryResource* resource) {
+    return reloadInBackground([path, resource]() { return load_bin(path, resource); });
+}
+
+std::future<void> ModelHandle::reload_txt(std::string const& path,
+                                          std::vector<std::string> features,
+                                          MemoryResource* resource) {
+    return reloadInBackground([path, features, resource]() mutable { return load_txt(path, features, resource); });
+}
@@ -0,0 +1,168 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "common_details.h"
+#include "fastforest.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace fastforest;
+
+namespace {
+
+    // number of rows that are evaluated together, such that the nodes of a tree stay in the cache
+    constexpr int blockSize = 64;
+
+    std::uint32_t leafBits(TreeResponseType value) {
+        static_assert(sizeof(TreeResponseType) == sizeof(std::uint32_t), "leaf values have to fit in a child slot");
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    template <bool categorical>
+    inline TreeResponseType leafValue(InlinedForest::Node const* nodes,
+                                      const std::uint32_t* categorySets,
+                                      std::uint32_t root,
+                                      const FeatureType* row) {
+        InlinedForest::Node const* node = nodes + root;
+        while (true) {
+            // Both children are loaded before the comparison, so it only decides between two registers.
+            const CutIndexType feature = node->feature;
+            const std::uint32_t left = node->children[0];
+            const std::uint32_t right = node->children[1];
+            const FeatureType value = row[feature & InlinedForest::featureMask];
+            const bool goesRight = categorical && detail::isCategoricalCut(node->cut)
+                                       ? detail::inCategorySet(categorySets, node->cut, value)
+                                       : value > node->cut;
+            const std::uint32_t child = goesRight ? right : left;
+            if (feature & (InlinedForest::leftLeafFlag >> goesRight)) {
+                TreeResponseType leaf;
+                std::memcpy(&leaf, &child, sizeof(leaf));
+                return leaf;
+            }
+            node = nodes + child;
+        }
+    }
+
+}  // namespace
+
+fastforest::InlinedForest::InlinedForest(FastForest const& forest)
+    : nodes_{forest.cutValues_.get_allocator().resource()},
+      categorySets_{forest.categorySets_},
+      metadata_{forest.metadata()},
+      transform_{objectiveTransform(forest.metadata().objective)} {
+    if (metadata_.vectorLeaves) {
+        throw std::runtime_error("Error in fastforest::InlinedForest : vector leaves don't fit in the child slots");
+    }
+    const std::size_t nNodes = forest.cutValues_.size();
+    nodes_.resize(nNodes);
+    for (std::size_t i = 0; i < nNodes; ++i) {
+        if (forest.cutIndices_[i] > featureMask) {
+            throw std::runtime_error("Error in fastforest::InlinedForest : feature index " +
+                                     std::to_string(forest.cutIndices_[i]) + " is too large");
+        }
+        Node& node = nodes_[i];
+        node.cut = forest.cutValues_[i];
+        node.feature = forest.cutIndices_[i];
+        // Except for the root, a non-positive index refers to a leaf (see FastForest::evaluate).
+        const int children[2] = {forest.leftIndices_[i], forest.rightIndices_[i]};
+        for (int side = 0; side < 2; ++side) {
+            if (children[side] > 0) {
+                node.children[side] = children[side];
+            } else {
+                node.children[side] = leafBits(forest.responses_[-children[side]]);
+                node.feature |= leftLeafFlag >> side;
+            }
+        }
+    }
+
+    const int nOut = metadata_.nClasses;
+    const int nTrees = forest.rootIndices_.size();
+    constants_.assign(nOut, metadata_.baseResponse);
+    for (int iClass = 0; iClass < nOut; ++iClass) {
+        classBegins_.push_back(roots_.size());
+        for (int iTree = iClass; iTree < nTrees; iTree += nOut) {
+            const int root = forest.rootIndices_[iTree];
+            if (root < 0) {
+                constants_[iClass] += forest.responses_[-(root + 1)];
+            } else {
+                roots_.push_back(root);
+            }
+        }
+    }
+    classBegins_.push_back(roots_.size());
+}
+
+template <bool categorical>
+void fastforest::InlinedForest::evaluateBlock(const FeatureType* array,
+                                              int nRows,
+                                              int nFeatures,
+                                              TreeEnsembleResponseType* out) const {
+    const int nOut = metadata_.nClasses;
+    TreeEnsembleResponseType sums[blockSize];
+    for (int iClass = 0; iClass < nOut; ++iClass) {
+        std::fill(sums, sums + nRows, constants_[iClass]);
+        for (int iRoot = classBegins_[iClass]; iRoot < classBegins_[iClass + 1]; ++iRoot) {
+            const std::uint32_t root = roots_[iRoot];
+            for (int iRow = 0; iRow < nRows; ++iRow) {
+                const FeatureType* row = array + iRow * nFeatures;
+                sums[iRow] += leafValue<categorical>(nodes_.data(), categorySets_.data(), root, row);
+            }
+        }
+        for (int iRow = 0; iRow < nRows; ++iRow) {
+            out[iRow * nOut + iClass] = sums[iRow];
+        }
+    }
+}
+
+void fastforest::InlinedForest::evaluate_batch(
+    const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads) const {
+    const int nOut = metadata_.nClasses;
+    detail::splitRange(nRows, nThreads, [&](int begin, int end) {
+        for (int blockBegin = begin; blockBegin < end; blockBegin += blockSize) {
+            const FeatureType* block = array + static_cast<std::size_t>(blockBegin) * nFeatures;
+            const int n = std::min(blockSize, end - blockBegin);
+            TreeEnsembleResponseType* blockOut = out + static_cast<std::size_t>(blockBegin) * nOut;
+            if (categorySets_.empty()) {
+                evaluateBlock<false>(block, n, nFeatures, blockOut);
+            } else {
+                evaluateBlock<true>(block, n, nFeatures, blockOut);
+            }
+        }
+    });
+}
+
+void fastforest::InlinedForest::predict_batch(
+    const FeatureType* array, int nRows, int nFeatures, TreeEnsembleResponseType* out, int nThreads) const {
+    evaluate_batch(array, nRows, nFeatures, out, nThreads);
+    transform_inplace(out, nRows, metadata_.nClasses, transform_);
+}
@@ -0,0 +1,339 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "common_details.h"
+#include "fastforest.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace fastforest;
+
+namespace {
+
+    // Empty forest with the same memory resource and array capacities as the given one.
+    FastForest emptyLike(FastForest const& ff) {
+        FastForest out{ff.cutValues_.get_allocator().resource()};
+        out.rootIndices_.reserve(ff.rootIndices_.size());
+        out.cutIndices_.reserve(ff.cutIndices_.size());
+        out.cutValues_.reserve(ff.cutValues_.size());
+        out.leftIndices_.reserve(ff.leftIndices_.size());
+        out.rightIndices_.reserve(ff.rightIndices_.size());
+        out.responses_.reserve(ff.responses_.size());
+        // the nodes keep their cut values, which refer to the category sets
+        out.categorySets_ = ff.categorySets_;
+        out.set_metadata(ff.metadata());
+        return out;
+    }
+
+    std::uint32_t bits(float x) {
+        std::uint32_t out;
+        std::memcpy(&out, &x, sizeof(float));
+        return out;
+    }
+
+    std::size_t nBytes(FastForest const& ff) {
+        return ff.rootIndices_.size() * sizeof(int) + ff.cutIndices_.size() * sizeof(CutIndexType) +
+               ff.cutValues_.size() * sizeof(FeatureType) + ff.leftIndices_.size() * sizeof(int) +
+               ff.rightIndices_.size() * sizeof(int) + ff.responses_.size() * sizeof(TreeResponseType) +
+               ff.categorySets_.size() * sizeof(std::uint32_t);
+    }
+
+    // Hash-consing of subtrees: every distinct leaf and every distinct node (the cut together with the distinct
+    // subtrees of its children) gets an id, so identical subtrees get the same id.
+    class SubtreeIds {
+      public:
+        struct Subtree {
+            bool isLeaf;
+            CutIndexType cutIndex;
+            FeatureType cutValue;
+            int left;
+            int right;
+            TreeResponseType response;
+        };
+
+        int leaf(TreeResponseType response) {
+            auto inserted = leafIds_.emplace(bits(response), subtrees_.size());
+            if (inserted.second) {
+                subtrees_.push_back({true, 0, 0, 0, 0, response});
+            }
+            return inserted.first->second;
+        }
+
+        int node(CutIndexType cutIndex, FeatureType cutValue, int left, int right) {
+            // a split where both sides are the same is not needed
+            if (left == right) {
+                return left;
+            }
+            NodeKey key{cutIndex, bits(cutValue), left, right};
+            auto inserted = nodeIds_.emplace(key, subtrees_.size());
+            if (inserted.second) {
+                subtrees_.push_back({false, cutIndex, cutValue, left, right, 0});
+            }
+            return inserted.first->second;
+        }
+
+        Subtree const& operator[](int id) const { return subtrees_[id]; }
+        std::size_t size() const { return subtrees_.size(); }
+
+      private:
+        struct NodeKey {
+            CutIndexType cutIndex;
+            std::uint32_t cutValue;
+            int left;
+            int right;
+            bool operator==(NodeKey const& other) const {
+                return cutIndex == other.cutIndex && cutValue == other.cutValue && left == other.left &&
+                       right == other.right;
+            }
+        };
+        struct NodeKeyHash {
+            std::size_t operator()(NodeKey const& key) const {
+                std::uint64_t h = key.cutIndex;
+                for (std::uint64_t x : {std::uint64_t(key.cutValue), std::uint64_t(key.left), std::uint64_t(key.right)}) {
+                    h = (h ^ x) * 0x100000001b3ull;
+                }
+                return static_cast<std::size_t>(h ^ (h >> 29));
+            }
+        };
+
+        std::vector<Subtree> subtrees_;
+        std::unordered_map<std::uint32_t, int> leafIds_;
+        std::unordered_map<NodeKey, int, NodeKeyHash> nodeIds_;
+    };
+
+    // Returns the subtree id of the tree with the given root index, visiting the children before their parents.
+    int subtreeId(FastForest const& ff, int root, SubtreeIds& ids) {
+        if (root < 0) {
+            return ids.leaf(ff.responses_[-(root + 1)]);
+        }
+        struct StackEntry {
+            int index;
+            bool childrenDone;
+        };
+        std::vector<StackEntry> stack{{root, false}};
+        // ids of the finished child nodes, where the left subtree is always finished before the right one
+        std::vector<int> results;
+        auto childId = [&](int child) {
+            if (child > 0) {
+                int id = results.back();
+                results.pop_back();
+                return id;
+            }
+            return ids.leaf(ff.responses_[-child]);
+        };
+        while (!stack.empty()) {
+            StackEntry entry = stack.back();
+            stack.pop_back();
+            const int left = ff.leftIndices_[entry.index];
+            const int right = ff.rightIndices_[entry.index];
+            if (entry.childrenDone) {
+                const int rightId = childId(right);
+                const int leftId = childId(left);
+                results.push_back(ids.node(ff.cutIndices_[entry.index], ff.cutValues_[entry.index], leftId, rightId));
+                continue;
+            }
+            stack.push_back({entry.index, true});
+            if (right > 0) {
+                stack.push_back({right, false});
+            }
+            if (left > 0) {
+                stack.push_back({left, false});
+            }
+        }
+        return results.back();
+    }
+
+}  // namespace
+
+void fastforest::FastForest::reorder(const FeatureType* array, int nRows, int nFeatures) {
+    const int nNodes = cutValues_.size();
+
+    // count how often the right child is taken at each node
+    std::vector<unsigned long> nVisits(nNodes, 0);
+    std::vector<unsigned long> nRightTaken(nNodes, 0);
+    for (int iRow = 0; iRow < nRows; ++iRow) {
+        const FeatureType* row = array + static_cast<std::size_t>(iRow) * nFeatures;
+        for (int index : rootIndices_) {
+            if (index < 0) {
+                continue;
+            }
+            do {
+                ++nVisits[index];
+                bool goRight = detail::goesRight(*this, row, index);
+                nRightTaken[index] += goRight;
+                index = goRight ? rightIndices_[index] : leftIndices_[index];
+            } while (index > 0);
+        }
+    }
+
+    // Always descending into the more frequently taken child first, the hot child of each node is stored right
+    // after its parent and the leaves are ordered by how hot their path is.
+    auto ff = emptyLike(*this);
+    for (int root : rootIndices_) {
+        detail::appendTree(*this, root, ff, [&](int index) { return 2 * nRightTaken[index] > nVisits[index]; });
+    }
+
+    *this = std::move(ff);
+}
+
+void fastforest::FastForest::group_classes(int nClasses) {
+    if (metadata_.vectorLeaves) {
+        throw std::runtime_error("Error in FastForest::group_classes : the trees of forests with vector leaves don't "
+                                 "belong to classes");
+    }
+    checkClasses(nClasses);
+
+    const int nTrees = rootIndices_.size();
+    auto ff = emptyLike(*this);
+    ff.rootIndices_.clear();
+
+    // Place the trees class by class, but remember the new root indices in the original tree order.
+    std::vector<int> rootIndices(nTrees);
+    for (int iClass = 0; iClass < nClasses; ++iClass) {
+        for (int iTree = iClass; iTree < nTrees; iTree += nClasses) {
+            detail::appendTree(*this, rootIndices_[iTree], ff, [](int) { return false; });
+            rootIndices[iTree] = ff.rootIndices_.back();
+        }
+    }
+    ff.rootIndices_.assign(rootIndices.begin(), rootIndices.end());
+
+    Metadata metadata = metadata_;
+    metadata.nClasses = nClasses;
+    ff.set_metadata(std::move(metadata));
+
+    *this = std::move(ff);
+}
+
+SimplifyReport fastforest::FastForest::simplify(int nClasses) {
+    if (metadata_.vectorLeaves) {
+        throw std::runtime_error("Error in FastForest::simplify : forests with vector leaves are not supported");
+    }
+    if (nClasses < 1) {
+        throw std::runtime_error("Error in FastForest::simplify : the number of classes has to be positive");
+    }
+    checkClasses(nClasses);
+    const int nTrees = rootIndices_.size();
+
+    SimplifyReport report;
+    report.nTreesBefore = nTrees;
+    report.nNodesBefore = cutValues_.size();
+    report.nLeavesBefore = responses_.size();
+    report.bytesBefore = nBytes(*this);
+
+    SubtreeIds ids;
+    std::vector<int> treeIds(nTrees);
+    for (int iTree = 0; iTree < nTrees; ++iTree) {
+        treeIds[iTree] = subtreeId(*this, rootIndices_[iTree], ids);
+    }
+
+    // Sort the trees of each class into the ones with splits and the constant ones, which are summed up.
+    std::vector<std::vector<int>> classTrees(nClasses);
+    std::vector<double> classConstants(nClasses, 0.);
+    bool hasConstants = false;
+    for (int iTree = 0; iTree < nTrees; ++iTree) {
+        auto const& subtree = ids[treeIds[iTree]];
+        if (subtree.isLeaf) {
+            classConstants[iTree % nClasses] += subtree.response;
+            hasConstants = true;
+        } else {
+            classTrees[iTree % nClasses].push_back(treeIds[iTree]);
+        }
+    }
+    // The trees stay interleaved by class. If the classes end up with different numbers of trees, the ones with
+    // fewer trees are padded with zero leaves.
+    std::size_t nRounds = 0;
+    for (auto& trees : classTrees) {
+        if (hasConstants) {
+            trees.push_back(ids.leaf(0));
+        }
+        nRounds = std::max(nRounds, trees.size());
+    }
+    for (int iClass = 0; iClass < nClasses && hasConstants; ++iClass) {
+        classTrees[iClass].back() = ids.leaf(static_cast<TreeResponseType>(classConstants[iClass]));
+        classTrees[iClass].resize(nRounds, ids.leaf(0));
+    }
+
+    // Place the distinct subtrees in depth-first order, where a subtree that was already placed is referenced
+    // instead of copied. Node zero can't be shared, because a child index of zero means the first leaf.
+    FastForest ff{cutValues_.get_allocator().resource()};
+    std::vector<int> newIndices(ids.size(), -1);
+    struct StackEntry {
+        int id;
+        int newParent;
+        bool isRight;
+    };
+    std::vector<StackEntry> stack;
+    for (std::size_t iRound = 0; iRound < nRounds; ++iRound) {
+        for (int iClass = 0; iClass < nClasses; ++iClass) {
+            const int treeId = classTrees[iClass][iRound];
+            stack.push_back({treeId, -1, false});
+            while (!stack.empty()) {
+                StackEntry entry = stack.back();
+                stack.pop_back();
+                auto const& subtree = ids[entry.id];
+                int& newIndex = newIndices[entry.id];
+                if (newIndex < 0 || (newIndex == 0 && !subtree.isLeaf && entry.newParent >= 0)) {
+                    if (subtree.isLeaf) {
+                        newIndex = ff.responses_.size();
+                        ff.responses_.push_back(subtree.response);
+                    } else {
+                        newIndex = ff.cutValues_.size();
+                        ff.cutIndices_.push_back(subtree.cutIndex);
+                        ff.cutValues_.push_back(subtree.cutValue);
+                        ff.leftIndices_.push_back(0);
+                        ff.rightIndices_.push_back(0);
+                        stack.push_back({subtree.right, newIndex, true});
+                        stack.push_back({subtree.left, newIndex, false});
+                    }
+                }
+                if (entry.newParent >= 0) {
+                    (entry.isRight ? ff.rightIndices_ : ff.leftIndices_)[entry.newParent] =
+                        subtree.isLeaf ? -newIndex : newIndex;
+                } else {
+                    // a leaf as root means a single-leaf tree (see FastForest::evaluate)
+                    ff.rootIndices_.push_back(subtree.isLeaf ? -newIndex - 1 : newIndex);
+                }
+            }
+        }
+    }
+
+    ff.categorySets_ = categorySets_;
+    Metadata metadata = metadata_;
+    metadata.nClasses = nClasses;
+    ff.set_metadata(std::move(metadata));
+    *this = std::move(ff);
+
+    report.nTreesAfter = rootIndices_.size();
+    report.nNodesAfter = cutValues_.size();
+    report.nLeavesAfter = responses_.size();
+    report.bytesAfter = nBytes(*this);
+    return report;
+}
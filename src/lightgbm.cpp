@@ -0,0 +1,288 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "fastforest.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace fastforest;
+
+namespace {
+
+    [[noreturn]] void fail(std::string const& what) {
+        throw std::runtime_error("Error in fastforest::load_lightgbm_txt : " + what);
+    }
+
+    // The key=value lines of one section of the model file, i.e. of the header or of a tree.
+    typedef std::unordered_map<std::string, std::string> Section;
+
+    std::string const& get(Section const& section, std::string const& key) {
+        auto found = section.find(key);
+        if (found == section.end()) {
+            fail("missing key " + key);
+        }
+        return found->second;
+    }
+
+    template <class T>
+    std::vector<T> parseList(std::string const& str) {
+        std::vector<T> out;
+        const char* cur = str.c_str();
+        char* next;
+        while (true) {
+            double value = std::strtod(cur, &next);
+            if (next == cur) {
+                break;
+            }
+            out.push_back(static_cast<T>(value));
+            cur = next;
+        }
+        return out;
+    }
+
+    // Reads the key=value lines until the next empty line. Lines without '=' are stored as keys with empty values.
+    // Returns false at the end of the stream or at the end of the trees.
+    bool readSection(std::istream& is, Section& section) {
+        section.clear();
+        std::string line;
+        while (std::getline(is, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty()) {
+                if (section.empty()) {
+                    continue;
+                }
+                return true;
+            }
+            if (line == "end of trees") {
+                return false;
+            }
+            auto eq = line.find('=');
+            if (eq == std::string::npos) {
+                section[line] = "";
+            } else {
+                section[line.substr(0, eq)] = line.substr(eq + 1);
+            }
+        }
+        return !section.empty();
+    }
+
+    // LightGBM goes left if x <= threshold, with the threshold in double precision. For float inputs, that is the
+    // same as x <= cut with the largest float not above the threshold, and FastForest goes left if x <= cut.
+    FeatureType cutBelow(double threshold) {
+        auto cut = static_cast<FeatureType>(threshold);
+        if (cut > threshold) {
+            cut = std::nextafter(cut, -std::numeric_limits<FeatureType>::infinity());
+        }
+        return cut;
+    }
+
+    void appendTree(FastForest& ff,
+                    Section const& tree,
+                    std::vector<CutIndexType> const& featureIndices,
+                    double scale) {
+        const int nLeaves = std::atoi(get(tree, "num_leaves").c_str());
+        const auto leafValues = parseList<double>(get(tree, "leaf_value"));
+        if (nLeaves < 1 || static_cast<int>(leafValues.size()) != nLeaves) {
+            fail("inconsistent number of leaves");
+        }
+        if (tree.count("is_linear") && get(tree, "is_linear") != "0") {
+            fail("linear trees are not supported");
+        }
+
+        const int nodeOffset = ff.cutValues_.size();
+        const int leafOffset = ff.responses_.size();
+        for (double value : leafValues) {
+            ff.responses_.push_back(scale * value);
+        }
+        if (nLeaves == 1) {
+            ff.rootIndices_.push_back(-leafOffset - 1);
+            return;
+        }
+        ff.rootIndices_.push_back(nodeOffset);
+
+        const int nNodes = nLeaves - 1;
+        const auto splitFeatures = parseList<int>(get(tree, "split_feature"));
+        const auto thresholds = parseList<double>(get(tree, "threshold"));
+        const auto decisionTypes = parseList<int>(get(tree, "decision_type"));
+        const auto leftChildren = parseList<int>(get(tree, "left_child"));
+        const auto rightChildren = parseList<int>(get(tree, "right_child"));
+        for (auto size : {splitFeatures.size(), thresholds.size(), leftChildren.size(), rightChildren.size()}) {
+            if (static_cast<int>(size) != nNodes) {
+                fail("inconsistent number of nodes");
+            }
+        }
+
+        // Children with negative indices are leaves, encoded as the bitwise complement of the leaf index.
+        auto childIndex = [&](int child) {
+            if (child >= nNodes || ~child >= nLeaves) {
+                fail("child index out of range");
+            }
+            return child >= 0 ? nodeOffset + child : -(leafOffset + ~child);
+        };
+
+        for (int i = 0; i < nNodes; ++i) {
+            // bit 0: categorical split, bit 1: default left, bits 2 and 3: missing type (none, zero or NaN)
+            const int decisionType = i < static_cast<int>(decisionTypes.size()) ? decisionTypes[i] : 0;
+            if (decisionType & 1) {
+                fail("categorical splits are not supported");
+            }
+            const bool defaultLeft = decisionType & 2;
+            const int missingType = (decisionType >> 2) & 3;
+            // With the zero missing type, zeros go in the default direction, which can only be represented if the
+            // default direction is the one that the cut picks for zero anyway. Missing values (NaN) go left like for
+            // all other loaders, whatever the default direction of the split.
+            if (missingType == 1 && defaultLeft != (0. <= thresholds[i])) {
+                fail("splits that treat zero as missing value are not supported");
+            }
+            if (splitFeatures[i] < 0 || splitFeatures[i] >= static_cast<int>(featureIndices.size())) {
+                fail("split on unknown feature " + std::to_string(splitFeatures[i]));
+            }
+            ff.cutIndices_.push_back(featureIndices[splitFeatures[i]]);
+            ff.cutValues_.push_back(cutBelow(thresholds[i]));
+            ff.leftIndices_.push_back(childIndex(leftChildren[i]));
+            ff.rightIndices_.push_back(childIndex(rightChildren[i]));
+        }
+    }
+
+    // Sets the objective of the metadata that corresponds to the LightGBM objective and returns the factor that has
+    // to be applied to the leaves for the sigmoid parameter.
+    double resolveObjective(std::string const& objective, Metadata& metadata) {
+        std::istringstream ss(objective);
+        std::string name;
+        ss >> name;
+        double sigmoid = 1.;
+        std::string parameter;
+        while (ss >> parameter) {
+            if (parameter.compare(0, 8, "sigmoid:") == 0) {
+                sigmoid = std::strtod(parameter.c_str() + 8, nullptr);
+            } else if (parameter == "sqrt") {
+                fail("regression with the sqrt option is not supported");
+            }
+        }
+        if (name == "binary" || name == "multiclassova") {
+            metadata.objective = "binary:logistic";
+            return sigmoid;
+        }
+        if (name == "cross_entropy" || name == "xentropy") {
+            metadata.objective = "binary:logistic";
+        } else if (name == "multiclass" || name == "softmax") {
+            metadata.objective = "multi:softprob";
+        } else if (name == "poisson" || name == "gamma" || name == "tweedie") {
+            metadata.objective = "count:poisson";
+        } else if (name != "regression" && name != "regression_l1" && name != "huber" && name != "fair" &&
+                   name != "quantile" && name != "mape" && name != "lambdarank" && name != "rank_xendcg") {
+            fail("unsupported objective " + name);
+        }
+        return 1.;
+    }
+
+}  // namespace
+
+FastForest fastforest::load_lightgbm_txt(std::string const& txtpath,
+                                         std::vector<std::string>& features,
+                                         MemoryResource* resource) {
+    std::ifstream file(txtpath);
+    if (!file) {
+        fail("can't open " + txtpath);
+    }
+    return load_lightgbm_txt(file, features, resource);
+}
+
+FastForest fastforest::load_lightgbm_txt(std::istream& is,
+                                         std::vector<std::string>& features,
+                                         MemoryResource* resource) {
+    Section header;
+    if (!readSection(is, header) || !header.count("tree")) {
+        fail("not a LightGBM model file");
+    }
+
+    // map the features of the model to the requested features, or take them over if no features were requested
+    std::vector<std::string> modelFeatures;
+    std::istringstream ss(get(header, "feature_names"));
+    for (std::string name; ss >> name;) {
+        modelFeatures.push_back(name);
+    }
+    if (features.empty()) {
+        features = modelFeatures;
+    }
+    std::unordered_map<std::string, int> featureIndex;
+    for (std::size_t i = 0; i < features.size(); ++i) {
+        featureIndex[features[i]] = i;
+    }
+    std::vector<CutIndexType> featureIndices;
+    for (auto const& name : modelFeatures) {
+        auto found = featureIndex.find(name);
+        if (found == featureIndex.end()) {
+            fail("feature " + name + " not in list of features");
+        }
+        featureIndices.push_back(found->second);
+    }
+
+    Metadata metadata;
+    metadata.baseResponse = 0.;
+    metadata.features = features;
+    // The trees of multiclass models are interleaved by class, just like in XGBoost.
+    metadata.nClasses = std::atoi(get(header, "num_tree_per_iteration").c_str());
+    // The sigmoid parameter of the binary objectives is folded into the leaves, so the logistic function applies.
+    double scale = resolveObjective(header.count("objective") ? get(header, "objective") : "regression", metadata);
+
+    std::vector<Section> trees;
+    Section tree;
+    while (readSection(is, tree)) {
+        if (tree.count("Tree")) {
+            trees.push_back(tree);
+        }
+    }
+    if (trees.empty()) {
+        fail("model without trees");
+    }
+    // random forests average the trees of each class
+    if (header.count("average_output")) {
+        scale *= static_cast<double>(metadata.nClasses) / trees.size();
+    }
+
+    FastForest ff{resource};
+    for (auto const& section : trees) {
+        appendTree(ff, section, featureIndices, scale);
+    }
+    ff.set_metadata(std::move(metadata));
+    // the nodes of each class are stored contiguously, like for the other loaders of multiclass models
+    if (ff.metadata().nClasses > 1 && !ff.metadata().vectorLeaves) {
+        ff.group_classes(ff.metadata().nClasses);
+    }
+
+    return ff;
+}
@@ -0,0 +1,326 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "fastforest.h"
+#include "common_details.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace fastforest;
+
+namespace {
+
+    constexpr std::size_t hugePageSize = 2 * 1024 * 1024;
+
+    // operator new with support for alignments above the one of std::max_align_t, which C++11 doesn't have: the
+    // block is allocated with enough room to align it, and the pointer returned by operator new is kept just before
+    // the aligned address. The alignment has to be a power of two.
+    void* alignedNew(std::size_t bytes, std::size_t alignment) {
+        if (alignment <= alignof(std::max_align_t)) {
+            return ::operator new(bytes);
+        }
+        void* raw = ::operator new(bytes + alignment + sizeof(void*));
+        std::uintptr_t address = reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*);
+        address = (address + alignment - 1) & ~static_cast<std::uintptr_t>(alignment - 1);
+        reinterpret_cast<void**>(address)[-1] = raw;
+        return reinterpret_cast<void*>(address);
+    }
+
+    void alignedDelete(void* p, std::size_t alignment) {
+        ::operator delete(alignment <= alignof(std::max_align_t) ? p : static_cast<void**>(p)[-1]);
+    }
+
+    class NewDeleteResource : public MemoryResource {
+      private:
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override { return alignedNew(bytes, alignment); }
+        void do_deallocate(void* p, std::size_t /*bytes*/, std::size_t alignment) override {
+            alignedDelete(p, alignment);
+        }
+    };
+
+#ifdef __linux__
+
+    // from linux/mempolicy.h, which is not always installed
+    constexpr int mpolPreferred = 1;
+    constexpr unsigned mpolMfMove = 1 << 1;
+
+    // Resource that maps fresh pages for each allocation of at least one huge page, optionally backed by huge pages,
+    // and places all allocations on a NUMA node if one is given. Smaller allocations come from operator new, so the
+    // many small arrays of a forest don't cost a huge page each. On a NUMA node, they are aligned to whole pages,
+    // whose placement is then set like for the mapped ones.
+    class MappedResource : public MemoryResource {
+      public:
+        MappedResource(int numaNode, bool hugePages) : numaNode_{numaNode}, hugePages_{hugePages} {}
+
+      private:
+        std::size_t mappedSize(std::size_t bytes) const {
+            std::size_t pageSize = hugePages_ ? hugePageSize : sysconf(_SC_PAGESIZE);
+            return (bytes + pageSize - 1) / pageSize * pageSize;
+        }
+
+        static bool usesMapping(std::size_t bytes) { return bytes >= hugePageSize; }
+
+        // alignment of the allocations from operator new, such that a NUMA policy can be set on their pages
+        std::size_t heapAlignment(std::size_t alignment) const {
+            return numaNode_ >= 0 ? std::max<std::size_t>(alignment, sysconf(_SC_PAGESIZE)) : alignment;
+        }
+
+        // Sets the policy for the pages in [p, p + size) to prefer the NUMA node. Pages that were already touched,
+        // e.g. reused heap memory, are moved there.
+        void bindToNode(void* p, std::size_t size) const {
+            constexpr int bitsPerWord = 8 * sizeof(unsigned long);
+            std::vector<unsigned long> nodeMask(numaNode_ / bitsPerWord + 1, 0);
+            nodeMask[numaNode_ / bitsPerWord] = 1UL << (numaNode_ % bitsPerWord);
+            // the kernel only looks at the first maxnode - 1 bits of the mask
+            syscall(SYS_mbind, p, size, mpolPreferred, nodeMask.data(), nodeMask.size() * bitsPerWord + 1, mpolMfMove);
+        }
+
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+            if (!usesMapping(bytes)) {
+                if (numaNode_ < 0) {
+                    return alignedNew(bytes, alignment);
+                }
+                // whole regular pages, so the policy doesn't apply to the neighboring heap blocks
+                const std::size_t pageSize = sysconf(_SC_PAGESIZE);
+                const std::size_t size = (bytes + pageSize - 1) / pageSize * pageSize;
+                void* p = alignedNew(size, heapAlignment(alignment));
+                bindToNode(p, size);
+                return p;
+            }
+            const std::size_t size = mappedSize(bytes);
+            void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+            // explicit huge pages only work if the administrator reserved some, so failure is expected here
+            if (hugePages_) {
+                p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            }
+#endif
+            if (p == MAP_FAILED) {
+                p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (p == MAP_FAILED) {
+                    throw std::bad_alloc();
+                }
+#ifdef MADV_HUGEPAGE
+                if (hugePages_) {
+                    madvise(p, size, MADV_HUGEPAGE);
+                }
+#endif
+            }
+            if (numaNode_ >= 0) {
+                // The pages are not touched yet, so setting the policy now decides where they will be placed.
+                bindToNode(p, size);
+            }
+            return p;
+        }
+
+        void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+            if (usesMapping(bytes)) {
+                munmap(p, mappedSize(bytes));
+            } else {
+                alignedDelete(p, heapAlignment(alignment));
+            }
+        }
+
+        bool do_is_equal(MemoryResource const& other) const noexcept override {
+            auto otherMapped = dynamic_cast<MappedResource const*>(&other);
+            return otherMapped && otherMapped->numaNode_ == numaNode_ && otherMapped->hugePages_ == hugePages_;
+        }
+
+        const int numaNode_;
+        const bool hugePages_;
+    };
+
+#endif
+
+}  // namespace
+
+MemoryResource* fastforest::defaultResource() {
+    static NewDeleteResource resource;
+    return &resource;
+}
+
+MemoryResource* fastforest::hugePageResource() {
+#ifdef __linux__
+    static MappedResource resource{-1, true};
+    return &resource;
+#else
+    return defaultResource();
+#endif
+}
+
+MemoryResource* fastforest::numaResource(int numaNode, bool hugePages) {
+#ifdef __linux__
+    // one resource for each combination of node and page size, created on first use
+    static const int nNodes = numaNodeCount();
+    static std::vector<MappedResource> resources = [] {
+        std::vector<MappedResource> out;
+        for (int iNode = 0; iNode < nNodes; ++iNode) {
+            out.emplace_back(iNode, false);
+            out.emplace_back(iNode, true);
+        }
+        return out;
+    }();
+    if (nNodes > 1 && numaNode >= 0 && numaNode < nNodes) {
+        return &resources[2 * numaNode + hugePages];
+    }
+#endif
+    return hugePages ? hugePageResource() : defaultResource();
+}
+
+fastforest::MonotonicResource::MonotonicResource(void* buffer, std::size_t size, MemoryResource* upstream)
+    : upstream_{upstream}, ownsBuffer_{false}, buffer_{static_cast<char*>(buffer), size} {
+    current_ = buffer_.data;
+    end_ = buffer_.data + buffer_.size;
+}
+
+fastforest::MonotonicResource::MonotonicResource(std::size_t initialSize, MemoryResource* upstream)
+    : upstream_{upstream},
+      ownsBuffer_{true},
+      buffer_{static_cast<char*>(upstream->allocate(initialSize)), initialSize} {
+    current_ = buffer_.data;
+    end_ = buffer_.data + buffer_.size;
+}
+
+fastforest::MonotonicResource::~MonotonicResource() {
+    release();
+    if (ownsBuffer_) {
+        upstream_->deallocate(buffer_.data, buffer_.size);
+    }
+}
+
+void fastforest::MonotonicResource::release() {
+    for (auto const& chunk : chunks_) {
+        upstream_->deallocate(chunk.data, chunk.size);
+    }
+    // If the buffer was too small since the last release, replace it with one that fits everything.
+    if (ownsBuffer_ && !chunks_.empty()) {
+        upstream_->deallocate(buffer_.data, buffer_.size);
+        buffer_.size = nAllocatedBytes_;
+        buffer_.data = static_cast<char*>(upstream_->allocate(buffer_.size));
+    }
+    chunks_.clear();
+    current_ = buffer_.data;
+    end_ = buffer_.data + buffer_.size;
+    nAllocatedBytes_ = 0;
+}
+
+void* fastforest::MonotonicResource::do_allocate(std::size_t bytes, std::size_t alignment) {
+    // the padding that might be needed for the alignment is included in the bookkeeping for the buffer size
+    nAllocatedBytes_ += bytes + alignment - 1;
+
+    std::size_t space = end_ - current_;
+    void* p = current_;
+    if (!std::align(alignment, bytes, p, space)) {
+        // new chunk that is at least as large as all previous memory together, so the number of chunks stays small
+        std::size_t size = std::max(bytes + alignment, nAllocatedBytes_);
+        chunks_.push_back({static_cast<char*>(upstream_->allocate(size)), size});
+        current_ = chunks_.back().data;
+        end_ = current_ + size;
+        space = size;
+        p = current_;
+        std::align(alignment, bytes, p, space);
+    }
+    current_ = static_cast<char*>(p) + bytes;
+    return p;
+}
+
+int fastforest::numaNodeCount() {
+#ifdef __linux__
+    // the file contains a range like "0-1", or just "0" on systems with a single node
+    std::ifstream file("/sys/devices/system/node/online");
+    std::string online;
+    if (file >> online) {
+        auto dash = online.find_last_of("-,");
+        return std::stoi(dash == std::string::npos ? online : online.substr(dash + 1)) + 1;
+    }
+#endif
+    return 1;
+}
+
+int fastforest::currentNumaNode() {
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned int cpu = 0;
+    unsigned int node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+        return node;
+    }
+#endif
+    return 0;
+}
+
+void fastforest::FastForest::relocate(MemoryResource* resource) {
+    rootIndices_ = Vector<int>(rootIndices_.begin(), rootIndices_.end(), resource);
+    cutIndices_ = Vector<CutIndexType>(cutIndices_.begin(), cutIndices_.end(), resource);
+    cutValues_ = Vector<FeatureType>(cutValues_.begin(), cutValues_.end(), resource);
+    leftIndices_ = Vector<int>(leftIndices_.begin(), leftIndices_.end(), resource);
+    rightIndices_ = Vector<int>(rightIndices_.begin(), rightIndices_.end(), resource);
+    responses_ = Vector<TreeResponseType>(responses_.begin(), responses_.end(), resource);
+    categorySets_ = Vector<std::uint32_t>(categorySets_.begin(), categorySets_.end(), resource);
+}
+
+fastforest::NumaForest::NumaForest(FastForest const& forest, bool hugePages) {
+    const int nNodes = numaNodeCount();
+    replicas_.resize(nNodes);
+    for (int iNode = 0; iNode < nNodes; ++iNode) {
+        replicas_[iNode].relocate(numaResource(iNode, hugePages));
+        replicas_[iNode] = forest;
+    }
+}
+
+FastForest const& fastforest::NumaForest::local() const {
+    const int node = currentNumaNode();
+    return replicas_[node < static_cast<int>(replicas_.size()) ? node : 0];
+}
+
+void fastforest::NumaForest::evaluate_batch(const FeatureType* array,
+                                            int nRows,
+                                            int nFeatures,
+                                            TreeEnsembleResponseType* out,
+                                            int nOut,
+                                            TreeEnsembleResponseType baseResponse,
+                                            int nThreads) const {
+    detail::splitRange(nRows, nThreads, [&](int begin, int end) {
+        local().evaluate_batch(array + static_cast<std::size_t>(begin) * nFeatures,
+                               end - begin,
+                               nFeatures,
+                               out + static_cast<std::size_t>(begin) * nOut,
+                               nOut,
+                               baseResponse);
+    });
+}
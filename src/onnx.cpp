@@ -0,0 +1,544 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "fastforest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace fastforest;
+
+namespace {
+
+    [[noreturn]] void fail(std::string const& what) {
+        throw std::runtime_error("Error in fastforest::load_onnx : " + what);
+    }
+
+    // Decoder for the protobuf wire format, which is just enough to walk through an ONNX model without the
+    // generated protobuf classes. See https://protobuf.dev/programming-guides/encoding.
+    class ProtoReader {
+      public:
+        enum WireType { Varint = 0, Fixed64 = 1, LengthDelimited = 2, Fixed32 = 5 };
+
+        ProtoReader(const char* begin, const char* end) : cur_{begin}, end_{end} {}
+
+        // reads the next field tag, returns false at the end of the message
+        bool next() {
+            if (cur_ == end_) {
+                return false;
+            }
+            std::uint64_t tag = varint();
+            field_ = static_cast<int>(tag >> 3);
+            wireType_ = static_cast<int>(tag & 7);
+            return true;
+        }
+
+        int field() const { return field_; }
+        int wireType() const { return wireType_; }
+
+        std::uint64_t varint() {
+            std::uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                if (cur_ == end_) {
+                    fail("truncated varint");
+                }
+                auto byte = static_cast<unsigned char>(*cur_++);
+                value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) {
+                    return value;
+                }
+            }
+            fail("malformed varint");
+        }
+
+        float fixed32() {
+            if (end_ - cur_ < 4) {
+                fail("truncated fixed32 field");
+            }
+            // the wire format is little endian, like all platforms this library runs on
+            float value;
+            std::memcpy(&value, cur_, 4);
+            cur_ += 4;
+            return value;
+        }
+
+        // the payload of a length-delimited field, which can be decoded with another reader
+        ProtoReader message() {
+            std::uint64_t length = varint();
+            if (length > static_cast<std::uint64_t>(end_ - cur_)) {
+                fail("truncated length-delimited field");
+            }
+            ProtoReader sub{cur_, cur_ + length};
+            cur_ += length;
+            return sub;
+        }
+
+        std::string string() {
+            ProtoReader sub = message();
+            return std::string(sub.cur_, sub.end_);
+        }
+
+        bool atEnd() const { return cur_ == end_; }
+
+        void skip() {
+            switch (wireType_) {
+                case Varint:
+                    varint();
+                    break;
+                case Fixed64:
+                    advance(8);
+                    break;
+                case LengthDelimited:
+                    message();
+                    break;
+                case Fixed32:
+                    advance(4);
+                    break;
+                default:
+                    fail("unsupported wire type " + std::to_string(wireType_));
+            }
+        }
+
+      private:
+        void advance(std::ptrdiff_t n) {
+            if (end_ - cur_ < n) {
+                fail("truncated field");
+            }
+            cur_ += n;
+        }
+
+        const char* cur_;
+        const char* end_;
+        int field_ = 0;
+        int wireType_ = 0;
+    };
+
+    // The values of an AttributeProto that occur in the tree ensemble operators.
+    struct Attribute {
+        float f = 0.f;
+        std::int64_t i = 0;
+        std::string s;
+        std::vector<float> floats;
+        std::vector<std::int64_t> ints;
+        std::vector<std::string> strings;
+    };
+
+    typedef std::unordered_map<std::string, Attribute> Attributes;
+
+    void readAttribute(ProtoReader reader, Attributes& attributes) {
+        std::string name;
+        Attribute attribute;
+        while (reader.next()) {
+            switch (reader.field()) {
+                case 1:
+                    name = reader.string();
+                    break;
+                case 2:
+                    attribute.f = reader.fixed32();
+                    break;
+                case 3:
+                    attribute.i = static_cast<std::int64_t>(reader.varint());
+                    break;
+                case 4:
+                    attribute.s = reader.string();
+                    break;
+                case 7:
+                    // repeated scalars can be packed or not
+                    if (reader.wireType() == ProtoReader::LengthDelimited) {
+                        for (ProtoReader packed = reader.message(); !packed.atEnd();) {
+                            attribute.floats.push_back(packed.fixed32());
+                        }
+                    } else {
+                        attribute.floats.push_back(reader.fixed32());
+                    }
+                    break;
+                case 8:
+                    if (reader.wireType() == ProtoReader::LengthDelimited) {
+                        for (ProtoReader packed = reader.message(); !packed.atEnd();) {
+                            attribute.ints.push_back(static_cast<std::int64_t>(packed.varint()));
+                        }
+                    } else {
+                        attribute.ints.push_back(static_cast<std::int64_t>(reader.varint()));
+                    }
+                    break;
+                case 9:
+                    attribute.strings.push_back(reader.string());
+                    break;
+                default:
+                    reader.skip();
+            }
+        }
+        attributes[name] = std::move(attribute);
+    }
+
+    // Finds the tree ensemble node in the graph of the model and returns its operator type and attributes.
+    std::string findTreeEnsemble(ProtoReader model, Attributes& attributes) {
+        std::string opType;
+        while (model.next()) {
+            if (model.field() != 7) {  // ModelProto.graph
+                model.skip();
+                continue;
+            }
+            for (ProtoReader graph = model.message(); graph.next();) {
+                if (graph.field() != 1) {  // GraphProto.node
+                    graph.skip();
+                    continue;
+                }
+                std::string nodeOpType;
+                Attributes nodeAttributes;
+                for (ProtoReader node = graph.message(); node.next();) {
+                    if (node.field() == 4) {  // NodeProto.op_type
+                        nodeOpType = node.string();
+                    } else if (node.field() == 5) {  // NodeProto.attribute
+                        readAttribute(node.message(), nodeAttributes);
+                    } else {
+                        node.skip();
+                    }
+                }
+                if (nodeOpType == "TreeEnsembleRegressor" || nodeOpType == "TreeEnsembleClassifier") {
+                    if (!opType.empty()) {
+                        fail("models with more than one tree ensemble are not supported");
+                    }
+                    opType = nodeOpType;
+                    attributes = std::move(nodeAttributes);
+                }
+            }
+        }
+        if (opType.empty()) {
+            fail("no TreeEnsembleRegressor or TreeEnsembleClassifier in the model");
+        }
+        return opType;
+    }
+
+    template <class T>
+    std::vector<T> const& get(Attributes const& attributes, std::string const& name, std::vector<T> Attribute::*field) {
+        auto found = attributes.find(name);
+        if (found == attributes.end()) {
+            fail("missing attribute " + name);
+        }
+        return found->second.*field;
+    }
+
+    // The nodes of one tree, in the order of the node attributes.
+    struct Tree {
+        std::vector<int> nodes;
+        // for each column of the output, the leaf weights by node id
+        std::map<int, std::unordered_map<std::int64_t, double>> weights;
+    };
+
+    struct Ensemble {
+        std::vector<std::int64_t> const& nodeIds;
+        std::vector<std::int64_t> const& featureIds;
+        std::vector<float> const& values;
+        std::vector<std::string> const& modes;
+        std::vector<std::int64_t> const& trueIds;
+        std::vector<std::int64_t> const& falseIds;
+    };
+
+    // Appends a copy of the tree with the leaf weights of the given output column. The nodes are added in
+    // depth-first order, so the root comes first and no node other than the root of the first tree has index zero.
+    void appendTree(FastForest& ff, Ensemble const& ensemble, Tree const& tree, int column, double scale) {
+        std::unordered_map<std::int64_t, int> positions;
+        std::unordered_map<std::int64_t, int> nParents;
+        for (int pos : tree.nodes) {
+            positions[ensemble.nodeIds[pos]] = pos;
+        }
+        for (int pos : tree.nodes) {
+            if (ensemble.modes[pos] != "LEAF") {
+                ++nParents[ensemble.trueIds[pos]];
+                ++nParents[ensemble.falseIds[pos]];
+            }
+        }
+        int root = -1;
+        for (int pos : tree.nodes) {
+            if (!nParents.count(ensemble.nodeIds[pos])) {
+                if (root >= 0) {
+                    fail("tree with more than one root");
+                }
+                root = pos;
+            }
+        }
+        if (root < 0) {
+            fail("tree without root");
+        }
+
+        auto const& weights = tree.weights.at(column);
+        auto leafValue = [&](std::int64_t nodeId) {
+            auto found = weights.find(nodeId);
+            return found == weights.end() ? 0. : scale * found->second;
+        };
+
+        // A node position together with the entry in the left or right indices that has to be set to its index,
+        // which is null for the root.
+        struct StackEntry {
+            int pos;
+            Vector<int>* indices;
+            int slot;
+        };
+        std::vector<StackEntry> stack{{root, nullptr, 0}};
+        std::size_t nVisited = 0;
+        while (!stack.empty()) {
+            const StackEntry entry = stack.back();
+            const int pos = entry.pos;
+            stack.pop_back();
+            // every node is visited once in a tree, more visits mean that the children form a cycle
+            if (++nVisited > tree.nodes.size()) {
+                fail("malformed tree structure");
+            }
+
+            std::string const& mode = ensemble.modes[pos];
+            int index;
+            if (mode == "LEAF") {
+                index = -static_cast<int>(ff.responses_.size());
+                ff.responses_.push_back(leafValue(ensemble.nodeIds[pos]));
+            } else {
+                // FastForest goes left if x <= cut. The ONNX conditions are mapped to that by moving the cut to the
+                // next smaller float for the strict comparisons, and by swapping the branches for the x > cut ones.
+                const float down = std::nextafter(ensemble.values[pos], -std::numeric_limits<float>::infinity());
+                bool trueIsLeft;
+                float cut;
+                if (mode == "BRANCH_LEQ") {
+                    trueIsLeft = true;
+                    cut = ensemble.values[pos];
+                } else if (mode == "BRANCH_LT") {
+                    trueIsLeft = true;
+                    cut = down;
+                } else if (mode == "BRANCH_GT") {
+                    trueIsLeft = false;
+                    cut = ensemble.values[pos];
+                } else if (mode == "BRANCH_GTE") {
+                    trueIsLeft = false;
+                    cut = down;
+                } else {
+                    fail("unsupported node mode " + mode);
+                }
+                auto trueNode = positions.find(ensemble.trueIds[pos]);
+                auto falseNode = positions.find(ensemble.falseIds[pos]);
+                if (trueNode == positions.end() || falseNode == positions.end()) {
+                    fail("child node not found");
+                }
+                if (ensemble.featureIds[pos] < 0) {
+                    fail("negative feature id");
+                }
+                index = ff.cutValues_.size();
+                ff.cutIndices_.push_back(ensemble.featureIds[pos]);
+                ff.cutValues_.push_back(cut);
+                ff.leftIndices_.push_back(0);
+                ff.rightIndices_.push_back(0);
+                stack.push_back({trueIsLeft ? falseNode->second : trueNode->second, &ff.rightIndices_, index});
+                stack.push_back({trueIsLeft ? trueNode->second : falseNode->second, &ff.leftIndices_, index});
+            }
+            if (entry.indices) {
+                (*entry.indices)[entry.slot] = index;
+            } else {
+                // a leaf as root means a single-leaf tree (see FastForest::evaluate)
+                ff.rootIndices_.push_back(mode == "LEAF" ? index - 1 : index);
+            }
+        }
+    }
+
+    void appendConstantTree(FastForest& ff, double value) {
+        ff.rootIndices_.push_back(-static_cast<int>(ff.responses_.size()) - 1);
+        ff.responses_.push_back(value);
+    }
+
+}  // namespace
+
+FastForest fastforest::load_onnx(std::string const& path, MemoryResource* resource) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        fail("can't open " + path);
+    }
+    return load_onnx(file, resource);
+}
+
+FastForest fastforest::load_onnx(std::istream& is, MemoryResource* resource) {
+    const std::string content{std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()};
+    Attributes attributes;
+    const std::string opType = findTreeEnsemble(ProtoReader{content.data(), content.data() + content.size()},
+                                                attributes);
+    const bool isClassifier = opType == "TreeEnsembleClassifier";
+    const std::string prefix = isClassifier ? "class_" : "target_";
+
+    if (attributes.count("nodes_values_as_tensor")) {
+        fail("double precision tree ensembles are not supported");
+    }
+    Ensemble ensemble{get(attributes, "nodes_nodeids", &Attribute::ints),
+                      get(attributes, "nodes_featureids", &Attribute::ints),
+                      get(attributes, "nodes_values", &Attribute::floats),
+                      get(attributes, "nodes_modes", &Attribute::strings),
+                      get(attributes, "nodes_truenodeids", &Attribute::ints),
+                      get(attributes, "nodes_falsenodeids", &Attribute::ints)};
+    auto const& treeIds = get(attributes, "nodes_treeids", &Attribute::ints);
+    const std::size_t nNodes = treeIds.size();
+    for (std::size_t size : {ensemble.nodeIds.size(),
+                             ensemble.featureIds.size(),
+                             ensemble.values.size(),
+                             ensemble.modes.size(),
+                             ensemble.trueIds.size(),
+                             ensemble.falseIds.size()}) {
+        if (size != nNodes) {
+            fail("inconsistent number of nodes");
+        }
+    }
+
+    // group the nodes by tree, with the trees in the order of their first node
+    std::vector<Tree> trees;
+    std::unordered_map<std::int64_t, int> treeIndices;
+    for (std::size_t pos = 0; pos < nNodes; ++pos) {
+        auto inserted = treeIndices.emplace(treeIds[pos], trees.size());
+        if (inserted.second) {
+            trees.emplace_back();
+        }
+        trees[inserted.first->second].nodes.push_back(pos);
+    }
+
+    auto const& weightTreeIds = get(attributes, prefix + "treeids", &Attribute::ints);
+    auto const& weightNodeIds = get(attributes, prefix + "nodeids", &Attribute::ints);
+    auto const& weightColumns = get(attributes, prefix + "ids", &Attribute::ints);
+    auto const& weights = get(attributes, prefix + "weights", &Attribute::floats);
+    if (weightNodeIds.size() != weightTreeIds.size() || weightColumns.size() != weightTreeIds.size() ||
+        weights.size() != weightTreeIds.size()) {
+        fail("inconsistent number of leaf weights");
+    }
+
+    // The number of output columns. Like the ONNX runtime, classifiers with two classes but weights for only one of
+    // them are treated as binary classifiers with a single score.
+    int nColumns;
+    std::map<std::int64_t, int> usedColumns;
+    for (auto column : weightColumns) {
+        usedColumns.emplace(column, 0);
+    }
+    if (isClassifier) {
+        auto labels = attributes.find("classlabels_int64s");
+        if (labels == attributes.end()) {
+            labels = attributes.find("classlabels_strings");
+        }
+        if (labels == attributes.end()) {
+            fail("missing class labels");
+        }
+        nColumns = std::max(labels->second.ints.size(), labels->second.strings.size());
+        if (nColumns == 2 && usedColumns.size() == 1) {
+            nColumns = 1;
+        }
+    } else {
+        nColumns = attributes.count("n_targets") ? attributes.at("n_targets").i : 1;
+    }
+    for (std::size_t i = 0; i < weights.size(); ++i) {
+        auto tree = treeIndices.find(weightTreeIds[i]);
+        if (tree == treeIndices.end()) {
+            fail("leaf weight for unknown tree");
+        }
+        const int column = nColumns == 1 ? 0 : weightColumns[i];
+        if (column < 0 || column >= nColumns) {
+            fail("leaf weight for unknown output " + std::to_string(weightColumns[i]));
+        }
+        trees[tree->second].weights[column][weightNodeIds[i]] += weights[i];
+    }
+
+    double scale = 1.;
+    auto aggregate = attributes.find("aggregate_function");
+    if (aggregate != attributes.end() && aggregate->second.s != "SUM") {
+        if (aggregate->second.s != "AVERAGE") {
+            fail("unsupported aggregate function " + aggregate->second.s);
+        }
+        scale = 1. / trees.size();
+    }
+
+    Metadata metadata;
+    metadata.nClasses = nColumns;
+    metadata.baseResponse = 0.;
+    auto postTransform = attributes.find("post_transform");
+    if (postTransform != attributes.end() && postTransform->second.s != "NONE") {
+        if (postTransform->second.s == "LOGISTIC") {
+            metadata.objective = "binary:logistic";
+        } else if (postTransform->second.s == "SOFTMAX") {
+            metadata.objective = "multi:softprob";
+        } else {
+            fail("unsupported post transform " + postTransform->second.s);
+        }
+    }
+
+    // FastForest expects the trees of multiclass models interleaved by class. Every tree gets one copy for each
+    // output it has weights for, and classes with fewer trees are padded with empty trees.
+    std::vector<std::vector<int>> treesByColumn(nColumns);
+    for (std::size_t iTree = 0; iTree < trees.size(); ++iTree) {
+        for (auto const& columnWeights : trees[iTree].weights) {
+            treesByColumn[columnWeights.first].push_back(iTree);
+        }
+    }
+    std::size_t nRounds = 0;
+    for (auto const& columnTrees : treesByColumn) {
+        nRounds = std::max(nRounds, columnTrees.size());
+    }
+
+    FastForest ff{resource};
+    for (std::size_t iRound = 0; iRound < nRounds; ++iRound) {
+        for (int column = 0; column < nColumns; ++column) {
+            if (iRound < treesByColumn[column].size()) {
+                appendTree(ff, ensemble, trees[treesByColumn[column][iRound]], column, scale);
+            } else {
+                appendConstantTree(ff, 0.);
+            }
+        }
+    }
+
+    // The base values are added after the aggregation. A common value becomes the base response, otherwise there is
+    // one more round of constant trees.
+    auto baseValues = attributes.find("base_values");
+    if (baseValues != attributes.end() && !baseValues->second.floats.empty()) {
+        auto const& values = baseValues->second.floats;
+        if (static_cast<int>(values.size()) != nColumns) {
+            fail("unexpected number of base values");
+        }
+        if (std::equal(values.begin() + 1, values.end(), values.begin())) {
+            metadata.baseResponse = values[0];
+        } else {
+            for (float value : values) {
+                appendConstantTree(ff, value);
+            }
+        }
+    }
+
+    // the features are the columns of the input tensor, so there are no feature names
+    ff.set_metadata(std::move(metadata));
+    // the nodes of each class are stored contiguously, like for the other loaders of multiclass models
+    if (ff.metadata().nClasses > 1 && !ff.metadata().vectorLeaves) {
+        ff.group_classes(ff.metadata().nClasses);
+    }
+
+    return ff;
+}
@@ -0,0 +1,139 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "common_details.h"
+#include "fastforest.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <stdexcept>
+
+using namespace fastforest;
+
+namespace {
+
+    // Fills the static part of the profile (tree depths and node-to-tree mapping) and zeroes the counters.
+    void initializeProfile(FastForest const& ff, ForestProfile& profile) {
+        const int nTrees = ff.rootIndices_.size();
+
+        profile.nRows = 0;
+        profile.treeDepths.assign(nTrees, 0);
+        profile.treePathLengths.assign(nTrees, 0);
+        profile.nodeTrees.assign(ff.cutValues_.size(), -1);
+        profile.nodeVisits.assign(ff.cutValues_.size(), 0);
+        profile.nodeRightTaken.assign(ff.cutValues_.size(), 0);
+        profile.leafVisits.assign(ff.responses_.size(), 0);
+
+        // stack of (node index, depth) pairs for the depth-first walk through each tree
+        std::vector<std::pair<int, int>> stack;
+        for (int iTree = 0; iTree < nTrees; ++iTree) {
+            if (ff.rootIndices_[iTree] < 0) {
+                continue;
+            }
+            stack.emplace_back(ff.rootIndices_[iTree], 1);
+            while (!stack.empty()) {
+                auto node = stack.back();
+                stack.pop_back();
+                profile.nodeTrees[node.first] = iTree;
+                profile.treeDepths[iTree] = std::max(profile.treeDepths[iTree], node.second);
+                for (int child : {ff.leftIndices_[node.first], ff.rightIndices_[node.first]}) {
+                    if (child > 0) {
+                        stack.emplace_back(child, node.second + 1);
+                    }
+                }
+            }
+        }
+    }
+
+}  // namespace
+
+void fastforest::FastForest::profile(const FeatureType* array,
+                                     TreeEnsembleResponseType* out,
+                                     int nOut,
+                                     ForestProfile& profile,
+                                     TreeEnsembleResponseType baseResponse) const {
+    if (metadata_.vectorLeaves) {
+        throw std::runtime_error("Error in FastForest::profile : forests with vector leaves are not supported");
+    }
+    if (rootIndices_.size() % nOut != 0) {
+        throw std::runtime_error(std::string{"Error in FastForest::profile : Forest has "} +
+                                 std::to_string(rootIndices_.size()) + " trees, " + "which is not compatible with " +
+                                 std::to_string(nOut) + " classes!");
+    }
+    if (profile.nodeVisits.size() != cutValues_.size() || profile.leafVisits.size() != responses_.size()) {
+        initializeProfile(*this, profile);
+    }
+
+    for (int i = 0; i < nOut; ++i) {
+        out[i] = baseResponse;
+    }
+
+    for (std::size_t iRootIndex = 0; iRootIndex < rootIndices_.size(); ++iRootIndex) {
+        int index = rootIndices_[iRootIndex];
+        if (index < 0) {
+            // single-leaf tree, see FastForest::evaluate
+            index++;
+        } else {
+            do {
+                ++profile.nodeVisits[index];
+                ++profile.treePathLengths[iRootIndex];
+                bool goRight = detail::goesRight(*this, array, index);
+                profile.nodeRightTaken[index] += goRight;
+                index = goRight ? rightIndices_[index] : leftIndices_[index];
+            } while (index > 0);
+        }
+        ++profile.leafVisits[-index];
+        out[iRootIndex % nOut] += responses_[-index];
+    }
+
+    ++profile.nRows;
+}
+
+void fastforest::ForestProfile::write_txt(std::string const& filename) const {
+    std::ofstream os(filename);
+    if (!os) {
+        throw std::runtime_error("Error in ForestProfile::write_txt : can't open " + filename + " for writing");
+    }
+
+    os << "# rows " << nRows << "\n";
+
+    os << "# tree depth avg_path_length\n";
+    for (std::size_t iTree = 0; iTree < treeDepths.size(); ++iTree) {
+        os << iTree << " " << treeDepths[iTree] << " " << averagePathLength(iTree) << "\n";
+    }
+
+    os << "# node tree visits right_taken_ratio\n";
+    for (std::size_t iNode = 0; iNode < nodeVisits.size(); ++iNode) {
+        double ratio = nodeVisits[iNode] == 0 ? 0. : static_cast<double>(nodeRightTaken[iNode]) / nodeVisits[iNode];
+        os << iNode << " " << nodeTrees[iNode] << " " << nodeVisits[iNode] << " " << ratio << "\n";
+    }
+
+    os << "# leaf visits\n";
+    for (std::size_t iLeaf = 0; iLeaf < leafVisits.size(); ++iLeaf) {
+        os << iLeaf << " " << leafVisits[iLeaf] << "\n";
+    }
+}
@@ -0,0 +1,708 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "common_details.h"
+#include "compression.h"
+#include "fastforest.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+using namespace fastforest;
+
+namespace {
+
+    // The first bytes of the versioned binary format. Read as an int, they give a negative number, so they can't be
+    // confused with the number of trees at the beginning of the unversioned format.
+    constexpr char magic[4] = {'F', 'F', 'B', '\xff'};
+    constexpr std::uint32_t formatVersion = 2;
+
+    // Flag in the header for the compressed variant of the format, where each array is stored as a section with its
+    // size in bytes followed by the encoded data.
+    constexpr std::uint32_t compressedFlag = 1;
+    // Flag for forests with categorical splits, where the category sets follow the other arrays as their number of
+    // words and the words, or as a section of raw words in the compressed variant.
+    constexpr std::uint32_t categoricalFlag = 2;
+    // Flag for forests with vector leaves (see Metadata::vectorLeaves), where the responses hold nClasses values per
+    // leaf.
+    constexpr std::uint32_t vectorLeafFlag = 4;
+    // limit for the size of the category sets in a file, against huge allocations for corrupted files
+    constexpr std::uint64_t maxCategoryWords = std::uint64_t(1) << 24;
+    // limits for the length of the strings and the number of feature names in the header, for the same reason
+    constexpr std::uint32_t maxStringSize = std::uint32_t(1) << 16;
+    constexpr std::uint32_t maxFeatures = std::uint32_t(1) << 24;
+    // Number of bytes that arrays are read in at a time from inputs of unknown size, so that a corrupted size
+    // can't allocate much more memory than the input actually holds.
+    constexpr std::uint64_t readChunkSize = std::uint64_t(1) << 24;
+    // The LZ codec turns one input byte into at most this many output bytes: a match of up to 255 bytes per length
+    // byte, or a token with its offset for a match of up to 19 bytes.
+    constexpr std::uint64_t maxExpansion = 255;
+
+    const char* const errorPrefix = "Error in fastforest::load_bin : ";
+
+    // sizes of the types in the binary format, which have to match the ones the library was compiled with
+    constexpr std::uint8_t typeSizes[8] = {sizeof(int),
+                                           sizeof(CutIndexType),
+                                           sizeof(FeatureType),
+                                           sizeof(TreeResponseType),
+                                           sizeof(TreeEnsembleResponseType),
+                                           0,
+                                           0,
+                                           0};
+
+    // Checksum over a byte stream that is fed in pieces of arbitrary size: a 64 bit FNV-1a variant that consumes
+    // eight bytes at once, which is fast enough to not slow down the reading of large forests.
+    class Checksum {
+      public:
+        void update(const char* data, std::size_t n) {
+            while (n > 0 && nPending_ > 0) {
+                pending_[nPending_++] = *data++;
+                --n;
+                if (nPending_ == 8) {
+                    consume(pending_);
+                    nPending_ = 0;
+                }
+            }
+            for (; n >= 8; n -= 8, data += 8) {
+                consume(data);
+            }
+            while (n > 0) {
+                pending_[nPending_++] = *data++;
+                --n;
+            }
+        }
+
+        std::uint64_t value() const {
+            std::uint64_t hash = hash_;
+            for (std::size_t i = 0; i < nPending_; ++i) {
+                hash = (hash ^ static_cast<unsigned char>(pending_[i])) * prime;
+            }
+            return hash;
+        }
+
+      private:
+        static constexpr std::uint64_t prime = 0x100000001b3ULL;
+
+        void consume(const char* data) {
+            std::uint64_t word;
+            std::memcpy(&word, data, 8);
+            hash_ = (hash_ ^ word) * prime;
+        }
+
+        std::uint64_t hash_ = 0xcbf29ce484222325ULL;
+        char pending_[8];
+        std::size_t nPending_ = 0;
+    };
+
+    class Writer {
+      public:
+        explicit Writer(std::ostream& os) : os_{os} {}
+
+        void write(const void* data, std::size_t n) {
+            os_.write(static_cast<const char*>(data), n);
+            checksum_.update(static_cast<const char*>(data), n);
+        }
+        template <class T>
+        void write(T const& value) {
+            write(&value, sizeof(T));
+        }
+        void write(std::string const& str) {
+            write(static_cast<std::uint32_t>(str.size()));
+            write(str.data(), str.size());
+        }
+        template <class T>
+        void write(Vector<T> const& vec) {
+            write(vec.data(), vec.size() * sizeof(T));
+        }
+
+        void writeSection(std::string const& section) {
+            write(static_cast<std::uint64_t>(section.size()));
+            write(section.data(), section.size());
+        }
+
+        void writeChecksum() {
+            std::uint64_t value = checksum_.value();
+            os_.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+
+      private:
+        std::ostream& os_;
+        Checksum checksum_;
+    };
+
+    class Reader {
+      public:
+        // For seekable inputs, the number of remaining bytes bounds the sizes of the arrays. Other inputs are read
+        // in chunks of bounded size instead.
+        explicit Reader(std::istream& is) : is_{is} {
+            const auto begin = is_.tellg();
+            if (begin == std::streampos(-1)) {
+                return;
+            }
+            is_.seekg(0, std::ios::end);
+            const auto end = is_.tellg();
+            if (end != std::streampos(-1) && end >= begin) {
+                remaining_ = static_cast<std::uint64_t>(end - begin);
+                sizeKnown_ = true;
+            }
+            is_.clear();
+            is_.seekg(begin);
+        }
+
+        void read(void* data, std::size_t n) {
+            is_.read(static_cast<char*>(data), n);
+            if (!is_) {
+                fail("unexpected end of input");
+            }
+            checksum_.update(static_cast<const char*>(data), n);
+            remaining_ -= n;
+        }
+        template <class T>
+        T read() {
+            T value;
+            read(&value, sizeof(T));
+            return value;
+        }
+        std::string readString() {
+            auto size = read<std::uint32_t>();
+            if (size > maxStringSize) {
+                fail("string length " + std::to_string(size) + " is out of range");
+            }
+            std::string str(size, '\0');
+            read(&str[0], str.size());
+            return str;
+        }
+        template <class T>
+        void read(Vector<T>& vec, int n) {
+            if (n < 0) {
+                fail("negative array size");
+            }
+            readElements(vec, n, "array size");
+        }
+
+        // Reads a section of the compressed format. Its size is bounded by the given maximum, so that a corrupted
+        // size can't cause a huge allocation.
+        std::string readSection(std::uint64_t maxSize) {
+            auto size = read<std::uint64_t>();
+            if (size > maxSize) {
+                fail("section size " + std::to_string(size) + " is out of range");
+            }
+            std::string section;
+            readElements(section, size, "section size");
+            return section;
+        }
+
+        void readChecksum() {
+            std::uint64_t expected = checksum_.value();
+            std::uint64_t value;
+            is_.read(reinterpret_cast<char*>(&value), sizeof(value));
+            if (!is_ || value != expected) {
+                fail("checksum mismatch, the file is corrupted");
+            }
+        }
+
+        [[noreturn]] static void fail(std::string const& what) {
+            throw std::runtime_error(errorPrefix + what);
+        }
+
+      private:
+        // Resizes the container to n elements and reads them, failing before the allocation if the input is known
+        // to be shorter, and growing the container chunk by chunk otherwise.
+        template <class Container>
+        void readElements(Container& container, std::uint64_t n, const char* what) {
+            using T = typename Container::value_type;
+            if (n > remaining_ / sizeof(T)) {
+                fail(what + (" " + std::to_string(n)) + " is out of range");
+            }
+            const std::uint64_t chunk = sizeKnown_ ? n : readChunkSize / sizeof(T);
+            container.clear();
+            for (std::uint64_t done = 0; done < n;) {
+                const std::uint64_t step = std::min(n - done, chunk);
+                container.resize(done + step);
+                read(&container[done], step * sizeof(T));
+                done += step;
+            }
+        }
+
+        std::istream& is_;
+        Checksum checksum_;
+        std::uint64_t remaining_ = std::numeric_limits<std::uint64_t>::max();
+        bool sizeKnown_ = false;
+    };
+
+    // Checks that all indices point inside the arrays, such that corrupted files can't cause out-of-bounds reads.
+    void validateIndices(FastForest const& ff) {
+        const int nNodes = ff.cutValues_.size();
+        const int nLeaves = ff.responses_.size() / detail::leafSize(ff);
+        for (int index : ff.rootIndices_) {
+            if (index >= nNodes || -(index + 1) >= nLeaves) {
+                Reader::fail("root index " + std::to_string(index) + " is out of range");
+            }
+        }
+        for (auto const* children : {&ff.leftIndices_, &ff.rightIndices_}) {
+            for (int index : *children) {
+                if (index >= nNodes || -index >= nLeaves) {
+                    Reader::fail("child index " + std::to_string(index) + " is out of range");
+                }
+            }
+        }
+        const std::size_t nFeatures = ff.metadata().features.size();
+        if (nFeatures > 0) {
+            for (auto cutIndex : ff.cutIndices_) {
+                if (cutIndex >= nFeatures) {
+                    Reader::fail("feature index " + std::to_string(cutIndex) + " is out of range");
+                }
+            }
+        }
+    }
+
+    // Reads the arrays in the order they are stored in both versions of the format.
+    void readArrays(Reader& reader, FastForest& ff, int nRootNodes, int nNodes, int nLeaves) {
+        reader.read(ff.rootIndices_, nRootNodes);
+        reader.read(ff.cutIndices_, nNodes);
+        reader.read(ff.cutValues_, nNodes);
+        reader.read(ff.leftIndices_, nNodes);
+        reader.read(ff.rightIndices_, nNodes);
+        reader.read(ff.responses_, nLeaves);
+    }
+
+    // Encoders and decoders for the arrays in the compressed format:
+    //  * root indices and cut indices as varints, the root indices as zigzag deltas to the previous root
+    //  * cut values as indices into a dictionary of the distinct cut values of each feature, bit-packed with as many
+    //    bits as the dictionary of the feature needs, or as raw values if the dictionaries don't save space
+    //  * children of each node, left and right interleaved, as zigzag deltas to the parent node or to the previous
+    //    leaf, with the lowest bit telling leaves from nodes. For nodes in depth-first order, most deltas are small.
+    //  * responses byte-shuffled and compressed with the LZ codec
+    // In each case, the decoded array has the known size from the header, and the section has to be used up.
+
+    std::string encodeRoots(Vector<int> const& roots) {
+        std::string out;
+        std::int64_t previous = 0;
+        for (int root : roots) {
+            detail::putVarint(out, detail::zigzag(root - previous));
+            previous = root;
+        }
+        return out;
+    }
+
+    void decodeRoots(std::string const& section, Vector<int>& roots) {
+        detail::ByteReader reader{section.data(), section.data() + section.size(), errorPrefix};
+        std::int64_t previous = 0;
+        reader.varints(roots.size(), [&](std::size_t i, std::uint64_t value) {
+            previous += detail::unzigzag(value);
+            roots[i] = static_cast<int>(previous);
+        });
+        if (!reader.atEnd()) {
+            reader.fail("trailing data after the root indices");
+        }
+    }
+
+    std::string encodeCutIndices(Vector<CutIndexType> const& cutIndices) {
+        std::string out;
+        for (auto cutIndex : cutIndices) {
+            detail::putVarint(out, cutIndex);
+        }
+        return out;
+    }
+
+    void decodeCutIndices(std::string const& section, Vector<CutIndexType>& cutIndices) {
+        detail::ByteReader reader{section.data(), section.data() + section.size(), errorPrefix};
+        reader.varints(cutIndices.size(),
+                       [&](std::size_t i, std::uint64_t value) { cutIndices[i] = static_cast<CutIndexType>(value); });
+        if (!reader.atEnd()) {
+            reader.fail("trailing data after the cut indices");
+        }
+    }
+
+    // Number of bits for the indices into a dictionary of the given size.
+    int indexBits(std::uint64_t dictionarySize) {
+        int bits = 0;
+        while (dictionarySize > (std::uint64_t(1) << bits)) {
+            ++bits;
+        }
+        return bits;
+    }
+
+    std::string encodeCutValues(Vector<CutIndexType> const& cutIndices, Vector<FeatureType> const& cutValues) {
+        const std::size_t nFeatures =
+            cutIndices.empty() ? 0 : *std::max_element(cutIndices.begin(), cutIndices.end()) + 1;
+
+        // the distinct cut values of each feature, compared bitwise so that the encoding is lossless
+        std::vector<std::vector<std::uint32_t>> dictionaries(nFeatures);
+        for (std::size_t i = 0; i < cutValues.size(); ++i) {
+            std::uint32_t bits;
+            std::memcpy(&bits, &cutValues[i], sizeof(bits));
+            dictionaries[cutIndices[i]].push_back(bits);
+        }
+        std::string out;
+        std::vector<int> widths(nFeatures);
+        std::uint64_t nBits = 0;
+        std::string header;
+        detail::putVarint(header, nFeatures);
+        std::vector<std::unordered_map<std::uint32_t, std::uint32_t>> positions(nFeatures);
+        for (std::size_t iFeature = 0; iFeature < nFeatures; ++iFeature) {
+            auto& dictionary = dictionaries[iFeature];
+            const std::uint64_t nCuts = dictionary.size();
+            std::sort(dictionary.begin(), dictionary.end());
+            dictionary.erase(std::unique(dictionary.begin(), dictionary.end()), dictionary.end());
+            widths[iFeature] = indexBits(dictionary.size());
+            nBits += nCuts * widths[iFeature];
+            detail::putVarint(header, dictionary.size());
+            header.append(reinterpret_cast<const char*>(dictionary.data()), dictionary.size() * sizeof(std::uint32_t));
+            for (std::size_t i = 0; i < dictionary.size(); ++i) {
+                positions[iFeature][dictionary[i]] = i;
+            }
+        }
+        // Without enough repeated cut values, the dictionaries don't pay off, and the values are stored as they are
+        // after a dictionary count of zero.
+        if (header.size() + (nBits + 7) / 8 >= cutValues.size() * sizeof(FeatureType)) {
+            detail::putVarint(out, 0);
+            out.append(reinterpret_cast<const char*>(cutValues.data()), cutValues.size() * sizeof(FeatureType));
+            return out;
+        }
+        out = std::move(header);
+        // the indices with the bit width of their dictionary, packed from the lowest bit of each byte on
+        std::uint64_t buffer = 0;
+        int nBuffered = 0;
+        for (std::size_t i = 0; i < cutValues.size(); ++i) {
+            std::uint32_t bits;
+            std::memcpy(&bits, &cutValues[i], sizeof(bits));
+            buffer |= static_cast<std::uint64_t>(positions[cutIndices[i]][bits]) << nBuffered;
+            nBuffered += widths[cutIndices[i]];
+            for (; nBuffered >= 8; nBuffered -= 8, buffer >>= 8) {
+                out.push_back(static_cast<char>(buffer & 0xff));
+            }
+        }
+        if (nBuffered > 0) {
+            out.push_back(static_cast<char>(buffer & 0xff));
+        }
+        return out;
+    }
+
+    void decodeCutValues(std::string const& section,
+                         Vector<CutIndexType> const& cutIndices,
+                         Vector<FeatureType>& cutValues) {
+        detail::ByteReader reader{section.data(), section.data() + section.size(), errorPrefix};
+        const std::uint64_t nFeatures = reader.varint();
+        if (nFeatures == 0) {
+            const char* data = reader.take(cutValues.size() * sizeof(FeatureType));
+            std::memcpy(cutValues.data(), data, cutValues.size() * sizeof(FeatureType));
+            if (!reader.atEnd()) {
+                reader.fail("trailing data after the cut values");
+            }
+            return;
+        }
+        if (nFeatures > section.size()) {
+            reader.fail("number of dictionaries out of range");
+        }
+        // the dictionaries are copied into one array, with the offset, size and index width of each one
+        struct Dictionary {
+            std::size_t offset;
+            std::uint64_t size;
+            int width;
+        };
+        std::vector<FeatureType> values;
+        std::vector<Dictionary> dictionaries(nFeatures);
+        for (auto& dictionary : dictionaries) {
+            dictionary.offset = values.size();
+            dictionary.size = reader.varint();
+            if (dictionary.size > section.size()) {
+                reader.fail("dictionary size out of range");
+            }
+            dictionary.width = indexBits(dictionary.size);
+            const char* data = reader.take(dictionary.size * sizeof(FeatureType));
+            values.resize(values.size() + dictionary.size);
+            std::memcpy(values.data() + dictionary.offset, data, dictionary.size * sizeof(FeatureType));
+        }
+
+        const CutIndexType* cutIndexData = cutIndices.data();
+        const std::size_t nNodes = cutValues.size();
+        std::uint64_t nBits = 0;
+        for (std::size_t i = 0; i < nNodes; ++i) {
+            if (cutIndexData[i] >= nFeatures) {
+                reader.fail("cut value index out of range");
+            }
+            nBits += dictionaries[cutIndexData[i]].width;
+        }
+        // The packed indices are copied with eight bytes of padding, so that every index can be extracted from
+        // one 64-bit word, without branches on the index widths. No width is larger than 32 bits.
+        const std::size_t nBytes = (nBits + 7) / 8;
+        std::vector<unsigned char> packed(nBytes + 8, 0);
+        std::memcpy(packed.data(), reader.take(nBytes), nBytes);
+        if (!reader.atEnd()) {
+            reader.fail("trailing data after the cut values");
+        }
+
+        const unsigned char* packedData = packed.data();
+        const Dictionary* dictionaryData = dictionaries.data();
+        const FeatureType* valueData = values.data();
+        FeatureType* out = cutValues.data();
+        std::uint64_t position = 0;
+        for (std::size_t i = 0; i < nNodes; ++i) {
+            Dictionary const& dictionary = dictionaryData[cutIndexData[i]];
+            const unsigned char* word = packedData + position / 8;
+            std::uint64_t bits = 0;
+            for (int iByte = 0; iByte < 8; ++iByte) {
+                bits |= static_cast<std::uint64_t>(word[iByte]) << (8 * iByte);
+            }
+            const std::uint64_t index = (bits >> (position % 8)) & ((std::uint64_t(1) << dictionary.width) - 1);
+            position += dictionary.width;
+            if (index >= dictionary.size) {
+                reader.fail("cut value index out of range");
+            }
+            out[i] = valueData[dictionary.offset + index];
+        }
+    }
+
+    std::string encodeChildren(Vector<int> const& left, Vector<int> const& right) {
+        std::string out;
+        std::int64_t previousLeaf = 0;
+        auto encode = [&](std::int64_t node, int child) {
+            if (child > 0) {
+                detail::putVarint(out, detail::zigzag(child - node) << 1);
+            } else {
+                detail::putVarint(out, detail::zigzag(-child - previousLeaf) << 1 | 1);
+                previousLeaf = -child;
+            }
+        };
+        for (std::size_t i = 0; i < left.size(); ++i) {
+            encode(i, left[i]);
+            encode(i, right[i]);
+        }
+        return out;
+    }
+
+    void decodeChildren(std::string const& section, Vector<int>& left, Vector<int>& right) {
+        detail::ByteReader reader{section.data(), section.data() + section.size(), errorPrefix};
+        std::int64_t previousLeaf = 0;
+        // the left and right children are interleaved, and the decoding avoids branches on the node type, which
+        // are hard to predict
+        reader.varints(2 * left.size(), [&](std::size_t i, std::uint64_t value) {
+            const std::int64_t isLeaf = value & 1;
+            const std::int64_t delta = detail::unzigzag(value >> 1);
+            previousLeaf += isLeaf * delta;
+            const std::int64_t child = isLeaf ? -previousLeaf : static_cast<std::int64_t>(i / 2) + delta;
+            (i & 1 ? right : left)[i / 2] = static_cast<int>(child);
+        });
+        if (!reader.atEnd()) {
+            reader.fail("trailing data after the child indices");
+        }
+    }
+
+    std::string encodeResponses(Vector<TreeResponseType> const& responses) {
+        const auto shuffled = detail::shuffleBytes(
+            reinterpret_cast<const char*>(responses.data()), responses.size(), sizeof(TreeResponseType));
+        return detail::lzCompress(shuffled.data(), shuffled.size());
+    }
+
+    void decodeResponses(std::string const& section, Vector<TreeResponseType>& responses) {
+        std::string shuffled(responses.size() * sizeof(TreeResponseType), '\0');
+        detail::lzDecompress(section.data(), section.size(), &shuffled[0], shuffled.size(), errorPrefix);
+        detail::unshuffleBytes(
+            shuffled.data(), responses.size(), sizeof(TreeResponseType), reinterpret_cast<char*>(responses.data()));
+    }
+
+    // Reads the arrays of the compressed format. The sections can't be larger than the arrays with the worst case
+    // of ten bytes per varint, plus the cut value dictionaries.
+    void readCompressedArrays(Reader& reader, FastForest& ff, int nRootNodes, int nNodes, int nLeaves) {
+        if (nRootNodes < 0 || nNodes < 0 || nLeaves < 0) {
+            Reader::fail("negative array size");
+        }
+        const std::uint64_t maxSize = 32 * (static_cast<std::uint64_t>(nRootNodes) + nNodes + nLeaves) + 64;
+        const std::string roots = reader.readSection(maxSize);
+        const std::string cutIndices = reader.readSection(maxSize);
+        const std::string cutValues = reader.readSection(maxSize);
+        const std::string children = reader.readSection(maxSize);
+        const std::string responses = reader.readSection(maxSize);
+        // Every varint takes at least one byte, so the sections bound the array sizes before they are allocated.
+        const std::uint64_t nNodes64 = nNodes;
+        if (static_cast<std::uint64_t>(nRootNodes) > roots.size() || nNodes64 > cutIndices.size() ||
+            2 * nNodes64 > children.size() ||
+            nLeaves * sizeof(TreeResponseType) > maxExpansion * responses.size()) {
+            Reader::fail("array size out of range for the size of its section");
+        }
+        ff.rootIndices_.resize(nRootNodes);
+        ff.cutIndices_.resize(nNodes);
+        ff.cutValues_.resize(nNodes);
+        ff.leftIndices_.resize(nNodes);
+        ff.rightIndices_.resize(nNodes);
+        ff.responses_.resize(nLeaves);
+        decodeRoots(roots, ff.rootIndices_);
+        decodeCutIndices(cutIndices, ff.cutIndices_);
+        decodeCutValues(cutValues, ff.cutIndices_, ff.cutValues_);
+        decodeChildren(children, ff.leftIndices_, ff.rightIndices_);
+        decodeResponses(responses, ff.responses_);
+    }
+
+}  // namespace
+
+FastForest fastforest::load_bin(std::string const& txtpath, MemoryResource* resource) {
+    std::ifstream ifs(txtpath, std::ios::binary);
+    if (!ifs) {
+        Reader::fail("can't open " + txtpath);
+    }
+    return load_bin(ifs, resource);
+}
+
+FastForest fastforest::load_bin(std::istream& is, MemoryResource* resource) {
+    FastForest ff{resource};
+    Reader reader{is};
+
+    char begin[4];
+    reader.read(begin, sizeof(begin));
+
+    if (std::memcmp(begin, magic, sizeof(magic)) != 0) {
+        // unversioned format without metadata, where the first bytes are the number of trees
+        int nRootNodes;
+        std::memcpy(&nRootNodes, begin, sizeof(int));
+        int nNodes = reader.read<int>();
+        int nLeaves = reader.read<int>();
+        readArrays(reader, ff, nRootNodes, nNodes, nLeaves);
+        validateIndices(ff);
+        return ff;
+    }
+
+    auto version = reader.read<std::uint32_t>();
+    if (version != formatVersion) {
+        Reader::fail("unsupported format version " + std::to_string(version) + ", expected version " +
+                     std::to_string(formatVersion));
+    }
+    auto flags = reader.read<std::uint32_t>();
+    if (flags & ~(compressedFlag | categoricalFlag | vectorLeafFlag)) {
+        Reader::fail("unsupported format flags " + std::to_string(flags));
+    }
+    std::uint8_t sizes[sizeof(typeSizes)];
+    reader.read(sizes, sizeof(sizes));
+    if (std::memcmp(sizes, typeSizes, sizeof(typeSizes)) != 0) {
+        Reader::fail(
+            "the sizes of the index, feature or response types in the file don't match the ones of this build");
+    }
+
+    Metadata metadata;
+    metadata.nClasses = reader.read<int>();
+    metadata.baseResponse = reader.read<TreeEnsembleResponseType>();
+    metadata.objective = reader.readString();
+    metadata.vectorLeaves = flags & vectorLeafFlag;
+    auto nFeatures = reader.read<std::uint32_t>();
+    if (nFeatures > maxFeatures) {
+        Reader::fail("number of features " + std::to_string(nFeatures) + " is out of range");
+    }
+    metadata.features.resize(nFeatures);
+    for (auto& feature : metadata.features) {
+        feature = reader.readString();
+    }
+
+    int nRootNodes = reader.read<int>();
+    int nNodes = reader.read<int>();
+    int nLeaves = reader.read<int>();
+    if (flags & compressedFlag) {
+        readCompressedArrays(reader, ff, nRootNodes, nNodes, nLeaves);
+    } else {
+        readArrays(reader, ff, nRootNodes, nNodes, nLeaves);
+    }
+    if (flags & categoricalFlag) {
+        if (flags & compressedFlag) {
+            auto section = reader.readSection(maxCategoryWords * sizeof(std::uint32_t));
+            ff.categorySets_.resize(section.size() / sizeof(std::uint32_t));
+            std::memcpy(ff.categorySets_.data(), section.data(), ff.categorySets_.size() * sizeof(std::uint32_t));
+        } else {
+            auto nWords = reader.read<std::uint32_t>();
+            if (nWords > maxCategoryWords) {
+                Reader::fail("category set size " + std::to_string(nWords) + " is out of range");
+            }
+            reader.read(ff.categorySets_, nWords);
+        }
+    }
+    reader.readChecksum();
+
+    ff.set_metadata(std::move(metadata));
+    validateIndices(ff);
+    if (!ff.categorySets_.empty()) {
+        // without category sets, NaN cuts are evaluated as numerical cuts
+        detail::validateCategorySets(ff, errorPrefix);
+    }
+
+    return ff;
+}
+
+void fastforest::FastForest::write_bin(std::string const& filename, bool compress) const {
+    std::ofstream os(filename, std::ios::binary);
+    Writer writer{os};
+
+    writer.write(magic, sizeof(magic));
+    writer.write(formatVersion);
+    writer.write((compress ? compressedFlag : 0) | (categorySets_.empty() ? 0 : categoricalFlag) |
+                 (metadata_.vectorLeaves ? vectorLeafFlag : 0));
+    writer.write(typeSizes, sizeof(typeSizes));
+
+    writer.write(metadata_.nClasses);
+    writer.write(metadata_.baseResponse);
+    writer.write(metadata_.objective);
+    writer.write(static_cast<std::uint32_t>(metadata_.features.size()));
+    for (auto const& feature : metadata_.features) {
+        writer.write(feature);
+    }
+
+    writer.write(static_cast<int>(rootIndices_.size()));
+    writer.write(static_cast<int>(cutValues_.size()));
+    writer.write(static_cast<int>(responses_.size()));
+    if (compress) {
+        writer.writeSection(encodeRoots(rootIndices_));
+        writer.writeSection(encodeCutIndices(cutIndices_));
+        writer.writeSection(encodeCutValues(cutIndices_, cutValues_));
+        writer.writeSection(encodeChildren(leftIndices_, rightIndices_));
+        writer.writeSection(encodeResponses(responses_));
+    } else {
+        writer.write(rootIndices_);
+        writer.write(cutIndices_);
+        writer.write(cutValues_);
+        writer.write(leftIndices_);
+        writer.write(rightIndices_);
+        writer.write(responses_);
+    }
+    if (!categorySets_.empty()) {
+        if (compress) {
+            writer.writeSection(std::string(reinterpret_cast<const char*>(categorySets_.data()),
+                                            categorySets_.size() * sizeof(std::uint32_t)));
+        } else {
+            writer.write(static_cast<std::uint32_t>(categorySets_.size()));
+            writer.write(categorySets_);
+        }
+    }
+
+    writer.writeChecksum();
+    os.close();
+    if (!os) {
+        throw std::runtime_error("Error in FastForest::write_bin : writing to " + filename + " failed");
+    }
+}
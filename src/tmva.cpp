@@ -25,322 +25,376 @@ SOFTWARE.
 */
 
 #include "fastforest.h"
-#include "common_details.h"
 
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
-#include <iostream>
-#include <optional>
-#include <sstream>
+#include <limits>
 #include <stdexcept>
-#include <streambuf>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
-namespace util {
-
-    std::string readFile(const char* filename);
-
-}
-
-std::string util::readFile(const char* filename) {
-    std::ifstream t(filename);
-    std::string str;
+using namespace fastforest;
 
-    t.seekg(0, std::ios::end);
-    str.reserve(t.tellg());
-    t.seekg(0, std::ios::beg);
+namespace {
 
-    str.assign((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
+    [[noreturn]] void fail(std::string const& what) {
+        throw std::runtime_error("Error in fastforest::load_tmva_xml : " + what);
+    }
 
-    return str;
-}
+    // The attributes of a <Node> element in the TMVA weight file that are needed to build the forest.
+    struct NodeAttributes {
+        char pos = 's';
+        int IVar = -1;
+        double Cut = 0.;
+        int cType = 1;
+        double res = 0.;
+        double purity = 0.;
+        int nType = 0;
+    };
 
-namespace tmva {
-    class XMLAttributes {
+    // Minimal single-pass parser for TMVA weight files. It only looks at the elements that describe the variables
+    // and the trees and never copies strings, except for the variable names.
+    class TMVAParser {
       public:
-        // If we set an attribute that is already set, this will do nothing and return false.
-        // Therefore an attribute has repeated and we know a new node has started.
-        bool set(std::string const& name, std::string const& value) {
-            if (name == "itree")
-                return setValue(itree_, std::stoi(value));
-            if (name == "boostWeight")
-                return setValue(boostWeight_, std::stod(value));
-            if (name == "pos")
-                return setValue(pos_, value[0]);
-            if (name == "depth")
-                return setValue(depth_, std::stoi(value));
-            if (name == "IVar")
-                return setValue(IVar_, std::stoi(value));
-            if (name == "Cut")
-                return setValue(Cut_, std::stod(value));
-            if (name == "res")
-                return setValue(res_, std::stod(value));
-            if (name == "nType")
-                return setValue(nType_, std::stoi(value));
-            return true;
-        }
-
-        bool hasValue(std::string const& name) {
-            if (name == "itree")
-                return itree_.has_value();
-            if (name == "boostWeight")
-                return boostWeight_.has_value();
-            if (name == "pos")
-                return pos_.has_value();
-            if (name == "depth")
-                return depth_.has_value();
-            if (name == "IVar")
-                return IVar_.has_value();
-            if (name == "Cut")
-                return Cut_.has_value();
-            if (name == "res")
-                return res_.has_value();
-            if (name == "nType")
-                return nType_.has_value();
-            return false;
-        }
-
-        auto const& itree() const { return itree_; };
-        auto const& boostWeight() const { return boostWeight_; };
-        auto const& pos() const { return pos_; };
-        auto const& depth() const { return depth_; };
-        auto const& IVar() const { return IVar_; };
-        auto const& Cut() const { return Cut_; };
-        auto const& res() const { return res_; };
-        auto const& nType() const { return nType_; };
-
-        void reset() {
-            boostWeight_.reset();
-            itree_.reset();
-            pos_.reset();
-            depth_.reset();
-            IVar_.reset();
-            Cut_.reset();
-            res_.reset();
-            nType_.reset();
-        }
-
-      private:
-        template <class T>
-        bool setValue(std::optional<T>& member, T const& value) {
-            if (member.has_value()) {
-                member = value;
+        TMVAParser(const char* begin, const char* end) : cur_{begin}, end_{end} {}
+
+        // Moves to the start of the next tag and returns false if there is none. The name of the tag (including a
+        // leading slash for closing tags) is stored and can be checked with isTag.
+        bool nextTag() {
+            cur_ = static_cast<const char*>(std::memchr(cur_, '<', end_ - cur_));
+            if (!cur_) {
+                cur_ = end_;
                 return false;
             }
-            member = value;
-            return true;
-        }
-
-        // from the tree root node node
-        std::optional<double> boostWeight_ = std::nullopt;
-        std::optional<int> itree_ = std::nullopt;
-        std::optional<char> pos_ = std::nullopt;
-        std::optional<int> depth_ = std::nullopt;
-        std::optional<int> IVar_ = std::nullopt;
-        std::optional<double> Cut_ = std::nullopt;
-        std::optional<double> res_ = std::nullopt;
-        std::optional<int> nType_ = std::nullopt;
-    };
-
-    struct BDTWithXMLAttributes {
-        std::vector<double> boostWeights;
-        std::vector<std::vector<XMLAttributes>> nodes;
-    };
-
-    BDTWithXMLAttributes readXMLFile(std::string const& filename);
-
-    BDTWithXMLAttributes readXMLFile(std::string const& filename) {
-        const std::string str = util::readFile(filename.c_str());
-
-        std::size_t pos1 = 0;
-
-        std::string name;
-        std::string value;
-
-        BDTWithXMLAttributes bdtXmlAttributes;
-
-        std::vector<XMLAttributes>* currentTree = nullptr;
-
-        XMLAttributes* attrs = nullptr;
-
-        while ((pos1 = str.find('=', pos1)) != std::string::npos) {
-            auto pos2 = str.rfind(' ', pos1) + 1;
-
-            name = str.substr(pos2, pos1 - pos2);
-
-            pos2 = pos1 + 2;
-            pos1 = str.find('"', pos2);
-
-            value = str.substr(pos2, pos1 - pos2);
-
-            if (name == "boostWeight") {
-                bdtXmlAttributes.boostWeights.push_back(std::stod(value));
-            }
-
-            if (name == "itree") {
-                bdtXmlAttributes.nodes.emplace_back();
-                currentTree = &bdtXmlAttributes.nodes.back();
-                currentTree->emplace_back();
-                attrs = &currentTree->back();
+            ++cur_;
+            nameBegin_ = cur_;
+            while (cur_ != end_ && *cur_ != ' ' && *cur_ != '>' && *cur_ != '/' && *cur_ != '\n' && *cur_ != '\t') {
+                ++cur_;
             }
-
-            if (bdtXmlAttributes.nodes.empty())
-                continue;
-
-            if (attrs->hasValue(name)) {
-                currentTree->emplace_back();
-                attrs = &currentTree->back();
+            // closing tags start with a slash that is part of the name
+            if (cur_ == nameBegin_ && cur_ != end_ && *cur_ == '/') {
+                ++cur_;
+                while (cur_ != end_ && *cur_ != '>') {
+                    ++cur_;
+                }
             }
-
-            attrs->set(name, value);
+            nameEnd_ = cur_;
+            return true;
         }
 
-        if (bdtXmlAttributes.nodes.size() != bdtXmlAttributes.boostWeights.size()) {
-            throw std::runtime_error("nodes size and bosstWeights size don't match");
+        bool isTag(const char* name) const {
+            std::size_t n = std::strlen(name);
+            return static_cast<std::size_t>(nameEnd_ - nameBegin_) == n && std::memcmp(nameBegin_, name, n) == 0;
         }
 
-        return bdtXmlAttributes;
-    }
-
-}  // namespace tmva
-
-using namespace fastforest;
-
-namespace {
-
-    struct SlowTreeNode {
-        bool isLeaf = false;
-        int depth = -1;
-        int index = -1;
-        int yes = -1;
-        int no = -1;
-        int missing = -1;
-        int cutIndex = -1;
-        double cutValue = 0.0;
-        double leafValue = 0.0;
-    };
-
-    std::vector<SlowTreeNode> getSlowTreeNodes(std::vector<tmva::XMLAttributes> const& nodes) {
-        std::vector<SlowTreeNode> xgbNodes(nodes.size());
-
-        int xgbIndex = 0;
-        for (int depth = 0; xgbIndex != nodes.size(); ++depth) {
-            int iNode = 0;
-            for (auto const& node : nodes) {
-                if (node.depth() == depth) {
-                    xgbNodes[iNode].index = xgbIndex;
-                    ++xgbIndex;
+        // Calls func(name, nameLength, valueBegin) for each attribute of the current tag, where the value is
+        // terminated by a quote. Returns true if the tag is self-closing.
+        template <class Func>
+        bool attributes(Func const& func) {
+            while (true) {
+                while (cur_ != end_ && (*cur_ == ' ' || *cur_ == '\n' || *cur_ == '\t' || *cur_ == '\r')) {
+                    ++cur_;
+                }
+                if (cur_ == end_) {
+                    fail("unexpected end of file inside a tag");
+                }
+                if (*cur_ == '>') {
+                    ++cur_;
+                    return false;
+                }
+                if (*cur_ == '/') {
+                    cur_ += 2;
+                    return true;
+                }
+                const char* name = cur_;
+                while (cur_ != end_ && *cur_ != '=') {
+                    ++cur_;
+                }
+                std::size_t nameLength = cur_ - name;
+                if (end_ - cur_ < 2 || cur_[1] != '"') {
+                    fail("malformed attribute " + std::string(name, nameLength));
                 }
-                ++iNode;
+                const char* value = cur_ + 2;
+                cur_ = static_cast<const char*>(std::memchr(value, '"', end_ - value));
+                if (!cur_) {
+                    fail("unterminated attribute value");
+                }
+                func(name, nameLength, value);
+                ++cur_;
             }
         }
 
-        int iNode = 0;
-        for (auto const& node : nodes) {
-            auto& xgbNode = xgbNodes[iNode];
-            xgbNode.isLeaf = *node.nType() != 0;
-            xgbNode.depth = *node.depth();
-            xgbNode.cutIndex = *node.IVar();
-            xgbNode.cutValue = *node.Cut();
-            xgbNode.leafValue = *node.res();
-            if (!xgbNode.isLeaf) {
-                xgbNode.yes = xgbNodes[iNode + 1].index;
-                xgbNode.no = xgbNode.yes + 1;
-                xgbNode.missing = xgbNode.yes;
-            }
-            ++iNode;
+        // the text between the end of the current tag and the next tag
+        std::string text() const {
+            auto next = static_cast<const char*>(std::memchr(cur_, '<', end_ - cur_));
+            return std::string(cur_, next ? next : end_);
         }
 
-        return xgbNodes;
-    }
-
-    using SlowTree = std::vector<SlowTreeNode>;
-    using SlowForest = std::vector<SlowTree>;
-
-    std::ostream& operator<<(std::ostream& os, SlowTreeNode const& node) {
-        for (int i = 0; i < node.depth; ++i) {
-            os << "\t";
-        }
-        if (node.isLeaf) {
-            os << node.index << ":leaf=" << node.leafValue;
-        } else {
-            os << node.index << ":[f" << node.cutIndex << "<" << node.cutValue << "]";
-            os << " yes=" << node.yes << ",no=" << node.no << ",missing=" << node.missing;
-        }
-        return os;
-    }
+      private:
+        const char* cur_;
+        const char* end_;
+        const char* nameBegin_ = nullptr;
+        const char* nameEnd_ = nullptr;
+    };
 
-    std::ostream& operator<<(std::ostream& os, SlowTree const& nodes) {
-        for (auto const& node : nodes) {
-            os << node << "\n";
-        }
-        return os;
+    inline bool attributeIs(const char* name, std::size_t nameLength, const char* expected) {
+        return std::strlen(expected) == nameLength && std::memcmp(name, expected, nameLength) == 0;
     }
 
-    std::ostream& operator<<(std::ostream& os, SlowForest const& forest) {
-        int iTree = 0;
-        for (auto const& tree : forest) {
-            os << "booster[" << iTree << "]:"
-               << "\n";
-            os << tree;
-            ++iTree;
+    std::vector<char> readFile(std::string const& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file) {
+            fail("can't open " + filename);
         }
-        return os;
+        file.seekg(0, std::ios::end);
+        std::vector<char> content(static_cast<std::size_t>(file.tellg()));
+        file.seekg(0, std::ios::beg);
+        file.read(content.data(), content.size());
+        return content;
     }
 
 }  // namespace
 
-namespace fastforest {
-
-    FastForest load_slowforest(SlowForest const& xgb, std::vector<std::string>& features) {
-        FastForest ff;
-
-        int nVariables = 0;
-        std::unordered_map<std::string, int> varIndices;
-        bool fixFeatures = false;
-
-        std::unordered_map<int, int> nodeIndices;
-        std::unordered_map<int, int> leafIndices;
-
-        int nPreviousNodes = 0;
-        int nPreviousLeaves = 0;
-
-        for (auto const& tree : xgb) {
-            detail::correctIndices(
-                ff.rightIndices_.begin() + nPreviousNodes, ff.rightIndices_.end(), nodeIndices, leafIndices);
-            detail::correctIndices(
-                ff.leftIndices_.begin() + nPreviousNodes, ff.leftIndices_.end(), nodeIndices, leafIndices);
-            nodeIndices.clear();
-            leafIndices.clear();
-            nPreviousNodes = ff.cutValues_.size();
-            nPreviousLeaves = ff.responses_.size();
-            ff.rootIndices_.push_back(nPreviousNodes);
-            for (auto const& node : tree) {
-                if (node.isLeaf) {
-                    ff.responses_.push_back(node.leafValue);
-                    leafIndices[node.index] = leafIndices.size() + nPreviousLeaves;
+FastForest fastforest::load_tmva_xml(std::string const& xmlpath, std::vector<std::string>& features) {
+    const std::vector<char> content = readFile(xmlpath);
+    TMVAParser parser{content.data(), content.data() + content.size()};
+
+    FastForest ff;
+
+    // names of the variables in the weight file, indexed by the VarIndex attribute
+    std::vector<std::string> variables;
+    // for each variable in the weight file, the index in the features vector
+    std::vector<CutIndexType> featureIndices;
+
+    // Training options that decide how the trees are combined, with the defaults of TMVA's MethodBDT.
+    std::string boostType = "AdaBoost";
+    bool useYesNoLeaf = true;
+    std::string analysisType = "Classification";
+    int nClasses = 2;
+
+    // Trees of type regression (analysis type 1) return the response of the leaves, while classification trees
+    // return the node type or the purity.
+    int treeAnalysisType = 0;
+    double boostWeight = 1.;
+    double boostWeightSum = 0.;
+
+    // leaf values in double precision until the normalization is applied, and the cut types of the nodes
+    std::vector<double> leafValues;
+    std::vector<int> cutTypes;
+
+    // Stack of the cut nodes enclosing the current node. Leaves are pushed as -1 so the stack follows the nesting.
+    std::vector<int> openNodes;
+
+    while (parser.nextTag()) {
+        if (parser.isTag("Info")) {
+            std::string name;
+            std::string value;
+            parser.attributes([&](const char* attr, std::size_t n, const char* begin) {
+                if (attributeIs(attr, n, "name")) {
+                    name.assign(begin, std::strchr(begin, '"'));
+                } else if (attributeIs(attr, n, "value")) {
+                    value.assign(begin, std::strchr(begin, '"'));
+                }
+            });
+            if (name == "AnalysisType") {
+                analysisType = value;
+            }
+        } else if (parser.isTag("Option")) {
+            std::string name;
+            bool selfClosing = parser.attributes([&](const char* attr, std::size_t n, const char* begin) {
+                if (attributeIs(attr, n, "name")) {
+                    name.assign(begin, std::strchr(begin, '"'));
+                }
+            });
+            if (selfClosing) {
+                continue;
+            }
+            if (name == "BoostType") {
+                boostType = parser.text();
+            } else if (name == "UseYesNoLeaf") {
+                useYesNoLeaf = parser.text() == "True";
+            }
+        } else if (parser.isTag("Classes")) {
+            parser.attributes([&](const char* attr, std::size_t n, const char* value) {
+                if (attributeIs(attr, n, "NClass")) {
+                    nClasses = std::atoi(value);
+                }
+            });
+        } else if (parser.isTag("Variable")) {
+            int varIndex = -1;
+            std::string expression;
+            parser.attributes([&](const char* name, std::size_t n, const char* value) {
+                if (attributeIs(name, n, "VarIndex")) {
+                    varIndex = std::atoi(value);
+                } else if (attributeIs(name, n, "Expression")) {
+                    expression.assign(value, std::strchr(value, '"'));
+                }
+            });
+            if (varIndex < 0) {
+                fail("variable without index");
+            }
+            if (static_cast<std::size_t>(varIndex) >= variables.size()) {
+                variables.resize(varIndex + 1);
+            }
+            variables[varIndex] = expression;
+        } else if (parser.isTag("/Variables")) {
+            // map the variables to the requested features, or take them over if no features were requested
+            if (features.empty()) {
+                features = variables;
+            }
+            std::unordered_map<std::string, int> featureIndex;
+            for (std::size_t i = 0; i < features.size(); ++i) {
+                featureIndex[features[i]] = i;
+            }
+            for (auto const& variable : variables) {
+                auto found = featureIndex.find(variable);
+                if (found == featureIndex.end()) {
+                    fail("variable " + variable + " not in list of features");
+                }
+                featureIndices.push_back(found->second);
+            }
+        } else if (parser.isTag("Weights")) {
+            parser.attributes([&](const char* attr, std::size_t n, const char* value) {
+                if (attributeIs(attr, n, "AnalysisType")) {
+                    treeAnalysisType = std::atoi(value);
+                }
+            });
+            if (analysisType != "Classification" && analysisType != "Multiclass") {
+                fail("analysis type " + analysisType + " is not supported");
+            }
+            if (analysisType == "Multiclass" && boostType != "Grad") {
+                fail("multiclass classification is only supported with gradient boosting");
+            }
+        } else if (parser.isTag("BinaryTree")) {
+            boostWeight = 1.;
+            parser.attributes([&](const char* attr, std::size_t n, const char* value) {
+                if (attributeIs(attr, n, "boostWeight")) {
+                    boostWeight = std::strtod(value, nullptr);
+                }
+            });
+            boostWeightSum += boostWeight;
+            ff.rootIndices_.push_back(0);
+            openNodes.clear();
+        } else if (parser.isTag("Node")) {
+            if (ff.rootIndices_.empty()) {
+                fail("node outside of a tree");
+            }
+            NodeAttributes node;
+            bool selfClosing = parser.attributes([&](const char* name, std::size_t n, const char* value) {
+                // dispatch on the first letter first, so most attributes need only a single comparison
+                switch (name[0]) {
+                    case 'p':
+                        if (attributeIs(name, n, "pos"))
+                            node.pos = value[0];
+                        else if (attributeIs(name, n, "purity"))
+                            node.purity = std::strtod(value, nullptr);
+                        break;
+                    case 'I':
+                        if (attributeIs(name, n, "IVar"))
+                            node.IVar = std::atoi(value);
+                        break;
+                    case 'C':
+                        if (attributeIs(name, n, "Cut"))
+                            node.Cut = std::strtod(value, nullptr);
+                        break;
+                    case 'c':
+                        if (attributeIs(name, n, "cType"))
+                            node.cType = std::atoi(value);
+                        break;
+                    case 'r':
+                        if (attributeIs(name, n, "res"))
+                            node.res = std::strtod(value, nullptr);
+                        break;
+                    case 'n':
+                        if (attributeIs(name, n, "nType"))
+                            node.nType = std::atoi(value);
+                        break;
+                }
+            });
+
+            // Internal nodes have nType zero, while leaves are marked as signal or background leaves (or with -99
+            // in the files converted from XGBoost).
+            bool isLeaf = node.nType != 0;
+            int index;
+            if (isLeaf) {
+                index = -static_cast<int>(leafValues.size());
+                if (treeAnalysisType == 1) {
+                    leafValues.push_back(node.res);
                 } else {
-                    ff.cutValues_.push_back(node.cutValue);
-                    ff.cutIndices_.push_back(node.cutIndex);
-                    ff.leftIndices_.push_back(node.yes);
-                    ff.rightIndices_.push_back(node.no);
-                    nodeIndices[node.index] = nodeIndices.size() + nPreviousNodes;
+                    // the boost weight is folded into the leaves, the normalization follows after reading all trees
+                    leafValues.push_back(boostWeight * (useYesNoLeaf ? node.nType : node.purity));
                 }
+            } else {
+                if (node.IVar < 0 || static_cast<std::size_t>(node.IVar) >= featureIndices.size()) {
+                    fail("cut on unknown variable " + std::to_string(node.IVar));
+                }
+                index = ff.cutValues_.size();
+                ff.cutIndices_.push_back(featureIndices[node.IVar]);
+                // TMVA compares the features with x >= cut in single precision, while FastForest goes right for
+                // x > cut. The two are equivalent if the cut is moved to the next smaller float.
+                ff.cutValues_.push_back(std::nextafter(static_cast<float>(node.Cut),
+                                                       -std::numeric_limits<float>::infinity()));
+                ff.leftIndices_.push_back(0);
+                ff.rightIndices_.push_back(0);
             }
-        }
 
-        detail::correctIndices(
-            ff.rightIndices_.begin() + nPreviousNodes, ff.rightIndices_.end(), nodeIndices, leafIndices);
-        detail::correctIndices(
-            ff.leftIndices_.begin() + nPreviousNodes, ff.leftIndices_.end(), nodeIndices, leafIndices);
+            if (openNodes.empty()) {
+                // the root node, where a leaf means a single-leaf tree (see FastForest::evaluate)
+                ff.rootIndices_.back() = isLeaf ? index - 1 : index;
+            } else if (openNodes.back() < 0) {
+                fail("leaf node with children");
+            } else {
+                // Events pass the cut of the parent if x >= cut and the cut type is one, or if x < cut and the cut
+                // type is zero. Passing events go to the right node, so for cut type zero the children are swapped.
+                int parent = openNodes.back();
+                bool right = (node.pos == 'r') == (cutTypes[parent] != 0);
+                (right ? ff.rightIndices_ : ff.leftIndices_)[parent] = index;
+            }
 
-        return ff;
+            if (!isLeaf) {
+                cutTypes.push_back(node.cType);
+            }
+            if (!selfClosing) {
+                openNodes.push_back(isLeaf ? -1 : index);
+            }
+        } else if (parser.isTag("/Node")) {
+            if (openNodes.empty()) {
+                fail("unbalanced node tags");
+            }
+            openNodes.pop_back();
+        }
     }
 
-    FastForest load_tmva_xml(std::string const& xmlpath, std::vector<std::string>& features) {
-        tmva::BDTWithXMLAttributes tmvaXML = tmva::readXMLFile(xmlpath);
-        std::vector<std::vector<SlowTreeNode>> xgboostForest;
-        for (auto const& tree : tmvaXML.nodes) {
-            xgboostForest.push_back(getSlowTreeNodes(tree));
+    Metadata metadata;
+    metadata.baseResponse = 0.;
+    metadata.features = features;
+    if (boostType == "Grad") {
+        // Gradient boosting sums the tree responses. For binary classification the sum is mapped to [-1, 1] with
+        // tanh, for multiclass classification the sums of the interleaved class trees go through a softmax.
+        if (analysisType == "Multiclass") {
+            metadata.nClasses = nClasses;
+            metadata.objective = "multi:softprob";
+        } else {
+            metadata.objective = "tmva:grad";
+        }
+    } else {
+        // The other boost types take the average of the tree outputs weighted with the boost weights, or zero if
+        // the weights sum up to zero.
+        double scale = boostWeightSum > std::numeric_limits<double>::epsilon() ? 1. / boostWeightSum : 0.;
+        for (auto& value : leafValues) {
+            value *= scale;
         }
-        return fastforest::load_slowforest(xgboostForest, features);
+        metadata.objective = "tmva:adaboost";
     }
-}  // namespace fastforest
+    ff.responses_.assign(leafValues.begin(), leafValues.end());
+    ff.set_metadata(std::move(metadata));
+    // the nodes of each class are stored contiguously, like for the other loaders of multiclass models
+    if (ff.metadata().nClasses > 1) {
+        ff.group_classes(ff.metadata().nClasses);
+    }
+
+    return ff;
+}
@@ -0,0 +1,193 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "fastforest.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace fastforest;
+
+namespace {
+
+    // Constants for the exponential function from the Cephes library (expf.c). The argument is reduced to
+    // x = n * ln(2) + r with |r| <= ln(2)/2, exp(r) is approximated by a polynomial and multiplied by 2^n.
+    constexpr float expHi = 88.3762626647949f;
+    constexpr float expLo = -87.3365447504f;
+    constexpr float log2e = 1.44269504088896341f;
+    constexpr float ln2Hi = 0.693359375f;
+    constexpr float ln2Lo = -2.12194440e-4f;
+    constexpr float p0 = 1.9875691500e-4f;
+    constexpr float p1 = 1.3981999507e-3f;
+    constexpr float p2 = 8.3334519073e-3f;
+    constexpr float p3 = 4.1665795894e-2f;
+    constexpr float p4 = 1.6666665459e-1f;
+    constexpr float p5 = 5.0000001201e-1f;
+
+    inline float fastExp(float x) {
+        x = std::min(std::max(x, expLo), expHi);
+        float n = std::floor(x * log2e + 0.5f);
+        float r = x - n * ln2Hi - n * ln2Lo;
+        float y = ((((p0 * r + p1) * r + p2) * r + p3) * r + p4) * r + p5;
+        y = y * r * r + r + 1.f;
+        std::int32_t bits = (static_cast<std::int32_t>(n) + 127) << 23;
+        float scale;
+        std::memcpy(&scale, &bits, sizeof(float));
+        return y * scale;
+    }
+
+#ifdef __SSE2__
+    // Same operations as fastExp on four floats at once, so the results are bitwise identical.
+    inline __m128 fastExp(__m128 x) {
+        x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(expLo)), _mm_set1_ps(expHi));
+        __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(log2e)), _mm_set1_ps(0.5f));
+        // floor, emulated with a truncation that is corrected for negative numbers
+        __m128 n = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+        n = _mm_sub_ps(n, _mm_and_ps(_mm_cmpgt_ps(n, fx), _mm_set1_ps(1.f)));
+        __m128 r = _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(ln2Hi))), _mm_mul_ps(n, _mm_set1_ps(ln2Lo)));
+        __m128 y = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p0), r), _mm_set1_ps(p1));
+        y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(p2));
+        y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(p3));
+        y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(p4));
+        y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(p5));
+        y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(y, r), r), r), _mm_set1_ps(1.f));
+        __m128i bits = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n), _mm_set1_epi32(127)), 23);
+        return _mm_mul_ps(y, _mm_castsi128_ps(bits));
+    }
+#endif
+
+    // Applies op to each element of the array, four at a time if SSE2 is available. The scalar and vector versions
+    // of op have to give the same result, such that the output does not depend on the position in the array.
+    template <class ScalarOp, class VectorOp>
+    void forEach(TreeEnsembleResponseType* out, std::size_t n, ScalarOp scalarOp, VectorOp vectorOp) {
+        std::size_t i = 0;
+#ifdef __SSE2__
+        for (; i + 4 <= n; i += 4) {
+            _mm_storeu_ps(out + i, vectorOp(_mm_loadu_ps(out + i)));
+        }
+#endif
+        for (; i < n; ++i) {
+            out[i] = scalarOp(out[i]);
+        }
+    }
+
+    void expInplace(TreeEnsembleResponseType* out, std::size_t n) {
+#ifdef __SSE2__
+        forEach(out, n, [](float x) { return fastExp(x); }, [](__m128 x) { return fastExp(x); });
+#else
+        forEach(out, n, [](float x) { return fastExp(x); }, nullptr);
+#endif
+    }
+
+    void logisticInplace(TreeEnsembleResponseType* out, std::size_t n) {
+#ifdef __SSE2__
+        forEach(out,
+                n,
+                [](float x) { return 1.f / (1.f + fastExp(-x)); },
+                [](__m128 x) {
+                    const __m128 one = _mm_set1_ps(1.f);
+                    return _mm_div_ps(one, _mm_add_ps(one, fastExp(_mm_sub_ps(_mm_setzero_ps(), x))));
+                });
+#else
+        forEach(out, n, [](float x) { return 1.f / (1.f + fastExp(-x)); }, nullptr);
+#endif
+    }
+
+    // tanh(x) = 2/(1+exp(-2x)) - 1, which is how TMVA computes the output of gradient boosted trees
+    void tanhInplace(TreeEnsembleResponseType* out, std::size_t n) {
+#ifdef __SSE2__
+        forEach(out,
+                n,
+                [](float x) { return 2.f / (1.f + fastExp(-2.f * x)) - 1.f; },
+                [](__m128 x) {
+                    const __m128 one = _mm_set1_ps(1.f);
+                    const __m128 two = _mm_set1_ps(2.f);
+                    __m128 e = fastExp(_mm_mul_ps(_mm_set1_ps(-2.f), x));
+                    return _mm_sub_ps(_mm_div_ps(two, _mm_add_ps(one, e)), one);
+                });
+#else
+        forEach(out, n, [](float x) { return 2.f / (1.f + fastExp(-2.f * x)) - 1.f; }, nullptr);
+#endif
+    }
+
+    void softmaxInplace(TreeEnsembleResponseType* out, std::size_t nRows, int nOut) {
+        // Subtract the maximum of each row first to avoid overflows, like the Softmax function in the
+        // src/common/math.h source file of xgboost. The exponentials are then taken for all rows at once.
+        for (std::size_t iRow = 0; iRow < nRows; ++iRow) {
+            TreeEnsembleResponseType* row = out + iRow * nOut;
+            TreeEnsembleResponseType wmax = *std::max_element(row, row + nOut);
+            for (int i = 0; i < nOut; ++i) {
+                row[i] -= wmax;
+            }
+        }
+        expInplace(out, nRows * nOut);
+        for (std::size_t iRow = 0; iRow < nRows; ++iRow) {
+            TreeEnsembleResponseType* row = out + iRow * nOut;
+            double norm = 0.;
+            for (int i = 0; i < nOut; ++i) {
+                norm += row[i];
+            }
+            for (int i = 0; i < nOut; ++i) {
+                row[i] /= static_cast<float>(norm);
+            }
+        }
+    }
+
+}  // namespace
+
+void fastforest::details::softmaxTransformInplace(TreeEnsembleResponseType* out, int nOut) {
+    softmaxInplace(out, 1, nOut);
+}
+
+void fastforest::transform_inplace(TreeEnsembleResponseType* out, int nRows, int nOut, Transform transform) {
+    const std::size_t n = static_cast<std::size_t>(nRows) * nOut;
+    switch (transform) {
+        case Transform::Identity:
+            break;
+        case Transform::Logistic:
+            logisticInplace(out, n);
+            break;
+        case Transform::Softmax:
+            softmaxInplace(out, nRows, nOut);
+            break;
+        case Transform::Exp:
+            expInplace(out, n);
+            break;
+        case Transform::Tanh:
+            tanhInplace(out, n);
+            break;
+        default:
+            throw std::runtime_error("Error in fastforest::transform_inplace : unknown transform " +
+                                     std::to_string(static_cast<int>(transform)));
+    }
+}
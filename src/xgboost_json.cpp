@@ -0,0 +1,574 @@
+/**
+
+MIT License
+
+Copyright (c) 2020 Jonas Rembser
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "common_details.h"
+#include "fastforest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace fastforest;
+
+namespace {
+
+    [[noreturn]] void fail(std::string const& what) {
+        throw std::runtime_error("Error in fastforest::load_xgboost_json : " + what);
+    }
+
+    // A parsed JSON value. Arrays that only contain numbers (or booleans) are stored as a plain vector of doubles,
+    // because the trees of large models have millions of them. Doubles represent the float cut values and the
+    // integer indices of XGBoost models exactly.
+    struct Json {
+        enum Type { Null, Bool, Number, String, Array, NumberArray, Object };
+
+        Type type = Null;
+        double number = 0.;
+        std::string string;
+        std::vector<Json> array;
+        std::vector<double> numbers;
+        std::vector<std::pair<std::string, Json>> object;
+
+        Json const* find(std::string const& key) const {
+            for (auto const& member : object) {
+                if (member.first == key) {
+                    return &member.second;
+                }
+            }
+            return nullptr;
+        }
+
+        Json const& operator[](std::string const& key) const {
+            if (type != Object) {
+                fail("expected an object with the key " + key);
+            }
+            auto value = find(key);
+            if (!value) {
+                fail("missing key " + key);
+            }
+            return *value;
+        }
+
+        // XGBoost stores many parameters as strings, e.g. "num_class": "3" or "base_score": "5E-1", and newer
+        // versions store the base score as a list like "[5E-1]" (see asNumbers for lists with several values).
+        double asNumber() const {
+            if (type == Number || type == Bool) {
+                return number;
+            }
+            if (type == String) {
+                const char* begin = string.c_str() + (!string.empty() && string[0] == '[');
+                char* end;
+                double value = std::strtod(begin, &end);
+                if (end != begin) {
+                    return value;
+                }
+            }
+            fail("expected a number");
+        }
+
+        // the values of a list in a string, like "[5E-1,2.5E-1]"
+        std::vector<double> asNumberList() const {
+            if (type != String) {
+                return {asNumber()};
+            }
+            std::vector<double> values;
+            const char* cur = string.c_str() + (!string.empty() && string[0] == '[');
+            while (true) {
+                char* end;
+                values.push_back(std::strtod(cur, &end));
+                if (end == cur) {
+                    fail("expected a number or a list of numbers");
+                }
+                cur = end;
+                if (*cur != ',') {
+                    return values;
+                }
+                ++cur;
+            }
+        }
+
+        std::vector<double> const& asNumbers() const {
+            if (type != NumberArray) {
+                // empty arrays are parsed as arrays of numbers, so this is really something else
+                fail("expected an array of numbers");
+            }
+            return numbers;
+        }
+    };
+
+    class JsonParser {
+      public:
+        JsonParser(const char* begin, const char* end) : cur_{begin}, end_{end} {}
+
+        Json parseDocument() {
+            Json value = parse();
+            skipSpace();
+            if (cur_ != end_) {
+                fail("trailing characters after the JSON document");
+            }
+            return value;
+        }
+
+      private:
+        void skipSpace() {
+            while (cur_ != end_ && (*cur_ == ' ' || *cur_ == '\n' || *cur_ == '\r' || *cur_ == '\t')) {
+                ++cur_;
+            }
+        }
+
+        char peek() {
+            skipSpace();
+            if (cur_ == end_) {
+                fail("unexpected end of the JSON document");
+            }
+            return *cur_;
+        }
+
+        void expect(char c) {
+            if (peek() != c) {
+                fail(std::string{"expected '"} + c + "' in the JSON document");
+            }
+            ++cur_;
+        }
+
+        bool consumeWord(const char* word) {
+            const std::size_t n = std::strlen(word);
+            if (static_cast<std::size_t>(end_ - cur_) >= n && std::equal(word, word + n, cur_)) {
+                cur_ += n;
+                return true;
+            }
+            return false;
+        }
+
+        // Parses a number or a boolean into value, returns false if the next value is something else.
+        bool parseScalar(double& value) {
+            const char c = peek();
+            if (c == 't' && consumeWord("true")) {
+                value = 1.;
+                return true;
+            }
+            if (c == 'f' && consumeWord("false")) {
+                value = 0.;
+                return true;
+            }
+            if (c != '-' && (c < '0' || c > '9')) {
+                return false;
+            }
+            // strtod needs a null-terminated string, which the buffer of the document is
+            char* next;
+            value = std::strtod(cur_, &next);
+            if (next == cur_ || next > end_) {
+                fail("malformed number in the JSON document");
+            }
+            cur_ = next;
+            return true;
+        }
+
+        std::string parseString() {
+            expect('"');
+            std::string out;
+            while (true) {
+                if (cur_ == end_) {
+                    fail("unterminated string in the JSON document");
+                }
+                char c = *cur_++;
+                if (c == '"') {
+                    return out;
+                }
+                if (c != '\\') {
+                    out.push_back(c);
+                    continue;
+                }
+                if (cur_ == end_) {
+                    fail("unterminated string in the JSON document");
+                }
+                c = *cur_++;
+                switch (c) {
+                    case 'b':
+                        out.push_back('\b');
+                        break;
+                    case 'f':
+                        out.push_back('\f');
+                        break;
+                    case 'n':
+                        out.push_back('\n');
+                        break;
+                    case 'r':
+                        out.push_back('\r');
+                        break;
+                    case 't':
+                        out.push_back('\t');
+                        break;
+                    case 'u': {
+                        if (end_ - cur_ < 4) {
+                            fail("malformed escape sequence in the JSON document");
+                        }
+                        const unsigned code = std::stoul(std::string(cur_, cur_ + 4), nullptr, 16);
+                        cur_ += 4;
+                        // UTF-8 encoding of the code point, surrogate pairs are not combined
+                        if (code < 0x80) {
+                            out.push_back(static_cast<char>(code));
+                        } else if (code < 0x800) {
+                            out.push_back(static_cast<char>(0xc0 | (code >> 6)));
+                            out.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+                        } else {
+                            out.push_back(static_cast<char>(0xe0 | (code >> 12)));
+                            out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+                            out.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+                        }
+                        break;
+                    }
+                    default:
+                        out.push_back(c);
+                }
+            }
+        }
+
+        Json parse() {
+            Json value;
+            const char c = peek();
+            if (c == '{') {
+                ++cur_;
+                value.type = Json::Object;
+                if (peek() == '}') {
+                    ++cur_;
+                    return value;
+                }
+                do {
+                    std::string key = parseString();
+                    expect(':');
+                    value.object.emplace_back(std::move(key), parse());
+                } while (peek() == ',' && ++cur_);
+                expect('}');
+            } else if (c == '[') {
+                ++cur_;
+                // arrays of numbers take the fast path, until something else comes up
+                value.type = Json::NumberArray;
+                double number;
+                if (peek() != ']') {
+                    do {
+                        if (value.type == Json::NumberArray && parseScalar(number)) {
+                            value.numbers.push_back(number);
+                            continue;
+                        }
+                        if (value.type == Json::NumberArray) {
+                            value.type = Json::Array;
+                            for (double x : value.numbers) {
+                                value.array.emplace_back();
+                                value.array.back().type = Json::Number;
+                                value.array.back().number = x;
+                            }
+                            value.numbers.clear();
+                        }
+                        value.array.push_back(parse());
+                    } while (peek() == ',' && ++cur_);
+                }
+                expect(']');
+            } else if (c == '"') {
+                value.type = Json::String;
+                value.string = parseString();
+            } else if (c == 'n' && consumeWord("null")) {
+                value.type = Json::Null;
+            } else if (parseScalar(value.number)) {
+                value.type = (c == 't' || c == 'f') ? Json::Bool : Json::Number;
+            } else {
+                fail(std::string{"unexpected character '"} + c + "' in the JSON document");
+            }
+            return value;
+        }
+
+        const char* cur_;
+        const char* end_;
+    };
+
+    // The base score is stored as a prediction, so it has to be mapped back to a raw response with the inverse of
+    // the output transformation of the objective.
+    TreeEnsembleResponseType baseMargin(double baseScore, Transform transform) {
+        switch (transform) {
+            case Transform::Logistic:
+                return static_cast<TreeEnsembleResponseType>(std::log(baseScore / (1. - baseScore)));
+            case Transform::Exp:
+                return static_cast<TreeEnsembleResponseType>(std::log(baseScore));
+            default:
+                return static_cast<TreeEnsembleResponseType>(baseScore);
+        }
+    }
+
+    // Appends one tree from its node arrays in depth-first order. XGBoost goes left if x < cond, which for float
+    // inputs is the same as not x > cut with the largest float below cond. At categorical splits, XGBoost goes right
+    // for the categories in the set, like FastForest. The leaves of trees with vector leaves (with leafSize values
+    // each) are stored in the base weights of the nodes, the others in the split conditions.
+    void appendTree(FastForest& ff,
+                    Json const& tree,
+                    std::vector<CutIndexType> const& featureIndices,
+                    double scale,
+                    int leafSize) {
+        auto const& left = tree["left_children"].asNumbers();
+        auto const& right = tree["right_children"].asNumbers();
+        auto const& splitIndices = tree["split_indices"].asNumbers();
+        auto const& splitConditions = tree["split_conditions"].asNumbers();
+        const std::size_t nNodes = left.size();
+        if (nNodes == 0 || right.size() != nNodes || splitIndices.size() != nNodes ||
+            splitConditions.size() != nNodes) {
+            fail("inconsistent node arrays");
+        }
+        auto const* splitType = tree.find("split_type");
+        if (splitType && splitType->asNumbers().size() != nNodes) {
+            fail("inconsistent node arrays");
+        }
+        const int treeLeafSize = tree.find("tree_param") && tree["tree_param"].find("size_leaf_vector")
+                                     ? std::max(1, static_cast<int>(tree["tree_param"]["size_leaf_vector"].asNumber()))
+                                     : 1;
+        if (treeLeafSize != leafSize) {
+            fail("trees with " + std::to_string(treeLeafSize) + " values per leaf in a model with " +
+                 std::to_string(leafSize) + " targets");
+        }
+        auto const& leafValues = leafSize > 1 ? tree["base_weights"].asNumbers() : splitConditions;
+        if (leafValues.size() != nNodes * leafSize) {
+            fail("inconsistent leaf values");
+        }
+
+        // the category set of each categorical node
+        std::unordered_map<int, std::vector<std::uint32_t>> categories;
+        if (tree.find("categories_nodes")) {
+            auto const& nodes = tree["categories_nodes"].asNumbers();
+            auto const& segments = tree["categories_segments"].asNumbers();
+            auto const& sizes = tree["categories_sizes"].asNumbers();
+            auto const& values = tree["categories"].asNumbers();
+            if (segments.size() != nodes.size() || sizes.size() != nodes.size()) {
+                fail("inconsistent category arrays");
+            }
+            for (std::size_t i = 0; i < nodes.size(); ++i) {
+                if (segments[i] < 0 || sizes[i] < 0 || segments[i] + sizes[i] > values.size()) {
+                    fail("category segment out of range");
+                }
+                auto& set = categories[static_cast<int>(nodes[i])];
+                for (auto it = values.begin() + segments[i]; it != values.begin() + segments[i] + sizes[i]; ++it) {
+                    set.push_back(static_cast<std::uint32_t>(*it));
+                }
+            }
+        }
+
+        auto isLeaf = [&](int node) { return left[node] < 0; };
+        auto appendLeaf = [&](int node) {
+            for (int i = 0; i < leafSize; ++i) {
+                ff.responses_.push_back(static_cast<TreeResponseType>(leafValues[node * leafSize + i] * scale));
+            }
+            return static_cast<int>(ff.responses_.size() / leafSize) - 1;
+        };
+
+        if (isLeaf(0)) {
+            ff.rootIndices_.push_back(-appendLeaf(0) - 1);
+            return;
+        }
+        ff.rootIndices_.push_back(ff.cutValues_.size());
+
+        struct StackEntry {
+            int node;
+            int newParent;
+            bool isRight;
+        };
+        std::vector<StackEntry> stack{{0, -1, false}};
+        std::size_t nVisited = 0;
+        while (!stack.empty()) {
+            StackEntry entry = stack.back();
+            stack.pop_back();
+            if (entry.node < 0 || static_cast<std::size_t>(entry.node) >= nNodes || ++nVisited > nNodes) {
+                fail("malformed tree structure");
+            }
+            int newIndex;
+            if (isLeaf(entry.node)) {
+                newIndex = -appendLeaf(entry.node);
+            } else {
+                const auto feature = static_cast<std::size_t>(splitIndices[entry.node]);
+                if (feature >= featureIndices.size()) {
+                    fail("feature index " + std::to_string(feature) + " out of range");
+                }
+                newIndex = ff.cutValues_.size();
+                if (splitType && splitType->numbers[entry.node] == 1) {
+                    ff.cutValues_.push_back(detail::appendCategorySet(ff, categories[entry.node]));
+                } else {
+                    ff.cutValues_.push_back(std::nextafter(static_cast<FeatureType>(splitConditions[entry.node]),
+                                                           -std::numeric_limits<FeatureType>::infinity()));
+                }
+                ff.cutIndices_.push_back(featureIndices[feature]);
+                ff.leftIndices_.push_back(0);
+                ff.rightIndices_.push_back(0);
+                stack.push_back({static_cast<int>(right[entry.node]), newIndex, true});
+                stack.push_back({static_cast<int>(left[entry.node]), newIndex, false});
+            }
+            if (entry.newParent >= 0) {
+                (entry.isRight ? ff.rightIndices_ : ff.leftIndices_)[entry.newParent] = newIndex;
+            }
+        }
+    }
+
+}  // namespace
+
+FastForest fastforest::load_xgboost_json(std::string const& path,
+                                         std::vector<std::string>& features,
+                                         MemoryResource* resource) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        fail("can't open " + path);
+    }
+    return load_xgboost_json(file, features, resource);
+}
+
+FastForest fastforest::load_xgboost_json(std::istream& is,
+                                         std::vector<std::string>& features,
+                                         MemoryResource* resource) {
+    const std::string text{std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()};
+    const Json document = JsonParser{text.c_str(), text.c_str() + text.size()}.parseDocument();
+    Json const& learner = document["learner"];
+    Json const& modelParam = learner["learner_model_param"];
+
+    // DART models are gbtree models with a weight for each tree
+    Json const* booster = &learner["gradient_booster"];
+    std::vector<double> treeWeights;
+    if (booster->find("name") && (*booster)["name"].string == "dart") {
+        treeWeights = (*booster)["weight_drop"].asNumbers();
+        booster = &(*booster)["gbtree"];
+    }
+    if (booster->find("name") && (*booster)["name"].string != "gbtree") {
+        fail("unsupported booster " + (*booster)["name"].string);
+    }
+    Json const& model = (*booster)["model"];
+
+    // map the features of the model to the requested features, or take them over if no features were requested
+    std::vector<std::string> modelFeatures;
+    if (learner.find("feature_names")) {
+        for (auto const& name : learner["feature_names"].array) {
+            modelFeatures.push_back(name.string);
+        }
+    }
+    if (modelFeatures.empty()) {
+        // the names in the text dumps of models without feature names
+        const int nFeatures = modelParam["num_feature"].asNumber();
+        for (int i = 0; i < nFeatures; ++i) {
+            modelFeatures.push_back("f" + std::to_string(i));
+        }
+    }
+    if (features.empty()) {
+        features = modelFeatures;
+    }
+    std::unordered_map<std::string, int> featureIndex;
+    for (std::size_t i = 0; i < features.size(); ++i) {
+        featureIndex[features[i]] = i;
+    }
+    std::vector<CutIndexType> featureIndices;
+    for (auto const& name : modelFeatures) {
+        auto found = featureIndex.find(name);
+        if (found == featureIndex.end()) {
+            fail("feature " + name + " not in list of features");
+        }
+        featureIndices.push_back(found->second);
+    }
+
+    Metadata metadata;
+    metadata.features = features;
+    metadata.objective = learner["objective"]["name"].string;
+    // Models with several targets have one tree per target like multiclass models, or vector leaves with a value
+    // for each target if they were trained with multi_strategy="multi_output_tree".
+    const int nTargets = modelParam.find("num_target") ? modelParam["num_target"].asNumber() : 1;
+    metadata.nClasses = std::max({1, static_cast<int>(modelParam["num_class"].asNumber()), nTargets});
+    auto const& trees = model["trees"].array;
+    metadata.vectorLeaves = nTargets > 1 && !trees.empty() && trees[0].find("tree_param") &&
+                            trees[0]["tree_param"].find("size_leaf_vector") &&
+                            trees[0]["tree_param"]["size_leaf_vector"].asNumber() > 1;
+    const int leafSize = metadata.vectorLeaves ? metadata.nClasses : 1;
+
+    // The base score can have a value for each output. The first one is the base response, and the differences to
+    // it are added as constant trees.
+    std::vector<TreeEnsembleResponseType> baseMargins;
+    for (double baseScore : modelParam["base_score"].asNumberList()) {
+        baseMargins.push_back(baseMargin(baseScore, objectiveTransform(metadata.objective)));
+    }
+    if (baseMargins.size() != 1 && baseMargins.size() != static_cast<std::size_t>(metadata.nClasses)) {
+        fail("the base score has " + std::to_string(baseMargins.size()) + " values for " +
+             std::to_string(metadata.nClasses) + " outputs");
+    }
+    metadata.baseResponse = baseMargins[0];
+    baseMargins.resize(metadata.nClasses, baseMargins[0]);
+
+    // The trees are assigned to the classes by tree_info. They are interleaved by class, with zero trees for the
+    // classes that have fewer trees.
+    auto const& treeInfo = model["tree_info"].asNumbers();
+    if (treeInfo.size() != trees.size() || (!treeWeights.empty() && treeWeights.size() != trees.size())) {
+        fail("inconsistent number of trees");
+    }
+    std::vector<std::vector<int>> classTrees(metadata.vectorLeaves ? 1 : metadata.nClasses);
+    for (std::size_t iTree = 0; iTree < trees.size(); ++iTree) {
+        const int iClass = treeInfo[iTree];
+        if (iClass < 0 || iClass >= static_cast<int>(classTrees.size())) {
+            fail("class " + std::to_string(iClass) + " of tree " + std::to_string(iTree) + " out of range");
+        }
+        classTrees[iClass].push_back(iTree);
+    }
+    std::size_t nRounds = 0;
+    for (auto const& treesOfClass : classTrees) {
+        nRounds = std::max(nRounds, treesOfClass.size());
+    }
+
+    FastForest ff{resource};
+    for (std::size_t iRound = 0; iRound < nRounds; ++iRound) {
+        for (auto const& treesOfClass : classTrees) {
+            if (iRound < treesOfClass.size()) {
+                const int iTree = treesOfClass[iRound];
+                const double scale = treeWeights.empty() ? 1. : treeWeights[iTree];
+                appendTree(ff, trees[iTree], featureIndices, scale, leafSize);
+            } else {
+                ff.rootIndices_.push_back(-static_cast<int>(ff.responses_.size()) - 1);
+                ff.responses_.push_back(0);
+            }
+        }
+    }
+    if (std::any_of(baseMargins.begin(), baseMargins.end(), [&](double x) { return x != baseMargins[0]; })) {
+        // one vector leaf or a round of single-leaf trees
+        for (int iClass = 0; iClass < metadata.nClasses; ++iClass) {
+            if (iClass == 0 || !metadata.vectorLeaves) {
+                ff.rootIndices_.push_back(-static_cast<int>(ff.responses_.size() / leafSize) - 1);
+            }
+            ff.responses_.push_back(baseMargins[iClass] - baseMargins[0]);
+        }
+    }
+    ff.set_metadata(std::move(metadata));
+    // the nodes of each class are stored contiguously, which is faster to evaluate for large multiclass models
+    if (ff.metadata().nClasses > 1 && !ff.metadata().vectorLeaves) {
+        ff.group_classes(ff.metadata().nClasses);
+    }
+
+    return ff;
+}
@@ -3,15 +3,50 @@ import numpy as np
 
 byteorder = "little"
 
+magic = b"FFB\xff"
+
+
+def read_int(f):
+    return int.from_bytes(f.read(4), byteorder, signed=True)
+
+
+def read_string(f):
+    return f.read(int.from_bytes(f.read(4), byteorder)).decode()
+
+
 with open(sys.argv[-1], "rb") as f:
-    nRootNodes = int.from_bytes(f.read(4), byteorder)
-    nNodes = int.from_bytes(f.read(4), byteorder)
-    nLeaves = int.from_bytes(f.read(4), byteorder)
+    begin = f.read(4)
+
+    if begin == magic:
+        print("version:", int.from_bytes(f.read(4), byteorder))
+        flags = int.from_bytes(f.read(4), byteorder)
+        print("flags:", flags)
+        print("type sizes:", list(f.read(8)[:5]))
+        print("nClasses:", read_int(f))
+        print("baseResponse:", np.frombuffer(f.read(4), dtype=np.float32)[0])
+        print("objective:", read_string(f))
+        print("features:", [read_string(f) for _ in range(int.from_bytes(f.read(4), byteorder))])
+        nRootNodes = read_int(f)
+    else:
+        nRootNodes = int.from_bytes(begin, byteorder, signed=True)
+
+    nNodes = read_int(f)
+    nLeaves = read_int(f)
 
     print("nRootNodes:", nRootNodes)
     print("nNodes:", nNodes)
     print("nLeaves:", nLeaves)
 
+    if begin == magic and flags & 1:
+        # compressed variant, where each array is a section with its size in bytes and the encoded data
+        for name in ["rootIndices", "cutIndices", "cutValues", "leftIndices/rightIndices", "responses"]:
+            size = int.from_bytes(f.read(8), byteorder)
+            f.seek(size, 1)
+            print(name, "section:", size, "bytes")
+        if flags & 2:
+            print("categorySets section:", int.from_bytes(f.read(8), byteorder), "bytes")
+        sys.exit(0)
+
     print("")
     print("rootIndices:")
 
@@ -41,3 +76,9 @@ with open(sys.argv[-1], "rb") as f:
     print("responses:")
 
     print(np.frombuffer(f.read(nLeaves * 4), dtype=np.float32))
+
+    if begin == magic and flags & 2:
+        print("")
+        print("categorySets:")
+
+        print(np.frombuffer(f.read(read_int(f) * 4), dtype=np.uint32))
@@ -2,9 +2,21 @@
 #include <boost/test/unit_test.hpp>
 
 #include "fastforest.h"
+#include "fastforest_handle.h"
+#include "fastforest_c.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <fstream>
+#include <sstream>
+#include <iterator>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <utility>
 
 constexpr fastforest::FeatureType tolerance = 1e-4;
 constexpr std::size_t nSamples = 100;
@@ -94,6 +106,58 @@ BOOST_AUTO_TEST_CASE(SoftmaxNSamples100NFeatures100Test) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(GroupClassesTest) {
+    std::vector<std::string> features;
+    for (std::size_t i = 0; i < 100; ++i) {
+        features.emplace_back(std::string("f") + std::to_string(i));
+    }
+
+    const auto fastForest = fastforest::load_txt("softmax_n_samples_100_n_features_100/model.txt", features);
+    auto grouped = fastForest;
+    grouped.group_classes(3);
+
+    // the nodes of each class should form a contiguous range
+    const int nTrees = grouped.rootIndices_.size();
+    int previousMax = -1;
+    for (int iClass = 0; iClass < 3; ++iClass) {
+        int classMin = grouped.cutValues_.size();
+        int classMax = -1;
+        for (int iTree = iClass; iTree < nTrees; iTree += 3) {
+            if (grouped.rootIndices_[iTree] >= 0) {
+                classMin = std::min(classMin, grouped.rootIndices_[iTree]);
+                classMax = std::max(classMax, grouped.rootIndices_[iTree]);
+            }
+        }
+        BOOST_CHECK_GT(classMin, previousMax);
+        previousMax = classMax;
+    }
+
+    std::ifstream fileX("softmax_n_samples_100_n_features_100/X.csv");
+
+    std::vector<fastforest::FeatureType> inputs(features.size() * nSamples);
+    for (auto& x : inputs) {
+        fileX >> x;
+    }
+
+    // two rows evaluated with more threads than rows, which parallelizes over the classes
+    std::vector<fastforest::TreeEnsembleResponseType> out(3 * 2);
+    grouped.evaluate_batch(inputs.data(), 2, features.size(), out.data(), 3, 0.5, 3);
+
+    for (std::size_t i = 0; i < nSamples; ++i) {
+        auto ref = fastForest.softmax<3>(inputs.data() + features.size() * i);
+        auto probas = grouped.softmax<3>(inputs.data() + features.size() * i);
+        if (i < 2) {
+            fastforest::details::softmaxTransformInplace(out.data() + 3 * i, 3);
+        }
+        for (int iClass = 0; iClass < 3; ++iClass) {
+            BOOST_CHECK_EQUAL(probas[iClass], ref[iClass]);
+            if (i < 2) {
+                BOOST_CHECK_EQUAL(out[3 * i + iClass], ref[iClass]);
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(SoftmaxArrayTest) {
     std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
 
@@ -117,6 +181,41 @@ BOOST_AUTO_TEST_CASE(SoftmaxArrayTest) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(TransformTest) {
+    std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
+
+    const auto fastForest = fastforest::load_txt("softmax/model.txt", features);
+
+    std::ifstream fileX("softmax/X.csv");
+    std::ifstream filePreds("softmax/preds.csv");
+
+    std::vector<fastforest::FeatureType> inputs(5 * nSamples);
+    for (auto& x : inputs) {
+        fileX >> x;
+    }
+
+    std::vector<fastforest::TreeEnsembleResponseType> raw(3 * nSamples);
+    fastForest.evaluate_batch(inputs.data(), nSamples, 5, raw.data(), 3);
+
+    auto probas = raw;
+    fastforest::transform_inplace(probas.data(), nSamples, 3, fastforest::Transform::Softmax);
+    auto logistic = raw;
+    fastforest::transform_inplace(logistic.data(), nSamples, 3, fastforest::Transform::Logistic);
+    auto exp = raw;
+    fastforest::transform_inplace(exp.data(), nSamples, 3, fastforest::Transform::Exp);
+    auto tanh = raw;
+    fastforest::transform_inplace(tanh.data(), nSamples, 3, fastforest::Transform::Tanh);
+
+    RefPredictionType ref;
+    for (std::size_t i = 0; i < 3 * nSamples; ++i) {
+        filePreds >> ref;
+        BOOST_CHECK_CLOSE(probas[i], ref, tolerance);
+        BOOST_CHECK_CLOSE(logistic[i], 1. / (1. + std::exp(-raw[i])), tolerance);
+        BOOST_CHECK_CLOSE(exp[i], std::exp(raw[i]), tolerance);
+        BOOST_CHECK_SMALL(tanh[i] - std::tanh(raw[i]), 1e-6f);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(SerializationTest) {
     {
         std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
@@ -144,6 +243,706 @@ BOOST_AUTO_TEST_CASE(SerializationTest) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(CompressedSerializationTest) {
+    for (std::string model : {"continuous", "softmax", "manyfeatures"}) {
+        std::vector<std::string> features;
+        const auto fastForest = fastforest::load_txt(model + "/model.txt", features);
+        fastForest.write_bin(model + "/forest.bin");
+        fastForest.write_bin(model + "/forest_compressed.bin", true);
+
+        std::ifstream plainFile(model + "/forest.bin", std::ios::binary | std::ios::ate);
+        std::ifstream compressedFile(model + "/forest_compressed.bin", std::ios::binary | std::ios::ate);
+        BOOST_CHECK(compressedFile.tellg() < plainFile.tellg());
+
+        // the arrays are restored bitwise
+        const auto loaded = fastforest::load_bin(model + "/forest_compressed.bin");
+        BOOST_CHECK(loaded.rootIndices_ == fastForest.rootIndices_);
+        BOOST_CHECK(loaded.cutIndices_ == fastForest.cutIndices_);
+        BOOST_CHECK(loaded.leftIndices_ == fastForest.leftIndices_);
+        BOOST_CHECK(loaded.rightIndices_ == fastForest.rightIndices_);
+        BOOST_CHECK(std::memcmp(loaded.cutValues_.data(),
+                                fastForest.cutValues_.data(),
+                                fastForest.cutValues_.size() * sizeof(fastforest::FeatureType)) == 0);
+        BOOST_CHECK(std::memcmp(loaded.responses_.data(),
+                                fastForest.responses_.data(),
+                                fastForest.responses_.size() * sizeof(fastforest::TreeResponseType)) == 0);
+        BOOST_CHECK(loaded.metadata().features == features);
+    }
+
+    // long runs of equal bytes, which the codec encodes as overlapping matches
+    {
+        std::vector<std::string> features;
+        auto fastForest = fastforest::load_txt("continuous/model.txt", features);
+        for (std::size_t i = 0; i < fastForest.responses_.size(); ++i) {
+            fastForest.responses_[i] = i % 1000 < 900 ? 0.5f : static_cast<float>(i);
+        }
+        fastForest.write_bin("continuous/forest_compressed.bin", true);
+        const auto loaded = fastforest::load_bin("continuous/forest_compressed.bin");
+        BOOST_CHECK(loaded.responses_ == fastForest.responses_);
+    }
+
+    // corruptions in the compressed sections are detected
+    std::ifstream file("continuous/forest_compressed.bin", std::ios::binary);
+    const std::string content{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    for (std::size_t pos = 100; pos < content.size(); pos += content.size() / 7) {
+        std::string corrupted = content;
+        corrupted[pos] ^= 0x10;
+        std::istringstream stream(corrupted);
+        BOOST_CHECK_THROW(fastforest::load_bin(stream), std::runtime_error);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ReorderTest) {
+    std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
+
+    const auto fastForest = fastforest::load_txt("continuous/model.txt", features);
+
+    std::ifstream fileX("continuous/X.csv");
+
+    std::vector<fastforest::FeatureType> inputs(5 * nSamples);
+    for (auto& x : inputs) {
+        fileX >> x;
+    }
+
+    auto reordered = fastForest;
+    reordered.reorder(inputs.data(), nSamples, 5);
+    reordered.write_bin("continuous/forest_reordered.bin");
+    const auto loaded = fastforest::load_bin("continuous/forest_reordered.bin");
+
+    BOOST_CHECK_EQUAL(reordered.cutValues_.size(), fastForest.cutValues_.size());
+    BOOST_CHECK_EQUAL(reordered.responses_.size(), fastForest.responses_.size());
+
+    for (std::size_t i = 0; i < nSamples; ++i) {
+        const fastforest::FeatureType* input = inputs.data() + 5 * i;
+        BOOST_CHECK_EQUAL(reordered(input), fastForest(input));
+        BOOST_CHECK_EQUAL(loaded(input), fastForest(input));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(BatchTest) {
+    std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
+
+    const auto fastForest = fastforest::load_txt("softmax/model.txt", features);
+
+    std::ifstream fileX("softmax/X.csv");
+
+    std::vector<fastforest::FeatureType> inputs(5 * nSamples);
+    for (auto& x : inputs) {
+        fileX >> x;
+    }
+
+    // all resources honor alignments beyond the one of std::max_align_t, for small and large allocations
+    for (auto resource : {fastforest::defaultResource(), fastforest::hugePageResource(), fastforest::numaResource(0)}) {
+        for (std::size_t bytes : {std::size_t{24}, std::size_t{3} << 20}) {
+            void* p = resource->allocate(bytes, 256);
+            BOOST_CHECK_EQUAL(reinterpret_cast<std::uintptr_t>(p) % 256, 0u);
+            std::memset(p, 1, bytes);
+            resource->deallocate(p, bytes, 256);
+        }
+    }
+
+    auto hugePageForest = fastForest;
+    hugePageForest.relocate(fastforest::hugePageResource());
+    const fastforest::NumaForest numaForest(fastForest);
+
+    std::vector<fastforest::TreeEnsembleResponseType> out(3 * nSamples);
+    std::vector<fastforest::TreeEnsembleResponseType> outNuma(3 * nSamples);
+    hugePageForest.evaluate_batch(inputs.data(), nSamples, 5, out.data(), 3, 0.5, 4);
+    numaForest.evaluate_batch(inputs.data(), nSamples, 5, outNuma.data(), 3, 0.5, 4);
+
+    for (std::size_t i = 0; i < nSamples; ++i) {
+        fastforest::details::softmaxTransformInplace(out.data() + 3 * i, 3);
+        fastforest::details::softmaxTransformInplace(outNuma.data() + 3 * i, 3);
+        auto ref = fastForest.softmax<3>(inputs.data() + 5 * i);
+        for (int iClass = 0; iClass < 3; ++iClass) {
+            BOOST_CHECK_EQUAL(out[3 * i + iClass], ref[iClass]);
+            BOOST_CHECK_EQUAL(outNuma[3 * i + iClass], ref[iClass]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(InterleavedBatchTest) {
+    std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
+
+    auto fastForest = fastforest::load_txt("softmax/model.txt", features);
+    // single-leaf trees are handled separately
+    fastForest.rootIndices_[4] = -1;
+
+    std::ifstream fileX("softmax/X.csv");
+    std::vector<fastforest::FeatureType> inputs(5 * nSamples);
+    for (auto& x : inputs) {
+        fileX >> x;
+    }
+
+    std::vector<fastforest::TreeEnsembleResponseType> ref(3 * nSamples);
+    fastForest.evaluate_batch(inputs.data(), nSamples, 5, ref.data(), 3, 0.5);
+
+    for (int nInterleaved : {1, 3, 16, fastforest::FastForest::maxInterleavedRows}) {
+        std::vector<fastforest::TreeEnsembleResponseType> out(3 * nSamples);
+        fastForest.evaluate_batch_interleaved(inputs.data(), nSamples, 5, out.data(), 3, 0.5, 2, nInterleaved);
+        BOOST_CHECK(out == ref);
+    }
+    std::vector<fastforest::TreeEnsembleResponseType> out(3 * nSamples);
+    BOOST_CHECK_THROW(fastForest.evaluate_batch_interleaved(inputs.data(), nSamples, 5, out.data(), 3, 0.5, 1, 0),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(CompleteForestTest) {
+    std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
+
+    auto fastForest = fastforest::load_txt("softmax/model.txt", features);
+    fastforest::Metadata metadata = fastForest.metadata();
+    metadata.nClasses = 3;
+    metadata.objective = "multi:softprob";
+    fastForest.set_metadata(metadata);
+    // single-leaf trees are folded into the constants
+    fastForest.rootIndices_[4] = -1;
+
+    std::ifstream fileX("softmax/X.csv");
+    std::vector<fastforest::FeatureType> inputs(5 * nSamples);
+    for (auto& x : inputs) {
+        fileX >> x;
+    }
+    inputs[0] = std::numeric_limits<float>::quiet_NaN();
+
+    std::vector<fastforest::TreeEnsembleResponseType> ref(3 * nSamples);
+    fastForest.predict_batch(inputs.data(), nSamples, 5, ref.data());
+
+    // all trees padded, and only the shallow ones
+    for (int maxDepth : {10, 4}) {
+        const fastforest::CompleteForest completeForest(fastForest, maxDepth, 1000.);
+        BOOST_CHECK(completeForest.n_padded_trees() > 0);
+        BOOST_CHECK_EQUAL(completeForest.n_fallback_trees() > 0, maxDepth == 4);
+        BOOST_CHECK_EQUAL(completeForest.n_padded_trees() + completeForest.n_fallback_trees(),
+                          fastForest.rootIndices_.size() - 1);
+
+        std::vector<fastforest::TreeEnsembleResponseType> out(3 * nSamples);
+        completeForest.predict_batch(inputs.data(), nSamples, 5, out.data(), 2);
+        // the trees are summed in a different order
+        for (std::size_t i = 0; i < out.size(); ++i) {
+            BOOST_CHECK_SMALL(out[i] - ref[i], 1e-5f);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(InlinedForestTest) {
+    std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
+
+    auto fastForest = fastforest::load_txt("softmax/model.txt", features);
+    fastforest::Metadata metadata = fastForest.metadata();
+    metadata.nClasses = 3;
+    metadata.objective = "multi:softprob";
+    fastForest.set_metadata(metadata);
+    // single-leaf trees are folded into the constants
+    fastForest.rootIndices_[4] = -1;
+
+    std::ifstream fileX("softmax/X.csv");
+    std::vector<fastforest::FeatureType> inputs(5 * nSamples);
+    for (auto& x : inputs) {
+        fileX >> x;
+    }
+    inputs[0] = std::numeric_limits<float>::quiet_NaN();
+
+    std::vector<fastforest::TreeEnsembleResponseType> ref(3 * nSamples);
+    fastForest.predict_batch(inputs.data(), nSamples, 5, ref.data());
+
+    // also with leaves that are shared between several parents
+    auto simplified = fastForest;
+    simplified.simplify(3);
+    for (auto const* forest : {&fastForest, &simplified}) {
+        const fastforest::InlinedForest inlinedForest(*forest);
+        std::vector<fastforest::TreeEnsembleResponseType> out(3 * nSamples);
+        inlinedForest.predict_batch(inputs.data(), nSamples, 5, out.data(), 2);
+        for (std::size_t i = 0; i < out.size(); ++i) {
+            BOOST_CHECK_SMALL(out[i] - ref[i], 1e-5f);
+        }
+    }
+
+    fastForest.cutIndices_[0] = fastforest::InlinedForest::rightLeafFlag;
+    BOOST_CHECK_THROW(fastforest::InlinedForest{fastForest}, std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(DeltaEvaluatorTest) {
+    std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
+
+    auto fastForest = fastforest::load_txt("softmax/model.txt", features);
+    fastforest::Metadata metadata = fastForest.metadata();
+    metadata.nClasses = 3;
+    metadata.objective = "multi:softprob";
+    fastForest.set_metadata(metadata);
+
+    std::ifstream fileX("softmax/X.csv");
+    std::vector<fastforest::FeatureType> inputs(5 * nSamples);
+    for (auto& x : inputs) {
+        fileX >> x;
+    }
+
+    fastforest::DeltaEvaluator deltaEvaluator(fastForest);
+    int nUsing = 0;
+    for (int feature = 0; feature < 5; ++feature) {
+        nUsing += deltaEvaluator.n_trees_using(feature);
+    }
+    BOOST_CHECK_GE(nUsing, int(fastForest.rootIndices_.size()));
+    BOOST_CHECK_EQUAL(deltaEvaluator.n_trees_using(5), 0);
+
+    std::vector<fastforest::FeatureType> row(5);
+    fastforest::TreeEnsembleResponseType out[3];
+    fastforest::TreeEnsembleResponseType ref[3];
+    for (int i = 0; i < 100; ++i) {
+        const fastforest::FeatureType* nominal = inputs.data() + 5 * i;
+        deltaEvaluator.set_row(nominal, 5);
+        deltaEvaluator.predict(out);
+        fastForest.predict(nominal, ref);
+        for (int iClass = 0; iClass < 3; ++iClass) {
+            BOOST_CHECK_SMALL(out[iClass] - ref[iClass], 1e-5f);
+        }
+
+        // shift one feature, then two, then go back to the nominal row
+        std::copy(nominal, nominal + 5, row.begin());
+        row[1] *= 1.1f;
+        deltaEvaluator.update(1, row[1]);
+        deltaEvaluator.predict(out);
+        fastForest.predict(row.data(), ref);
+        for (int iClass = 0; iClass < 3; ++iClass) {
+            BOOST_CHECK_SMALL(out[iClass] - ref[iClass], 1e-5f);
+        }
+
+        const int changed[2] = {1, 3};
+        row[1] = nominal[1] - 0.5f;
+        row[3] = std::numeric_limits<float>::quiet_NaN();
+        const fastforest::FeatureType values[2] = {row[1], row[3]};
+        deltaEvaluator.update(changed, values, 2);
+        deltaEvaluator.evaluate(out);
+        fastForest.softmax(row.data(), ref, 3, metadata.baseResponse);
+        fastforest::transform_inplace(out, 1, 3, fastforest::Transform::Softmax);
+        for (int iClass = 0; iClass < 3; ++iClass) {
+            BOOST_CHECK_SMALL(out[iClass] - ref[iClass], 1e-5f);
+        }
+
+        const fastforest::FeatureType nominalValues[2] = {nominal[1], nominal[3]};
+        deltaEvaluator.update(changed, nominalValues, 2);
+        deltaEvaluator.predict(out);
+        fastForest.predict(nominal, ref);
+        for (int iClass = 0; iClass < 3; ++iClass) {
+            BOOST_CHECK_SMALL(out[iClass] - ref[iClass], 1e-5f);
+        }
+    }
+    // the trees that cut on both features are only walked once per update
+    const int n1 = deltaEvaluator.n_trees_using(1);
+    const int n3 = deltaEvaluator.n_trees_using(3);
+    BOOST_CHECK_LT(deltaEvaluator.n_updated_trees(), n1 + 2 * (n1 + n3));
+
+    BOOST_CHECK_THROW(deltaEvaluator.update(5, 0.f), std::runtime_error);
+    BOOST_CHECK_THROW(deltaEvaluator.set_row(inputs.data(), 2), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(AutotuneTest) {
+    std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
+
+    auto fastForest = fastforest::load_txt("softmax/model.txt", features);
+    fastforest::Metadata metadata = fastForest.metadata();
+    metadata.nClasses = 3;
+    metadata.objective = "multi:softprob";
+    fastForest.set_metadata(metadata);
+
+    std::ifstream fileX("softmax/X.csv");
+    std::vector<fastforest::FeatureType> inputs(5 * nSamples);
+    for (auto& x : inputs) {
+        fileX >> x;
+    }
+    std::vector<fastforest::TreeEnsembleResponseType> ref(3 * nSamples);
+    fastForest.predict_batch(inputs.data(), nSamples, 5, ref.data());
+
+    // every engine gives the same predictions
+    fastforest::TunedForest tuned{fastForest};
+    for (auto engine : {fastforest::Engine::Batch,
+                        fastforest::Engine::Interleaved,
+                        fastforest::Engine::Complete,
+                        fastforest::Engine::Inlined,
+                        fastforest::Engine::Partitioned}) {
+        tuned.set_engine(engine, 8);
+        std::vector<fastforest::TreeEnsembleResponseType> out(3 * nSamples);
+        tuned.predict_batch(inputs.data(), nSamples, 5, out.data(), 2);
+        for (std::size_t i = 0; i < out.size(); ++i) {
+            BOOST_CHECK_SMALL(out[i] - ref[i], 1e-5f);
+        }
+    }
+    BOOST_CHECK_THROW(tuned.set_engine(fastforest::Engine::Interleaved, 0), std::runtime_error);
+
+    // the decision is cached next to the model, on the synthesized rows and on the sample rows
+    std::remove("softmax/model.txt.autotune");
+    fastforest::AutotuneOptions options;
+    options.nRows = 256;
+    options.nRepetitions = 2;
+    options.modelPath = "softmax/model.txt";
+    std::vector<fastforest::EngineTiming> timings;
+    const auto first = fastforest::autotune(fastForest, options, &timings);
+    BOOST_CHECK_EQUAL(timings.size(), 8);
+    for (auto const& timing : timings) {
+        BOOST_CHECK(timing.nsPerRow > 0.);
+    }
+    const auto cached = fastforest::autotune(fastForest, options, &timings);
+    BOOST_CHECK(timings.empty());
+    BOOST_CHECK(cached.engine() == first.engine());
+    BOOST_CHECK_EQUAL(cached.n_interleaved(), first.n_interleaved());
+
+    options.rows = inputs.data();
+    options.nRows = nSamples;
+    options.nThreads = 2;
+    const auto sampled = fastforest::autotune(fastForest, options, &timings);
+    BOOST_CHECK_EQUAL(timings.size(), 8);
+    std::ifstream cache("softmax/model.txt.autotune");
+    const std::string content{std::istreambuf_iterator<char>(cache), std::istreambuf_iterator<char>()};
+    BOOST_CHECK_EQUAL(std::count(content.begin(), content.end(), '\n'), 2);
+    BOOST_CHECK(content.find(fastforest::engineName(sampled.engine())) != std::string::npos);
+
+    // threads that tune at the same time write their own temporary files, so the cache is complete afterwards
+    std::remove("softmax/model.txt.autotune");
+    options.nThreads = 1;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&]() { fastforest::autotune(fastForest, options); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::ifstream concurrentCache("softmax/model.txt.autotune");
+    std::string line;
+    int nLines = 0;
+    while (std::getline(concurrentCache, line)) {
+        // the CPU, model hash and number of threads of the key, the engine and the number of interleaved rows
+        BOOST_CHECK_EQUAL(std::count(line.begin(), line.end(), '\t'), 4);
+        ++nLines;
+    }
+    BOOST_CHECK_EQUAL(nLines, 1);
+}
+
+// resource that counts the allocations it forwards to the default resource
+class CountingResource : public fastforest::MemoryResource {
+  public:
+    int nAllocations = 0;
+
+  private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        ++nAllocations;
+        return fastforest::defaultResource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+        fastforest::defaultResource()->deallocate(p, bytes, alignment);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(ArenaTest) {
+    {
+        std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
+        const auto fastForest = fastforest::load_txt("softmax/model.txt", features);
+        fastForest.write_bin("softmax/forest.bin");
+    }
+
+    CountingResource upstream;
+    fastforest::MonotonicResource arena{1024, &upstream};
+
+    // the first load grows the arena, after that reloading needs no more memory from upstream
+    fastforest::load_bin("softmax/forest.bin", &arena);
+    arena.release();
+    const int nAllocations = upstream.nAllocations;
+    for (int i = 0; i < 3; ++i) {
+        arena.release();
+        fastforest::load_bin("softmax/forest.bin", &arena);
+    }
+    BOOST_CHECK_EQUAL(upstream.nAllocations, nAllocations);
+
+    std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
+    arena.release();
+    const auto fastForest = fastforest::load_txt("softmax/model.txt", features, &arena);
+
+    std::ifstream fileX("softmax/X.csv");
+    std::ifstream filePreds("softmax/preds.csv");
+
+    std::vector<fastforest::FeatureType> input(5);
+    RefPredictionType ref;
+
+    for (std::size_t i = 0; i < nSamples; ++i) {
+        for (auto& x : input) {
+            fileX >> x;
+        }
+        for (auto& x : fastForest.softmax(input.data(), 3, &arena)) {
+            filePreds >> ref;
+            BOOST_CHECK_CLOSE(x, ref, tolerance);
+        }
+    }
+    BOOST_CHECK_EQUAL(fastForest.cutValues_.capacity(), fastForest.cutValues_.size());
+    BOOST_CHECK_EQUAL(fastForest.responses_.capacity(), fastForest.responses_.size());
+}
+
+BOOST_AUTO_TEST_CASE(SimplifyTest) {
+    // The model twice, so every subtree appears twice, together with constant trees and a useless split.
+    std::ifstream modelFile("continuous/model.txt");
+    std::string model{std::istreambuf_iterator<char>(modelFile), std::istreambuf_iterator<char>()};
+    model += model;
+    model += "booster[200]:\n0:leaf=0.25\nbooster[201]:\n0:[f1<0.5] yes=1,no=2,missing=1\n\t1:leaf=-0.125\n"
+             "\t2:leaf=-0.125\nbooster[202]:\n0:leaf=0.5\n";
+    std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
+    std::istringstream modelStream{model};
+    const auto fastForest = fastforest::load_txt(modelStream, features);
+
+    auto simplified = fastForest;
+    const auto report = simplified.simplify(1);
+    BOOST_CHECK_EQUAL(report.nTreesBefore, 203);
+    BOOST_CHECK_EQUAL(report.nTreesAfter, 201);
+    BOOST_CHECK_EQUAL(report.nNodesAfter, simplified.cutValues_.size());
+    BOOST_CHECK(2 * report.nNodesAfter <= report.nNodesBefore);
+    BOOST_CHECK(report.bytesAfter < report.bytesBefore);
+
+    // the shared subtrees survive serialization
+    simplified.write_bin("continuous/forest_simplified.bin");
+    const auto loaded = fastforest::load_bin("continuous/forest_simplified.bin");
+
+    std::ifstream fileX("continuous/X.csv");
+    std::vector<fastforest::FeatureType> input(5);
+    for (std::size_t i = 0; i < nSamples; ++i) {
+        for (auto& x : input) {
+            fileX >> x;
+        }
+        BOOST_CHECK_CLOSE(simplified(input.data()), fastForest(input.data()), tolerance);
+        BOOST_CHECK_EQUAL(loaded(input.data()), simplified(input.data()));
+    }
+
+    // A softmax model with a round of constant trees and a round where the class 0 tree is constant and the class 2
+    // tree has a useless split. The constants are folded per class.
+    std::ifstream softmaxFile("softmax/model.txt");
+    std::string softmaxModel{std::istreambuf_iterator<char>(softmaxFile), std::istreambuf_iterator<char>()};
+    softmaxModel += "booster[300]:\n0:leaf=0.25\nbooster[301]:\n0:leaf=-0.5\nbooster[302]:\n0:leaf=1\n"
+                    "booster[303]:\n0:leaf=0.125\nbooster[304]:\n0:[f1<0.5] yes=1,no=2,missing=1\n\t1:leaf=0.5\n"
+                    "\t2:leaf=-0.25\nbooster[305]:\n0:[f2<0.5] yes=1,no=2,missing=1\n\t1:leaf=-0.75\n\t2:leaf=-0.75\n";
+    std::istringstream softmaxStream{softmaxModel};
+    const auto softmaxForest = fastforest::load_txt(softmaxStream, features);
+
+    auto simplifiedSoftmax = softmaxForest;
+    const auto softmaxReport = simplifiedSoftmax.simplify(3);
+    BOOST_CHECK_EQUAL(softmaxReport.nTreesBefore, 306);
+    // class 1 keeps its extra tree next to its constant tree, so the other classes are padded to as many trees
+    BOOST_CHECK_EQUAL(softmaxReport.nTreesAfter, 306);
+    BOOST_CHECK_EQUAL(simplifiedSoftmax.metadata().nClasses, 3);
+    BOOST_CHECK_THROW(simplifiedSoftmax.simplify(4), std::runtime_error);
+
+    std::ifstream softmaxX("softmax/X.csv");
+    for (std::size_t i = 0; i < nSamples; ++i) {
+        for (auto& x : input) {
+            softmaxX >> x;
+        }
+        const auto ref = softmaxForest.softmax<3>(input.data());
+        const auto out = simplifiedSoftmax.softmax<3>(input.data());
+        for (int iClass = 0; iClass < 3; ++iClass) {
+            BOOST_CHECK_CLOSE(out[iClass], ref[iClass], tolerance);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ModelHandleTest) {
+    std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
+    const auto forestA = fastforest::load_txt("continuous/model.txt", features);
+    // a second version of the model with different responses
+    auto forestB = forestA;
+    for (auto& response : forestB.responses_) {
+        response = -response;
+    }
+    forestB.write_bin("continuous/forest_b.bin");
+
+    std::ifstream fileX("continuous/X.csv");
+    std::vector<fastforest::FeatureType> input(5);
+    for (auto& x : input) {
+        fileX >> x;
+    }
+    const auto scoreA = forestA(input.data());
+    const auto scoreB = forestB(input.data());
+
+    fastforest::ModelHandle handle{forestA};
+    std::atomic<bool> stop{false};
+    std::atomic<long> nWrong{0};
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&]() {
+            while (!stop) {
+                auto forest = handle.acquire();
+                const auto score = (*forest)(input.data());
+                nWrong += score != scoreA && score != scoreB;
+            }
+        });
+    }
+
+    auto reload = handle.reload_bin("continuous/forest_b.bin");
+    reload.get();
+    BOOST_CHECK_EQUAL(handle.version(), 1);
+    BOOST_CHECK_EQUAL((*handle.acquire())(input.data()), scoreB);
+
+    // a failed reload keeps the current version
+    reload = handle.reload_bin("continuous/does_not_exist.bin");
+    BOOST_CHECK_THROW(reload.get(), std::runtime_error);
+    BOOST_CHECK_EQUAL(handle.version(), 1);
+
+    for (int i = 0; i < 20; ++i) {
+        handle.publish(i % 2 ? forestB : forestA);
+    }
+    stop = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    BOOST_CHECK_EQUAL(nWrong, 0);
+    BOOST_CHECK_EQUAL(handle.version(), 21);
+}
+
+BOOST_AUTO_TEST_CASE(CInterfaceTest) {
+    const char* features[] = {"f0", "f1", "f2", "f3", "f4"};
+    fastforest_t* forest = fastforest_load_txt("continuous/model.txt", features, 5);
+    BOOST_REQUIRE(forest);
+    BOOST_CHECK_EQUAL(fastforest_n_outputs(forest), 1);
+    BOOST_CHECK_EQUAL(fastforest_min_features(forest), 5);
+    BOOST_CHECK_EQUAL(fastforest_feature_name(forest, 4), std::string{"f4"});
+
+    std::ifstream fileX("continuous/X.csv");
+    std::ifstream filePreds("continuous/preds.csv");
+    // row-major, column-major and with the columns embedded in a wider matrix
+    std::vector<float> rowMajor(nSamples * 5);
+    std::vector<float> columnMajor(nSamples * 5);
+    std::vector<float> wide(nSamples * 8);
+    for (std::size_t i = 0; i < nSamples; ++i) {
+        for (std::size_t j = 0; j < 5; ++j) {
+            fileX >> rowMajor[i * 5 + j];
+            columnMajor[j * nSamples + i] = rowMajor[i * 5 + j];
+            wide[i * 8 + j + 2] = rowMajor[i * 5 + j];
+        }
+    }
+    std::vector<float> outRowMajor(nSamples);
+    std::vector<float> outColumnMajor(nSamples);
+    std::vector<float> outWide(nSamples);
+    BOOST_CHECK_EQUAL(fastforest_predict(forest, rowMajor.data(), nSamples, 5, 5, 1, outRowMajor.data(), 2), 0);
+    BOOST_CHECK_EQUAL(
+        fastforest_predict(forest, columnMajor.data(), nSamples, 5, 1, nSamples, outColumnMajor.data(), 2), 0);
+    BOOST_CHECK_EQUAL(fastforest_predict(forest, wide.data() + 2, nSamples, 5, 8, 1, outWide.data(), 1), 0);
+    for (std::size_t i = 0; i < nSamples; ++i) {
+        RefPredictionType ref;
+        filePreds >> ref;
+        BOOST_CHECK_CLOSE(outRowMajor[i], ref, tolerance);
+        BOOST_CHECK_EQUAL(outColumnMajor[i], outRowMajor[i]);
+        BOOST_CHECK_EQUAL(outWide[i], outRowMajor[i]);
+    }
+
+    // errors are reported through the return value and the error message
+    BOOST_CHECK_EQUAL(fastforest_predict(forest, rowMajor.data(), nSamples, 3, 3, 1, outRowMajor.data(), 1), -1);
+    BOOST_CHECK(std::string{fastforest_last_error()}.find("at least 5 features") != std::string::npos);
+    BOOST_CHECK_EQUAL(fastforest_set_metadata(forest, 1, 0.5, "binary:logistic"), 0);
+    BOOST_CHECK_EQUAL(fastforest_objective(forest), std::string{"binary:logistic"});
+    BOOST_CHECK(!fastforest_load_bin("continuous/does_not_exist.bin"));
+    BOOST_CHECK(std::strlen(fastforest_last_error()) > 0);
+
+    fastforest_free(forest);
+}
+
+// stream buffer that can't seek, like the ones of pipes
+class UnseekableBuffer : public std::stringbuf {
+  public:
+    explicit UnseekableBuffer(std::string const& content) : std::stringbuf{content} {}
+
+  private:
+    pos_type seekoff(off_type, std::ios_base::seekdir, std::ios_base::openmode) override { return pos_type(-1); }
+    pos_type seekpos(pos_type, std::ios_base::openmode) override { return pos_type(-1); }
+};
+
+BOOST_AUTO_TEST_CASE(MetadataTest) {
+    {
+        std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
+        auto fastForest = fastforest::load_txt("softmax/model.txt", features);
+        BOOST_CHECK(fastForest.metadata().features == features);
+
+        fastforest::Metadata metadata = fastForest.metadata();
+        metadata.nClasses = 3;
+        metadata.objective = "multi:softprob";
+        fastForest.set_metadata(metadata);
+        fastForest.write_bin("softmax/forest.bin");
+
+        metadata.nClasses = 7;
+        BOOST_CHECK_THROW(fastForest.set_metadata(metadata), std::runtime_error);
+        metadata.nClasses = 3;
+        metadata.objective = "unknown:objective";
+        BOOST_CHECK_THROW(fastForest.set_metadata(metadata), std::runtime_error);
+    }
+
+    const auto fastForest = fastforest::load_bin("softmax/forest.bin");
+    BOOST_CHECK_EQUAL(fastForest.metadata().nClasses, 3);
+    BOOST_CHECK_EQUAL(fastForest.metadata().objective, "multi:softprob");
+    BOOST_CHECK_EQUAL(fastForest.metadata().features.size(), 5);
+
+    std::ifstream fileX("softmax/X.csv");
+    std::ifstream filePreds("softmax/preds.csv");
+
+    std::vector<fastforest::FeatureType> input(5);
+    std::array<fastforest::TreeEnsembleResponseType, 3> out;
+    RefPredictionType ref;
+
+    for (std::size_t i = 0; i < nSamples; ++i) {
+        for (auto& x : input) {
+            fileX >> x;
+        }
+        fastForest.predict(input.data(), out.data());
+        for (auto& x : out) {
+            filePreds >> ref;
+            BOOST_CHECK_CLOSE(x, ref, tolerance);
+        }
+    }
+
+    // a single flipped bit should be detected by the checksum
+    std::ifstream binFile("softmax/forest.bin", std::ios::binary);
+    std::string content{std::istreambuf_iterator<char>(binFile), std::istreambuf_iterator<char>()};
+    const std::string original = content;
+    content[content.size() / 2] ^= 1;
+    std::istringstream corrupted(content);
+    BOOST_CHECK_THROW(fastforest::load_bin(corrupted), std::runtime_error);
+
+    // other format versions and huge string lengths in the header are rejected before anything is allocated, the
+    // messages tell them apart from a checksum mismatch
+    for (std::size_t offset : {std::size_t(4), 24 + sizeof(fastforest::TreeEnsembleResponseType)}) {
+        std::string header = original;
+        for (std::size_t i = 0; i < 4; ++i) {
+            header[offset + i] = offset == 4 ? (i == 0 ? 1 : 0) : '\xff';
+        }
+        std::istringstream stream(header);
+        BOOST_CHECK_EXCEPTION(fastforest::load_bin(stream), std::runtime_error, [](std::runtime_error const& e) {
+            return std::string(e.what()).find("checksum") == std::string::npos;
+        });
+    }
+
+    // Huge array sizes in the header are rejected before the arrays are allocated, in the plain and the compressed
+    // variant, and with inputs that can't tell their size, which are read in chunks.
+    fastForest.write_bin("softmax/forest_compressed.bin", true);
+    std::ifstream compressedFile("softmax/forest_compressed.bin", std::ios::binary);
+    const std::string compressed{std::istreambuf_iterator<char>(compressedFile), std::istreambuf_iterator<char>()};
+    std::size_t countsOffset =
+        24 + sizeof(fastforest::TreeEnsembleResponseType) + 4 + fastForest.metadata().objective.size() + 4;
+    for (auto const& feature : fastForest.metadata().features) {
+        countsOffset += 4 + feature.size();
+    }
+    for (std::string const* file : {&original, &compressed}) {
+        UnseekableBuffer unseekable{*file};
+        std::istream unseekableStream{&unseekable};
+        const auto loaded = fastforest::load_bin(unseekableStream);
+        BOOST_CHECK(loaded.cutValues_ == fastForest.cutValues_);
+
+        for (std::size_t offset = countsOffset; offset < countsOffset + 12; offset += 4) {
+            std::string corrupted = *file;
+            const int hugeSize = std::numeric_limits<int>::max();
+            std::memcpy(&corrupted[offset], &hugeSize, sizeof(int));
+            std::istringstream stream(corrupted);
+            BOOST_CHECK_EXCEPTION(fastforest::load_bin(stream), std::runtime_error, [](std::runtime_error const& e) {
+                return std::string(e.what()).find("out of range") != std::string::npos;
+            });
+            UnseekableBuffer corruptedBuffer{corrupted};
+            std::istream corruptedStream{&corruptedBuffer};
+            BOOST_CHECK_THROW(fastforest::load_bin(corruptedStream), std::runtime_error);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(DiscreteTest) {
     std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
 
@@ -167,6 +966,68 @@ BOOST_AUTO_TEST_CASE(DiscreteTest) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(CachedForestTest) {
+    std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
+
+    auto fastForest = fastforest::load_txt("discrete/model.txt", features);
+    fastforest::Metadata metadata = fastForest.metadata();
+    metadata.objective = "binary:logistic";
+    fastForest.set_metadata(metadata);
+
+    std::ifstream fileX("discrete/X.csv");
+    std::vector<fastforest::FeatureType> inputs(5 * nSamples);
+    for (auto& x : inputs) {
+        fileX >> x;
+    }
+    // a row that is repeated within the batch
+    std::copy(inputs.begin(), inputs.begin() + 5, inputs.begin() + 5 * (nSamples - 1));
+    std::vector<fastforest::TreeEnsembleResponseType> ref(nSamples);
+    fastForest.predict_batch(inputs.data(), nSamples, 5, ref.data());
+
+    for (bool binned : {false, true}) {
+        fastforest::CacheOptions options;
+        options.binned = binned;
+        const fastforest::CachedForest cachedForest(fastForest, options);
+        std::vector<fastforest::TreeEnsembleResponseType> out(nSamples);
+        for (int pass = 0; pass < 2; ++pass) {
+            cachedForest.predict_batch(inputs.data(), nSamples, 5, out.data(), 2);
+            for (std::size_t i = 0; i < nSamples; ++i) {
+                BOOST_CHECK_EQUAL(out[i], ref[i]);
+            }
+        }
+        for (std::size_t i = 0; i < 10; ++i) {
+            fastforest::TreeEnsembleResponseType score;
+            cachedForest.predict(inputs.data() + 5 * i, &score);
+            BOOST_CHECK_EQUAL(score, ref[i]);
+        }
+        const auto statistics = cachedForest.statistics();
+        BOOST_CHECK_EQUAL(statistics.hits + statistics.misses, 2 * nSamples + 10);
+        // two threads can miss the same row at the same time, which then gets only one entry
+        BOOST_CHECK_LE(statistics.entries, statistics.misses);
+        BOOST_CHECK_GE(statistics.hits, nSamples + 10);
+        BOOST_CHECK_EQUAL(statistics.evictions, 0u);
+    }
+
+    // a cache that only fits a few entries evicts the older ones, but still gives the same responses
+    fastforest::CacheOptions options;
+    options.maxBytes = 4096;
+    options.nShards = 2;
+    fastforest::CachedForest cachedForest(fastForest, options);
+    std::vector<fastforest::TreeEnsembleResponseType> out(nSamples);
+    cachedForest.predict_batch(inputs.data(), nSamples, 5, out.data());
+    for (std::size_t i = 0; i < nSamples; ++i) {
+        BOOST_CHECK_EQUAL(out[i], ref[i]);
+    }
+    auto statistics = cachedForest.statistics();
+    BOOST_CHECK_GT(statistics.evictions, 0u);
+    BOOST_CHECK_LE(statistics.bytes, options.maxBytes);
+    BOOST_CHECK_EQUAL(statistics.entries, statistics.misses - statistics.evictions);
+
+    cachedForest.clear();
+    BOOST_CHECK_EQUAL(cachedForest.statistics().entries, 0u);
+    BOOST_CHECK_THROW(cachedForest.predict_batch(inputs.data(), nSamples, 2, out.data()), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_CASE(ManyfeaturesTest) {
     std::vector<std::string> features{};
     for (int i = 0; i < 311; ++i) {
@@ -193,6 +1054,520 @@ BOOST_AUTO_TEST_CASE(ManyfeaturesTest) {
     }
 }
 
+namespace {
+
+    // A LightGBM model with one tree of two splits and a single-leaf tree. The first split sends missing values to
+    // the default direction of zero, the second one has default-left NaN handling.
+    const std::string lightgbmModel =
+        "tree\nversion=v3\nnum_class=1\nnum_tree_per_iteration=1\nlabel_index=0\nmax_feature_idx=1\n"
+        "objective=binary sigmoid:1\nfeature_names=a b\nfeature_infos=[-5:5] [-5:5]\ntree_sizes=300 200\n\n"
+        "Tree=0\nnum_leaves=3\nnum_cat=0\nsplit_feature=0 1\nsplit_gain=1 1\nthreshold=0.10000000000000001 -1.5\n"
+        "decision_type=2 10\nleft_child=1 -1\nright_child=-2 -3\nleaf_value=0.5 -0.25 0.75\nleaf_weight=1 1 1\n"
+        "leaf_count=1 1 1\ninternal_value=0 0\ninternal_weight=0 0\ninternal_count=3 2\nis_linear=0\nshrinkage=1\n\n\n"
+        "Tree=1\nnum_leaves=1\nnum_cat=0\nsplit_feature=\nsplit_gain=\nthreshold=\ndecision_type=\nleft_child=\n"
+        "right_child=\nleaf_value=0.125\nleaf_weight=\nleaf_count=\ninternal_value=\ninternal_weight=\n"
+        "internal_count=\nis_linear=0\nshrinkage=1\n\n\nend of trees\n\nfeature_importances:\na=1\nb=1\n\n"
+        "parameters:\n[boosting: gbdt]\nend of parameters\n\npandas_categorical:null\n";
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(LightGBMTest) {
+    std::vector<std::string> features;
+    std::istringstream model{lightgbmModel};
+    const auto fastForest = fastforest::load_lightgbm_txt(model, features);
+    BOOST_CHECK((features == std::vector<std::string>{"a", "b"}));
+    BOOST_CHECK_EQUAL(fastForest.metadata().objective, "binary:logistic");
+
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const std::vector<std::array<float, 2>> inputs{{{0.1f, 0.f}},
+                                                   {{std::nextafter(0.1f, 0.f), -1.5f}},
+                                                   {{-2.f, std::nextafter(-1.5f, 0.f)}},
+                                                   {{0.f, nan}},
+                                                   {{nan, 3.f}}};
+    for (auto const& x : inputs) {
+        // LightGBM compares in double precision and replaces missing values by zero for the missing type none
+        double a = std::isnan(x[0]) ? 0. : x[0];
+        double raw = (a <= 0.1 ? (std::isnan(x[1]) || x[1] <= -1.5 ? 0.5 : 0.75) : -0.25) + 0.125;
+
+        fastforest::TreeEnsembleResponseType prediction;
+        fastForest.predict(x.data(), &prediction);
+        BOOST_CHECK_CLOSE(prediction, 1. / (1. + std::exp(-raw)), tolerance);
+    }
+
+    // the features are remapped if they are given in a different order
+    std::vector<std::string> reversed{"b", "a"};
+    model.clear();
+    model.seekg(0);
+    const auto reversedForest = fastforest::load_lightgbm_txt(model, reversed);
+    for (auto const& x : inputs) {
+        std::array<float, 2> reversedInput{{x[1], x[0]}};
+        BOOST_CHECK_EQUAL(fastForest(x.data()), reversedForest(reversedInput.data()));
+    }
+
+    // categorical splits are rejected
+    std::string categorical = lightgbmModel;
+    categorical.replace(categorical.find("decision_type=2 10"), 18, "decision_type=1 10");
+    std::istringstream categoricalModel{categorical};
+    BOOST_CHECK_THROW(fastforest::load_lightgbm_txt(categoricalModel, features), std::runtime_error);
+
+    // Splits where LightGBM sends NaN to the right are loaded, but NaN goes left like for the other loaders:
+    // default-right NaN handling, a negative threshold where NaN is replaced by zero, and a default-right split
+    // treating zero as missing value.
+    struct NanRightCase {
+        const char* from;
+        const char* to;
+        std::array<float, 2> x;
+        double leaf;
+    };
+    for (auto const& c : {NanRightCase{"decision_type=2 10", "decision_type=2 8", {{0.f, nan}}, 0.5},
+                          NanRightCase{"threshold=0.1", "threshold=-0.1", {{nan, 3.f}}, 0.75},
+                          NanRightCase{"threshold=0.10000000000000001 -1.5\ndecision_type=2",
+                                       "threshold=-0.10000000000000001 -1.5\ndecision_type=4",
+                                       {{nan, 3.f}},
+                                       0.75}}) {
+        std::string nanRight = lightgbmModel;
+        nanRight.replace(nanRight.find(c.from), std::strlen(c.from), c.to);
+        std::istringstream nanRightModel{nanRight};
+        const auto nanRightForest = fastforest::load_lightgbm_txt(nanRightModel, features);
+        fastforest::TreeEnsembleResponseType prediction;
+        nanRightForest.predict(c.x.data(), &prediction);
+        BOOST_CHECK_CLOSE(prediction, 1. / (1. + std::exp(-(c.leaf + 0.125))), tolerance);
+    }
+
+    // A model with three classes, where each class has one split tree and one single-leaf tree in a different order.
+    // The loader groups the nodes of each class.
+    const std::size_t splitTree = lightgbmModel.find("Tree=0");
+    const std::size_t leafTree = lightgbmModel.find("Tree=1");
+    const std::string splitBody = lightgbmModel.substr(splitTree + 6, leafTree - splitTree - 6);
+    const std::size_t end = lightgbmModel.find("end of trees");
+    const std::string leafBody = lightgbmModel.substr(leafTree + 6, end - leafTree - 6);
+    std::string multiclass = lightgbmModel.substr(0, splitTree) + "Tree=0" + splitBody + "Tree=1" + leafBody +
+                             "Tree=2" + splitBody + "Tree=3" + splitBody + "Tree=4" + splitBody + "Tree=5" + leafBody +
+                             lightgbmModel.substr(end);
+    multiclass.replace(multiclass.find("num_tree_per_iteration=1"), 24, "num_tree_per_iteration=3");
+    multiclass.replace(multiclass.find("objective=binary sigmoid:1"), 26, "objective=multiclass num_class:3");
+    std::istringstream multiclassModel{multiclass};
+    const auto multiclassForest = fastforest::load_lightgbm_txt(multiclassModel, features);
+    BOOST_CHECK_EQUAL(multiclassForest.metadata().nClasses, 3);
+    BOOST_CHECK_LT(multiclassForest.rootIndices_[3], multiclassForest.rootIndices_[4]);
+    BOOST_CHECK_LT(multiclassForest.rootIndices_[4], multiclassForest.rootIndices_[2]);
+    for (auto const& x : inputs) {
+        double a = std::isnan(x[0]) ? 0. : x[0];
+        double leaf = a <= 0.1 ? (std::isnan(x[1]) || x[1] <= -1.5 ? 0.5 : 0.75) : -0.25;
+        std::array<fastforest::TreeEnsembleResponseType, 3> probas;
+        multiclassForest.predict(x.data(), probas.data());
+        BOOST_CHECK_CLOSE(probas[0], 1. / (1. + 2. * std::exp(leaf + 0.125 - 2 * leaf)), tolerance);
+    }
+}
+
+namespace {
+
+    // Minimal protobuf encoder to write ONNX models for the tests.
+    namespace proto {
+
+        std::string varint(std::uint64_t value) {
+            std::string out;
+            while (value >= 0x80) {
+                out += static_cast<char>((value & 0x7f) | 0x80);
+                value >>= 7;
+            }
+            return out + static_cast<char>(value);
+        }
+
+        std::string bytes(int field, std::string const& payload) {
+            return varint(field << 3 | 2) + varint(payload.size()) + payload;
+        }
+
+        std::string attribute(std::string const& name, std::string const& s) {
+            return bytes(5, bytes(1, name) + bytes(4, s));
+        }
+
+        std::string attribute(std::string const& name, std::int64_t i) {
+            return bytes(5, bytes(1, name) + varint(3 << 3) + varint(i));
+        }
+
+        std::string attribute(std::string const& name, std::vector<std::int64_t> const& ints) {
+            std::string packed;
+            for (auto i : ints) {
+                packed += varint(i);
+            }
+            return bytes(5, bytes(1, name) + bytes(8, packed));
+        }
+
+        std::string attribute(std::string const& name, std::vector<float> const& floats) {
+            std::string packed(reinterpret_cast<const char*>(floats.data()), 4 * floats.size());
+            return bytes(5, bytes(1, name) + bytes(7, packed));
+        }
+
+        std::string attribute(std::string const& name, std::vector<std::string> const& strings) {
+            std::string out = bytes(1, name);
+            for (auto const& s : strings) {
+                out += bytes(9, s);
+            }
+            return bytes(5, out);
+        }
+
+        std::string model(std::string const& opType, std::string const& attributes) {
+            std::string node = bytes(1, "X") + bytes(2, "Y") + bytes(4, opType) + bytes(7, "ai.onnx.ml") + attributes;
+            return bytes(7, bytes(1, node));
+        }
+
+    }  // namespace proto
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(ONNXClassifierTest) {
+    // A binary classifier with a tree of two splits (f0 <= 1 and f1 < 2) and a tree with one split (f0 >= -1).
+    using Ints = std::vector<std::int64_t>;
+    using Floats = std::vector<float>;
+    using Strings = std::vector<std::string>;
+    std::string attributes =
+        proto::attribute("nodes_treeids", Ints{0, 0, 0, 0, 0, 1, 1, 1}) +
+        proto::attribute("nodes_nodeids", Ints{0, 1, 2, 3, 4, 0, 1, 2}) +
+        proto::attribute("nodes_featureids", Ints{0, 1, 0, 0, 0, 0, 0, 0}) +
+        proto::attribute("nodes_values", Floats{1.f, 2.f, 0.f, 0.f, 0.f, -1.f, 0.f, 0.f}) +
+        proto::attribute("nodes_modes",
+                         Strings{"BRANCH_LEQ", "BRANCH_LT", "LEAF", "LEAF", "LEAF", "BRANCH_GTE", "LEAF", "LEAF"}) +
+        proto::attribute("nodes_truenodeids", Ints{1, 3, 0, 0, 0, 1, 0, 0}) +
+        proto::attribute("nodes_falsenodeids", Ints{2, 4, 0, 0, 0, 2, 0, 0}) +
+        proto::attribute("class_treeids", Ints{0, 0, 0, 1, 1}) +
+        proto::attribute("class_nodeids", Ints{2, 3, 4, 1, 2}) +
+        proto::attribute("class_ids", Ints{0, 0, 0, 0, 0}) +
+        proto::attribute("class_weights", Floats{0.3f, -0.1f, 0.4f, 0.2f, -0.5f}) +
+        proto::attribute("classlabels_int64s", Ints{0, 1}) + proto::attribute("base_values", Floats{0.25f}) +
+        proto::attribute("post_transform", std::string{"LOGISTIC"});
+    std::istringstream model{proto::model("TreeEnsembleClassifier", attributes)};
+
+    const auto fastForest = fastforest::load_onnx(model);
+    BOOST_CHECK_EQUAL(fastForest.metadata().nClasses, 1);
+
+    // the same model with missing value tracking, which doesn't change where missing values go
+    std::istringstream trackingModel{proto::model(
+        "TreeEnsembleClassifier",
+        attributes + proto::attribute("nodes_missing_value_tracks_true", Ints{0, 1, 0, 0, 0, 1, 0, 0}))};
+    const auto trackingForest = fastforest::load_onnx(trackingModel);
+
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const std::vector<std::array<float, 2>> inputs{{{1.f, 2.f}},
+                                                   {{1.f, std::nextafter(2.f, 0.f)}},
+                                                   {{std::nextafter(1.f, 2.f), 0.f}},
+                                                   {{-1.f, 5.f}},
+                                                   {{-2.f, 1.f}},
+                                                   {{nan, 1.f}},
+                                                   {{0.f, nan}}};
+    for (auto const& x : inputs) {
+        // missing values go left, which is the true branch of the <= and < splits and the false branch of >=
+        bool first = std::isnan(x[0]) || x[0] <= 1.f;
+        bool second = std::isnan(x[1]) || x[1] < 2.f;
+        double raw = (first ? (second ? -0.1 : 0.4) : 0.3) + (x[0] >= -1.f ? 0.2 : -0.5) + 0.25;
+
+        fastforest::TreeEnsembleResponseType prediction;
+        fastForest.predict(x.data(), &prediction);
+        BOOST_CHECK_CLOSE(prediction, 1. / (1. + std::exp(-raw)), tolerance);
+        BOOST_CHECK_EQUAL(trackingForest(x.data()), fastForest(x.data()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ONNXRegressorTest) {
+    // A random forest regressor with two targets, one stump on f1 > 0.5 and one single-leaf tree.
+    using Ints = std::vector<std::int64_t>;
+    using Floats = std::vector<float>;
+    using Strings = std::vector<std::string>;
+    std::string attributes =
+        proto::attribute("nodes_treeids", Ints{0, 0, 0, 1}) + proto::attribute("nodes_nodeids", Ints{0, 1, 2, 0}) +
+        proto::attribute("nodes_featureids", Ints{1, 0, 0, 0}) +
+        proto::attribute("nodes_values", Floats{0.5f, 0.f, 0.f, 0.f}) +
+        proto::attribute("nodes_modes", Strings{"BRANCH_GT", "LEAF", "LEAF", "LEAF"}) +
+        proto::attribute("nodes_truenodeids", Ints{1, 0, 0, 0}) +
+        proto::attribute("nodes_falsenodeids", Ints{2, 0, 0, 0}) +
+        proto::attribute("target_treeids", Ints{0, 0, 0, 0, 1, 1}) +
+        proto::attribute("target_nodeids", Ints{1, 1, 2, 2, 0, 0}) +
+        proto::attribute("target_ids", Ints{0, 1, 0, 1, 0, 1}) +
+        proto::attribute("target_weights", Floats{1.f, 2.f, 3.f, 4.f, 10.f, 20.f}) +
+        proto::attribute("aggregate_function", std::string{"AVERAGE"}) +
+        proto::attribute("base_values", Floats{0.5f, -0.5f}) + proto::attribute("post_transform", std::string{"NONE"});
+    std::istringstream model{
+        proto::model("TreeEnsembleRegressor", attributes + proto::attribute("n_targets", std::int64_t{2}))};
+
+    const auto fastForest = fastforest::load_onnx(model);
+    BOOST_CHECK_EQUAL(fastForest.metadata().nClasses, 2);
+
+    for (float x1 : {0.f, 0.5f, std::nextafter(0.5f, 1.f)}) {
+        std::array<float, 2> x{{0.f, x1}};
+        std::array<float, 2> out;
+        fastForest.predict(x.data(), out.data());
+        bool passes = x1 > 0.5f;
+        BOOST_CHECK_CLOSE(out[0], ((passes ? 1. : 3.) + 10.) / 2 + 0.5, tolerance);
+        BOOST_CHECK_CLOSE(out[1], ((passes ? 2. : 4.) + 20.) / 2 - 0.5, tolerance);
+    }
+
+    // a split that is its own child is rejected instead of being followed forever
+    std::istringstream cyclicModel{proto::model(
+        "TreeEnsembleRegressor",
+        proto::attribute("nodes_treeids", Ints{0, 0, 0}) + proto::attribute("nodes_nodeids", Ints{0, 1, 2}) +
+            proto::attribute("nodes_featureids", Ints{1, 1, 0}) +
+            proto::attribute("nodes_values", Floats{0.5f, 0.5f, 0.f}) +
+            proto::attribute("nodes_modes", Strings{"BRANCH_GT", "BRANCH_GT", "LEAF"}) +
+            proto::attribute("nodes_truenodeids", Ints{1, 1, 0}) +
+            proto::attribute("nodes_falsenodeids", Ints{2, 2, 0}) + proto::attribute("target_treeids", Ints{0}) +
+            proto::attribute("target_nodeids", Ints{2}) + proto::attribute("target_ids", Ints{0}) +
+            proto::attribute("target_weights", Floats{1.f}))};
+    BOOST_CHECK_THROW(fastforest::load_onnx(cyclicModel), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(CategoricalTest) {
+    // Two trees with the categorical splits f1 in {1, 3} and f0 in {0, 40}, the values in the set go right.
+    const std::string model =
+        "booster[0]:\n"
+        "0:[f1:{1,3}] yes=2,no=1,missing=1\n"
+        "\t1:[f0<0.5] yes=3,no=4,missing=3\n"
+        "\t\t3:leaf=0.1\n"
+        "\t\t4:leaf=0.2\n"
+        "\t2:leaf=0.4\n"
+        "booster[1]:\n"
+        "0:[f0:{0,40}] yes=2,no=1,missing=1\n"
+        "\t1:leaf=-0.3\n"
+        "\t2:leaf=0.6\n";
+    std::vector<std::string> features{"f0", "f1"};
+    std::istringstream modelStream{model};
+    const auto fastForest = fastforest::load_txt(modelStream, features);
+    BOOST_CHECK(!fastForest.categorySets_.empty());
+
+    auto inSet = [](float x, std::initializer_list<int> set) {
+        return x >= 0.f && x < 64.f && std::find(set.begin(), set.end(), int(x)) != set.end();
+    };
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const std::vector<float> values{0.f, 0.3f, 0.7f, 1.f, 1.5f, 2.f, 3.f, 32.f, 40.f, 1e9f, -1.f, -0.5f, nan};
+    std::vector<float> inputs;
+    std::vector<fastforest::TreeEnsembleResponseType> ref;
+    for (float x0 : values) {
+        for (float x1 : values) {
+            inputs.insert(inputs.end(), {x0, x1});
+            // non-integer categories are truncated
+            const double f0Tree = inSet(x0, {0, 40}) ? 0.6 : -0.3;
+            ref.push_back((inSet(x1, {1, 3}) ? 0.4 : (x0 > 0.5f ? 0.2 : 0.1)) + f0Tree);
+            BOOST_CHECK_CLOSE(fastForest(inputs.data() + inputs.size() - 2, 0.), ref.back(), tolerance);
+        }
+    }
+
+    // the category sets survive the serialization
+    const std::size_t nRows = ref.size();
+    for (bool compress : {false, true}) {
+        fastForest.write_bin("continuous/categorical.bin", compress);
+        const auto loaded = fastforest::load_bin("continuous/categorical.bin");
+        BOOST_CHECK(loaded.categorySets_ == fastForest.categorySets_);
+        std::vector<fastforest::TreeEnsembleResponseType> out(nRows);
+        loaded.evaluate_batch(inputs.data(), nRows, 2, out.data(), 1, 0.);
+        for (std::size_t i = 0; i < nRows; ++i) {
+            BOOST_CHECK_CLOSE(out[i], ref[i], tolerance);
+        }
+    }
+
+    // interleaved and partitioned evaluation, and the complete trees, where the categorical trees stay in the regular
+    // layout
+    std::vector<fastforest::TreeEnsembleResponseType> batch(nRows);
+    std::vector<fastforest::TreeEnsembleResponseType> interleaved(nRows);
+    std::vector<fastforest::TreeEnsembleResponseType> partitioned(nRows);
+    std::vector<fastforest::TreeEnsembleResponseType> complete(nRows);
+    fastForest.evaluate_batch(inputs.data(), nRows, 2, batch.data(), 1, 0.);
+    fastForest.evaluate_batch_interleaved(inputs.data(), nRows, 2, interleaved.data(), 1, 0.);
+    const fastforest::CompleteForest completeForest(fastForest);
+    BOOST_CHECK_EQUAL(completeForest.n_padded_trees(), 0);
+    completeForest.evaluate_batch(inputs.data(), nRows, 2, complete.data());
+    BOOST_CHECK(interleaved == batch);
+    fastForest.evaluate_batch_partitioned(inputs.data(), nRows, 2, partitioned.data(), 1, 0.);
+    BOOST_CHECK(partitioned == batch);
+    std::vector<fastforest::FeatureType> columns(2 * nRows);
+    for (std::size_t i = 0; i < nRows; ++i) {
+        columns[i] = inputs[2 * i];
+        columns[nRows + i] = inputs[2 * i + 1];
+    }
+    fastForest.evaluate_batch_partitioned(columns.data(), nRows, 2, partitioned.data(), 1, 0., 2, true);
+    BOOST_CHECK(partitioned == batch);
+    for (std::size_t i = 0; i < nRows; ++i) {
+        BOOST_CHECK_SMALL(complete[i] - fastForest.metadata().baseResponse - batch[i], 1e-5f);
+    }
+
+    std::istringstream negativeCategory{"booster[0]:\n0:[f1:{-1,3}] yes=2,no=1,missing=1\n\t1:leaf=0\n\t2:leaf=1\n"};
+    BOOST_CHECK_THROW(fastforest::load_txt(negativeCategory, features), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(XGBoostJSONTest) {
+    // A binary classifier with a tree that splits on b in {1, 3} and a < 0.5, and a single-leaf tree.
+    const std::string model = R"({"learner": {
+        "attributes": {}, "feature_names": ["a", "b"], "feature_types": ["float", "c"],
+        "gradient_booster": {"name": "gbtree", "model": {
+            "gbtree_model_param": {"num_parallel_tree": "1", "num_trees": "2"},
+            "iteration_indptr": [0, 1, 2], "tree_info": [0, 0],
+            "trees": [
+                {"id": 0, "left_children": [1, 3, -1, -1, -1], "right_children": [2, 4, -1, -1, -1],
+                 "split_indices": [1, 0, 0, 0, 0], "split_conditions": [0.0, 0.5, 0.4, 0.1, 0.2],
+                 "split_type": [1, 0, 0, 0, 0], "default_left": [0, 1, 0, 0, 0],
+                 "categories": [1, 3], "categories_nodes": [0], "categories_segments": [0], "categories_sizes": [2],
+                 "tree_param": {"num_deleted": "0", "num_feature": "2", "num_nodes": "5", "size_leaf_vector": "1"}},
+                {"id": 1, "left_children": [-1], "right_children": [-1], "split_indices": [0],
+                 "split_conditions": [-2.5E-1], "split_type": [0], "default_left": [false],
+                 "categories": [], "categories_nodes": [], "categories_segments": [], "categories_sizes": [],
+                 "tree_param": {"num_deleted": "0", "num_feature": "2", "num_nodes": "1", "size_leaf_vector": "1"}}
+            ]}},
+        "learner_model_param": {"base_score": "[5E-1]", "boost_from_average": "1", "num_class": "0",
+                                "num_feature": "2", "num_target": "1"},
+        "objective": {"name": "binary:logistic", "reg_loss_param": {"scale_pos_weight": "1"}}},
+        "version": [2, 1, 0]})";
+
+    // the features are mapped by name
+    std::vector<std::string> features{"b", "a"};
+    std::istringstream modelStream{model};
+    const auto fastForest = fastforest::load_xgboost_json(modelStream, features);
+    BOOST_CHECK_EQUAL(fastForest.metadata().objective, "binary:logistic");
+    BOOST_CHECK_EQUAL(fastForest.metadata().nClasses, 1);
+    BOOST_CHECK_SMALL(fastForest.metadata().baseResponse, 1e-7f);
+
+    // XGBoost goes left if a < 0.5, so a tie goes right
+    const std::vector<std::array<float, 2>> inputs{{{1.f, 0.5f}},
+                                                   {{1.f, std::nextafter(0.5f, 0.f)}},
+                                                   {{3.f, 0.7f}},
+                                                   {{2.f, 0.7f}},
+                                                   {{std::numeric_limits<float>::quiet_NaN(), 0.f}}};
+    for (auto const& x : inputs) {
+        const double raw = (x[0] == 1.f || x[0] == 3.f ? 0.4 : (x[1] < 0.5f ? 0.1 : 0.2)) - 0.25;
+        fastforest::TreeEnsembleResponseType prediction;
+        fastForest.predict(x.data(), &prediction);
+        BOOST_CHECK_CLOSE(prediction, 1. / (1. + std::exp(-raw)), tolerance);
+    }
+
+    std::vector<std::string> wrongFeatures{"a", "c"};
+    std::istringstream wrongFeaturesStream{model};
+    BOOST_CHECK_THROW(fastforest::load_xgboost_json(wrongFeaturesStream, wrongFeatures), std::runtime_error);
+    std::istringstream truncated{model.substr(0, model.size() / 2)};
+    BOOST_CHECK_THROW(fastforest::load_xgboost_json(truncated, features), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(VectorLeafTest) {
+    // A regression with three targets: a tree with the splits a < 0.5 and b < 1.5, and a single-leaf tree.
+    const std::string model = R"({"learner": {
+        "attributes": {}, "feature_names": ["a", "b"], "feature_types": ["float", "float"],
+        "gradient_booster": {"name": "gbtree", "model": {
+            "gbtree_model_param": {"num_parallel_tree": "1", "num_trees": "2"},
+            "iteration_indptr": [0, 1, 2], "tree_info": [0, 0],
+            "trees": [
+                {"id": 0, "left_children": [1, -1, 3, -1, -1], "right_children": [2, -1, 4, -1, -1],
+                 "parents": [2147483647, 0, 0, 2, 2], "split_indices": [0, 0, 1, 0, 0],
+                 "split_conditions": [0.5, 0, 1.5, 0, 0], "default_left": [1, 0, 1, 0, 0],
+                 "base_weights": [0, 0, 0, 1, 2, 3, 0, 0, 0, -1, -2, -3, 0.5, 0.25, 0.125],
+                 "tree_param": {"num_deleted": "0", "num_feature": "2", "num_nodes": "5", "size_leaf_vector": "3"}},
+                {"id": 1, "left_children": [-1], "right_children": [-1], "parents": [2147483647],
+                 "split_indices": [0], "split_conditions": [0], "default_left": [0], "base_weights": [10, 20, 30],
+                 "tree_param": {"num_deleted": "0", "num_feature": "2", "num_nodes": "1", "size_leaf_vector": "3"}}
+            ]}},
+        "learner_model_param": {"base_score": "[5E-1,2.5E-1,0E0]", "boost_from_average": "1", "num_class": "0",
+                                "num_feature": "2", "num_target": "3"},
+        "objective": {"name": "reg:squarederror", "reg_loss_param": {"scale_pos_weight": "1"}}},
+        "version": [2, 1, 0]})";
+    std::vector<std::string> features;
+    std::istringstream modelStream{model};
+    auto fastForest = fastforest::load_xgboost_json(modelStream, features);
+    BOOST_CHECK(fastForest.metadata().vectorLeaves);
+    BOOST_CHECK_EQUAL(fastForest.metadata().nClasses, 3);
+
+    const std::vector<float> inputs{0.f, 0.f, 0.5f, 1.f, 0.7f, 1.5f, 1.f, 2.f, 0.2f, 9.f};
+    const int nRows = inputs.size() / 2;
+    std::vector<float> ref;
+    for (int iRow = 0; iRow < nRows; ++iRow) {
+        const float a = inputs[2 * iRow];
+        const float b = inputs[2 * iRow + 1];
+        const std::array<float, 3> leaf = a < 0.5f   ? std::array<float, 3>{{1.f, 2.f, 3.f}}
+                                          : b < 1.5f ? std::array<float, 3>{{-1.f, -2.f, -3.f}}
+                                                     : std::array<float, 3>{{0.5f, 0.25f, 0.125f}};
+        const std::array<float, 3> base{{0.5f, 0.25f, 0.f}};
+        for (int k = 0; k < 3; ++k) {
+            ref.push_back(base[k] + leaf[k] + 10.f * (k + 1));
+        }
+    }
+
+    auto check = [&](fastforest::FastForest const& forest) {
+        std::vector<float> out(3 * nRows);
+        forest.predict_batch(inputs.data(), nRows, 2, out.data());
+        std::vector<float> interleaved(3 * nRows);
+        forest.evaluate_batch_interleaved(
+            inputs.data(), nRows, 2, interleaved.data(), 3, forest.metadata().baseResponse, 1, 2);
+        std::vector<float> partitioned(3 * nRows);
+        forest.evaluate_batch_partitioned(
+            inputs.data(), nRows, 2, partitioned.data(), 3, forest.metadata().baseResponse);
+        for (int i = 0; i < 3 * nRows; ++i) {
+            BOOST_CHECK_CLOSE(out[i], ref[i], tolerance);
+            BOOST_CHECK_EQUAL(interleaved[i], out[i]);
+            BOOST_CHECK_EQUAL(partitioned[i], out[i]);
+        }
+        std::array<float, 3> single;
+        forest.predict(inputs.data() + 2, single.data());
+        for (int k = 0; k < 3; ++k) {
+            BOOST_CHECK_CLOSE(single[k], ref[3 + k], tolerance);
+        }
+    };
+    check(fastForest);
+    for (bool compress : {false, true}) {
+        fastForest.write_bin("continuous/vector_leaves.bin", compress);
+        check(fastforest::load_bin("continuous/vector_leaves.bin"));
+    }
+    fastForest.reorder(inputs.data(), nRows, 2);
+    check(fastForest);
+
+    // every tree contributes to all outputs
+    BOOST_CHECK_THROW(fastForest(inputs.data()), std::runtime_error);
+    BOOST_CHECK_THROW(fastForest.group_classes(3), std::runtime_error);
+    BOOST_CHECK_THROW(fastforest::InlinedForest{fastForest}, std::runtime_error);
+    std::vector<fastforest::EngineTiming> timings;
+    fastforest::AutotuneOptions options;
+    options.nRows = 64;
+    options.nRepetitions = 1;
+    const auto tuned = fastforest::autotune(fastForest, options, &timings);
+    BOOST_CHECK_EQUAL(timings.size(), 6);
+}
+
+#ifdef FASTFOREST_PROFILING
+
+BOOST_AUTO_TEST_CASE(ProfilingTest) {
+    std::vector<std::string> features{"f0", "f1", "f2", "f3", "f4"};
+
+    const auto fastForest = fastforest::load_txt("softmax/model.txt", features);
+
+    std::ifstream fileX("softmax/X.csv");
+
+    std::vector<fastforest::FeatureType> input(5);
+    std::array<fastforest::TreeEnsembleResponseType, 3> out;
+    fastforest::ForestProfile profile;
+
+    for (std::size_t i = 0; i < nSamples; ++i) {
+        for (auto& x : input) {
+            fileX >> x;
+        }
+        fastForest.profile(input.data(), out.data(), 3, profile);
+        fastforest::details::softmaxTransformInplace(out.data(), 3);
+        auto ref = fastForest.softmax<3>(input.data());
+        for (int iClass = 0; iClass < 3; ++iClass) {
+            BOOST_CHECK_EQUAL(out[iClass], ref[iClass]);
+        }
+    }
+
+    BOOST_CHECK_EQUAL(profile.nRows, nSamples);
+    unsigned long nLeafVisits = 0;
+    for (auto n : profile.leafVisits) {
+        nLeafVisits += n;
+    }
+    BOOST_CHECK_EQUAL(nLeafVisits, nSamples * fastForest.rootIndices_.size());
+    for (std::size_t iTree = 0; iTree < fastForest.rootIndices_.size(); ++iTree) {
+        int root = fastForest.rootIndices_[iTree];
+        if (root >= 0) {
+            BOOST_CHECK_EQUAL(profile.nodeVisits[root], nSamples);
+            BOOST_CHECK(profile.averagePathLength(iTree) >= 1.);
+            BOOST_CHECK(profile.averagePathLength(iTree) <= profile.treeDepths[iTree]);
+        }
+    }
+}
+
+#endif
+
 #ifdef EXPERIMENTAL_TMVA_SUPPORT
 
 BOOST_AUTO_TEST_CASE(BasicTMVAXMLTest) {
@@ -218,4 +1593,110 @@ BOOST_AUTO_TEST_CASE(BasicTMVAXMLTest) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(TMVAXMLFeatureMappingTest) {
+    // without requested features, the variable names are taken from the weight file
+    std::vector<std::string> features;
+    const auto fastForest = fastforest::load_tmva_xml("continuous/model.xml", features);
+    BOOST_CHECK((features == std::vector<std::string>{"f0", "f1", "f2", "f3", "f4"}));
+    BOOST_CHECK(fastForest.metadata().features == features);
+
+    // with the features in a different order, the cut indices are remapped accordingly
+    std::vector<std::string> reversed{features.rbegin(), features.rend()};
+    const auto reversedForest = fastforest::load_tmva_xml("continuous/model.xml", reversed);
+
+    std::ifstream fileX("continuous/X.csv");
+    std::vector<fastforest::FeatureType> input(5);
+    for (std::size_t i = 0; i < 100; ++i) {
+        for (auto& x : input) {
+            fileX >> x;
+        }
+        std::vector<fastforest::FeatureType> reversedInput{input.rbegin(), input.rend()};
+        BOOST_CHECK_EQUAL(fastForest(input.data()), reversedForest(reversedInput.data()));
+    }
+
+    std::vector<std::string> unknown{"f0", "f1"};
+    BOOST_CHECK_THROW(fastforest::load_tmva_xml("continuous/model.xml", unknown), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(TMVAXMLGradTest) {
+    std::vector<std::string> features;
+    const auto fastForest = fastforest::load_tmva_xml("continuous/model.xml", features);
+    BOOST_CHECK_EQUAL(fastForest.metadata().objective, "tmva:grad");
+
+    std::ifstream fileX("continuous/X.csv");
+    std::vector<fastforest::FeatureType> input(5);
+    for (std::size_t i = 0; i < 100; ++i) {
+        for (auto& x : input) {
+            fileX >> x;
+        }
+        // TMVA maps the sum of the tree responses to [-1, 1] without a base response
+        fastforest::TreeEnsembleResponseType prediction;
+        fastForest.predict(input.data(), &prediction);
+        BOOST_CHECK_SMALL(prediction - std::tanh(fastForest(input.data(), 0.f)), 1e-6f);
+    }
+}
+
+namespace {
+
+    // A small AdaBoost forest with two trees of different boost weights. The first tree uses the default cut type,
+    // where events with a >= 1 go to the right, and the second one the inverted cut type, where events with b < 0.5
+    // go to the right.
+    void writeAdaBoostXML(std::string const& path, bool useYesNoLeaf) {
+        std::ofstream file(path);
+        file << "<?xml version=\"1.0\"?>\n<MethodSetup Method=\"BDT::BDT\">\n"
+             << "<GeneralInfo><Info name=\"AnalysisType\" value=\"Classification\"/></GeneralInfo>\n"
+             << "<Options>\n<Option name=\"BoostType\" modified=\"Yes\">AdaBoost</Option>\n"
+             << "<Option name=\"UseYesNoLeaf\" modified=\"Yes\">" << (useYesNoLeaf ? "True" : "False")
+             << "</Option>\n</Options>\n"
+             << "<Variables NVar=\"2\">\n"
+             << "<Variable VarIndex=\"0\" Expression=\"a\" Label=\"a\" Type=\"F\"/>\n"
+             << "<Variable VarIndex=\"1\" Expression=\"b\" Label=\"b\" Type=\"F\"/>\n</Variables>\n"
+             << "<Classes NClass=\"2\"/>\n"
+             << "<Weights NTrees=\"2\" AnalysisType=\"0\">\n"
+             << "<BinaryTree type=\"DecisionTree\" boostWeight=\"2.0e+00\" itree=\"0\">\n"
+             << "<Node pos=\"s\" depth=\"0\" NCoef=\"0\" IVar=\"0\" Cut=\"1.0e+00\" cType=\"1\" res=\"0\" rms=\"0\" "
+                "purity=\"0.5\" nType=\"0\">\n"
+             << "<Node pos=\"l\" depth=\"1\" NCoef=\"0\" IVar=\"-1\" Cut=\"0\" cType=\"1\" res=\"0\" rms=\"0\" "
+                "purity=\"0.2\" nType=\"-1\"/>\n"
+             << "<Node pos=\"r\" depth=\"1\" NCoef=\"0\" IVar=\"-1\" Cut=\"0\" cType=\"1\" res=\"0\" rms=\"0\" "
+                "purity=\"0.9\" nType=\"1\"/>\n"
+             << "</Node>\n</BinaryTree>\n"
+             << "<BinaryTree type=\"DecisionTree\" boostWeight=\"1.0e+00\" itree=\"1\">\n"
+             << "<Node pos=\"s\" depth=\"0\" NCoef=\"0\" IVar=\"1\" Cut=\"5.0e-01\" cType=\"0\" res=\"0\" rms=\"0\" "
+                "purity=\"0.5\" nType=\"0\">\n"
+             << "<Node pos=\"l\" depth=\"1\" NCoef=\"0\" IVar=\"-1\" Cut=\"0\" cType=\"1\" res=\"0\" rms=\"0\" "
+                "purity=\"0.3\" nType=\"-1\"/>\n"
+             << "<Node pos=\"r\" depth=\"1\" NCoef=\"0\" IVar=\"-1\" Cut=\"0\" cType=\"1\" res=\"0\" rms=\"0\" "
+                "purity=\"0.6\" nType=\"1\"/>\n"
+             << "</Node>\n</BinaryTree>\n</Weights>\n</MethodSetup>\n";
+    }
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TMVAXMLAdaBoostTest) {
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const std::vector<std::array<float, 2>> inputs{
+        {{0.99f, 0.4f}}, {{1.f, 0.5f}}, {{1.01f, 0.6f}}, {{-3.f, 0.49f}}, {{nan, nan}}};
+
+    for (bool useYesNoLeaf : {false, true}) {
+        writeAdaBoostXML("continuous/adaboost.xml", useYesNoLeaf);
+        std::vector<std::string> features{"a", "b"};
+        const auto fastForest = fastforest::load_tmva_xml("continuous/adaboost.xml", features);
+        BOOST_CHECK_EQUAL(fastForest.metadata().objective, "tmva:adaboost");
+
+        for (auto const& x : inputs) {
+            // what TMVA's MethodBDT computes: the tree outputs averaged with the boost weights
+            bool right0 = x[0] >= 1.f;
+            bool right1 = !(x[1] >= 0.5f);
+            float out0 = useYesNoLeaf ? (right0 ? 1.f : -1.f) : (right0 ? 0.9f : 0.2f);
+            float out1 = useYesNoLeaf ? (right1 ? 1.f : -1.f) : (right1 ? 0.6f : 0.3f);
+            float ref = (2.f * out0 + out1) / 3.f;
+
+            fastforest::TreeEnsembleResponseType prediction;
+            fastForest.predict(x.data(), &prediction);
+            BOOST_CHECK_CLOSE(prediction, ref, 1e-4);
+        }
+    }
+}
+
 #endif